@@ -2,6 +2,7 @@
 
 #include <swa/config.h>
 #include <swa/private/impl.h>
+#include <swa/private/timer.h>
 #include <pthread.h>
 
 #include <android/native_activity.h>
@@ -26,6 +27,7 @@ struct swa_display_android {
 
 	struct swa_window_android* window;
 	uint64_t key_states[16]; // bitset
+	char (*key_names)[5]; // one per key in key_states, created lazily
 
 	// NOTE: could use a ringbuffer here
 	// probably not worth it
@@ -33,6 +35,7 @@ struct swa_display_android {
 	unsigned cap_events;
 	struct event* events;
 	enum swa_keyboard_mod keyboard_mods;
+	struct swa_timer_queue timers;
 
 	struct swa_egl_display* egl;
 };
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the current time of CLOCK_MONOTONIC in nanoseconds.
+int64_t swa_monotonic_ns(void);
+
+// Converts between nanoseconds and timespec.
+int64_t swa_timespec_to_ns(const struct timespec*);
+struct timespec swa_timespec_from_ns(int64_t ns);
+
+// Expands a wrapping 32-bit millisecond timestamp (as used by X11 and
+// wayland input events) to a full CLOCK_MONOTONIC timestamp in
+// microseconds. Since the clock domain of those timestamps isn't
+// strictly specified, falls back to the current time if the timestamp
+// doesn't seem to originate from CLOCK_MONOTONIC.
+uint64_t swa_event_time_usec(uint32_t ms);
+
+// Converts the given timeout in nanoseconds to a poll timeout in
+// milliseconds. Rounds up so that a poll with the returned timeout
+// never returns before the timeout has elapsed.
+// Negative values will result in -1 (infinite timeout).
+// Inline since it's also used by the winapi backend, which doesn't
+// build clock.c.
+static inline int swa_timeout_ns_to_ms(int64_t timeout_ns) {
+	if(timeout_ns < 0) {
+		return -1;
+	}
+
+	int64_t ms = (timeout_ns + 1000 * 1000 - 1) / (1000 * 1000);
+	return ms > INT_MAX ? INT_MAX : (int) ms;
+}
+
+// Logs (as debug output) the time elapsed since *last for the given
+// step and sets *last to the current time. Used for the startup
+// timing breakdowns of the backends.
+void swa_log_elapsed(int64_t* last, const char* step);
+
+#ifdef __cplusplus
+}
+#endif
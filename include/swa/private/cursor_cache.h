@@ -0,0 +1,89 @@
+#pragma once
+
+#include <swa/swa.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Limits for the display cursor cache. Entries used by a window are
+// never evicted, the limits may therefore be exceeded temporarily.
+#define SWA_CURSOR_CACHE_MAX_SIZE (4u * 1024u * 1024u)
+#define SWA_CURSOR_CACHE_MAX_COUNT 64u
+
+// Identifies the content of a cursor. Image cursors are identified
+// by their pixel data (looked up via its hash), all other cursors
+// just by type.
+struct swa_cursor_key {
+	enum swa_cursor_type type;
+
+	// only for swa_cursor_image
+	uint64_t hash;
+	unsigned width, height;
+	int hx, hy;
+	enum swa_image_format format;
+	// Pixel data. References the cursor image for keys created with
+	// swa_cursor_key_init, entries own a tightly packed copy.
+	const uint8_t* data;
+	unsigned stride;
+};
+
+struct swa_cursor_cache_entry {
+	// LRU list, most recently used first
+	struct swa_cursor_cache_entry* prev;
+	struct swa_cursor_cache_entry* next;
+
+	struct swa_cursor_key key;
+	size_t size; // approximate (server-side) memory used by the resource
+	unsigned refs; // number of windows currently using the entry
+
+	// backend resource, depending on the backend a pointer or an id
+	void* data;
+	uint32_t id;
+	int hx, hy; // hotspot of the resource, set by the backend if needed
+};
+
+// Display-level cache of cursor resources, shared between all windows.
+// Backends look up the cursor on swa_window_set_cursor and only create
+// the resource if it is not found.
+struct swa_cursor_cache {
+	struct swa_cursor_cache_entry* first;
+	struct swa_cursor_cache_entry* last;
+	size_t size;
+	unsigned count;
+
+	// Destroys the backend resource of the given entry.
+	void (*destroy)(struct swa_cursor_cache*, struct swa_cursor_cache_entry*);
+	void* data;
+};
+
+// Computes the key for the given cursor. For image cursors, this hashes
+// the image content. The key references the image data, it must stay
+// valid as long as the key is used.
+void swa_cursor_key_init(struct swa_cursor_key*, const struct swa_cursor*);
+
+// Returns the entry matching the given key and marks it as most recently
+// used. Returns NULL if there is none.
+struct swa_cursor_cache_entry* swa_cursor_cache_find(
+	struct swa_cursor_cache*, const struct swa_cursor_key*);
+
+// Adds a new (unreferenced) entry. The caller is responsible for setting
+// the backend resource of the returned entry.
+struct swa_cursor_cache_entry* swa_cursor_cache_insert(
+	struct swa_cursor_cache*, const struct swa_cursor_key*, size_t size);
+
+// Makes the given slot (e.g. the cursor of a window) reference `entry`
+// instead of its previous entry. Both may be NULL.
+// Afterwards, evicts least recently used, unreferenced entries until the
+// cache is within its limits.
+void swa_cursor_cache_set(struct swa_cursor_cache*,
+	struct swa_cursor_cache_entry** slot, struct swa_cursor_cache_entry* entry);
+
+// Destroys all entries.
+void swa_cursor_cache_finish(struct swa_cursor_cache*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <swa/swa.h>
+#include <swa/private/post.h>
+#include <swa/private/offer_cache.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,6 +11,7 @@ extern "C" {
 struct swa_display_interface {
 	void (*destroy)(struct swa_display*);
 	bool (*dispatch)(struct swa_display*, bool block);
+	bool (*dispatch_timeout)(struct swa_display*, int64_t timeout_ns);
 	void (*wakeup)(struct swa_display*);
 	enum swa_display_cap (*capabilities)(struct swa_display*);
 	const char** (*vk_extensions)(struct swa_display*, unsigned* count);
@@ -25,6 +28,9 @@ struct swa_display_interface {
 	struct swa_window* (*create_window)(struct swa_display*,
 		const struct swa_window_settings*);
 	swa_proc (*get_gl_proc_addr)(struct swa_display*, const char*);
+	struct swa_timer* (*add_timer)(struct swa_display*, int64_t deadline,
+		swa_timer_handler, void* userdata);
+	void (*flush)(struct swa_display*); // optional
 };
 
 struct swa_window_interface {
@@ -56,6 +62,9 @@ struct swa_window_interface {
 	void (*apply_buffer)(struct swa_window*);
 
 	void (*lock_pointer)(struct swa_window*, bool);
+	void (*set_draw_scheduling)(struct swa_window*, bool, uint64_t margin);
+	// optional, called after the listener was changed
+	void (*update_listener)(struct swa_window*);
 
 	void* (*native_handle)(struct swa_window*);
 };
@@ -64,6 +73,8 @@ struct swa_data_offer_interface {
 	void (*destroy)(struct swa_data_offer*);
 	bool (*formats)(struct swa_data_offer*, swa_formats_handler cb);
 	bool (*data)(struct swa_data_offer*, const char* format, swa_data_handler cb);
+	bool (*data_stream)(struct swa_data_offer*, const char* format,
+		swa_data_stream_handler cb); // optional
 	void (*set_preferred)(struct swa_data_offer*, const char* format,
 		enum swa_data_action action);
 	enum swa_data_action (*action)(struct swa_data_offer*);
@@ -72,6 +83,8 @@ struct swa_data_offer_interface {
 
 struct swa_display {
 	const struct swa_display_interface* impl;
+	enum swa_flush_policy flush_policy;
+	struct swa_post_queue posted;
 };
 
 struct swa_window {
@@ -80,9 +93,12 @@ struct swa_window {
 	void* userdata;
 };
 
+// Implementations must call swa_offer_cache_finish on `cache`
+// when destroying the offer.
 struct swa_data_offer {
 	const struct swa_data_offer_interface* impl;
 	void* userdata;
+	struct swa_offer_cache cache;
 };
 
 #ifdef __cplusplus
@@ -4,7 +4,7 @@
 //  - support for touch
 //  - support for keyboard key repeat (see wayland)
 // TODO: support for animated cursors (see wayland)
-// TODO: cursor plane support for vulkan
+// TODO: cursor support for vulkan
 // TODO: add extra compile time flag for gl support in drm backend?
 //   something like SWA_WITH_GBM?
 // TODO: multi output support
@@ -25,6 +25,9 @@
 #include <swa/private/kms/props.h>
 #include <swa/private/impl.h>
 #include <swa/private/xkb.h>
+#include <swa/private/timer.h>
+#include <swa/private/sched.h>
+#include <swa/private/cursor_cache.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -45,6 +48,9 @@ struct swa_display_kms {
 
 	int wakeup_pipe_w, wakeup_pipe_r;
 	struct pml_io* wakeup_io;
+	struct pml_timer* dispatch_timer; // for dispatch_timeout
+	struct pml_timer* timers_source; // armed for the next timer
+	struct swa_timer_queue timers;
 	bool quit;
 
 	struct {
@@ -82,6 +88,7 @@ struct swa_display_kms {
 			struct swa_window_kms* focus;
 			struct xkb_keymap* keymap;
 			struct xkb_state* state;
+			struct swa_xkb_key_names names;
 			enum swa_keyboard_mod mods;
 			uint64_t key_states[16]; // bitset
 		} keyboard;
@@ -92,6 +99,13 @@ struct swa_display_kms {
 			double y;
 			struct swa_window_kms* over;
 			uint64_t button_states; // bitset
+
+			// Merged motion not yet forwarded to the window.
+			struct {
+				bool pending;
+				int x, y; // last forwarded position
+				uint64_t time_usec; // time of the last merged event
+			} motion;
 		} pointer;
 
 		struct {
@@ -100,11 +114,20 @@ struct swa_display_kms {
 	} input;
 
 	struct swa_xcursor_theme* cursor_theme;
+	struct swa_cursor_cache cursor_cache;
+	// size of cursor buffers, queried on first use
+	unsigned cursor_width, cursor_height;
 
 	struct gbm_device* gbm_device;
 	struct swa_egl_display* egl;
 };
 
+enum swa_kms_commit {
+	swa_kms_commit_none,
+	swa_kms_commit_flip, // primary plane flip, possibly including the cursor
+	swa_kms_commit_cursor, // cursor plane only
+};
+
 struct swa_kms_output {
 	struct swa_window_kms* window; // only set when there is a window for output
 
@@ -127,12 +150,33 @@ struct swa_kms_output {
 		union drm_plane_props props;
 	} primary_plane;
 
-	/*
+	// When there is no cursor plane (id is 0), the legacy cursor
+	// api is used.
 	struct {
 		uint32_t id;
 		union drm_plane_props props;
 	} cursor_plane;
-	*/
+
+	// Cursor state not yet committed. Pointer motion only updates
+	// this, it's committed at most once per vblank or together with
+	// the next pageflip.
+	struct {
+		bool dirty;
+		bool buffer_changed; // only tracked for the legacy api
+		struct swa_kms_dumb_buffer* buffer; // NULL when hidden
+		int32_t x, y;
+	} cursor;
+
+	// The atomic commit currently in flight. There can only be one.
+	enum swa_kms_commit commit;
+
+	// Flip requested while a cursor commit was in flight.
+	// Will be committed as soon as that completes. fb_id is 0 if there
+	// is none.
+	struct {
+		uint32_t fb_id;
+		uint64_t width, height;
+	} deferred_flip;
 };
 
 // Dumb buffers always have linear format mod and drm XRGB8888 format
@@ -172,17 +216,15 @@ struct swa_kms_gl_surface {
 };
 
 struct swa_kms_buffer_cursor {
-	unsigned width;
-	unsigned height;
-	int hx;
-	int hy;
-	struct swa_kms_dumb_buffer buffer;
-	bool update;
+	// The cursor buffer, shared with other windows (data is a
+	// swa_kms_dumb_buffer). NULL when the window has no cursor.
+	struct swa_cursor_cache_entry* entry;
 };
 
 enum swa_kms_defer {
 	swa_kms_defer_draw = (1u << 0),
 	swa_kms_defer_size = (1u << 1),
+	swa_kms_defer_cursor = (1u << 2),
 };
 
 struct swa_window_kms {
@@ -193,6 +235,7 @@ struct swa_window_kms {
 	bool redraw;
 	struct pml_defer* defer;
 	enum swa_kms_defer defer_events;
+	struct swa_draw_sched sched;
 
 	enum swa_surface_type surface_type;
 	union {
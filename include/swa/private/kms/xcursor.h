@@ -26,6 +26,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -49,10 +50,18 @@ struct swa_xcursor {
 
 // Container for an Xcursor theme.
 struct swa_xcursor_theme {
+	// Cursors loaded so far. Also contains cursors that weren't found
+	// (with an image_count of zero).
 	unsigned int cursor_count;
 	struct swa_xcursor **cursors;
 	char *name;
 	int size;
+
+	// Cursor directories of the theme and the themes it inherits from,
+	// in lookup order. Built on the first cursor lookup.
+	bool indexed;
+	unsigned int dir_count;
+	char **dirs;
 };
 
 // Loads the named xcursor theme at the given cursor size (in pixels). This is
@@ -60,10 +69,13 @@ struct swa_xcursor_theme {
 // client-side cursors is not available or you wish to override client-side
 // cursors for a particular UI interaction (such as using a grab cursor when
 // moving a window around).
+// Does not touch the filesystem, the theme is indexed on the first
+// cursor lookup and every cursor is only loaded when first requested.
 struct swa_xcursor_theme* swa_xcursor_theme_load(const char *name, int size);
 void swa_xcursor_theme_destroy(struct swa_xcursor_theme *theme);
 
-// Obtains a swa_xcursor image for the specified cursor name (e.g. "left_ptr")
+// Obtains a swa_xcursor image for the specified cursor name (e.g. "left_ptr").
+// Returns NULL if the theme doesn't have such a cursor.
 struct swa_xcursor* swa_xcursor_theme_get_cursor(
 	struct swa_xcursor_theme* theme, const char* name);
 
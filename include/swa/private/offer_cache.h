@@ -0,0 +1,40 @@
+#pragma once
+
+#include <swa/swa.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct swa_offer_cache_entry {
+	const char* format; // owned
+	struct swa_exchange_data data; // owned
+};
+
+// Data already received from a data offer, by format. Lives as long as
+// the offer, i.e. it is invalidated together with the selection it
+// represents. See swa_data_offer_set_cache.
+struct swa_offer_cache {
+	bool enabled;
+	unsigned n_entries;
+	struct swa_offer_cache_entry* entries;
+	// application handler of the pending data request, called
+	// after the received data was stored
+	swa_data_handler pending;
+};
+
+// Returns the cached data for the given format or NULL.
+const struct swa_exchange_data* swa_offer_cache_find(
+	const struct swa_offer_cache*, const char* format);
+
+// Stores a copy of the given data. Returns false if allocation failed.
+bool swa_offer_cache_insert(struct swa_offer_cache*, const char* format,
+	struct swa_exchange_data data);
+
+// Frees all cached data.
+void swa_offer_cache_finish(struct swa_offer_cache*);
+
+#ifdef __cplusplus
+}
+#endif
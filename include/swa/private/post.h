@@ -0,0 +1,38 @@
+#pragma once
+
+#include <swa/swa.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct swa_posted {
+	struct swa_posted* next;
+	swa_post_handler handler;
+	void* data;
+};
+
+// Lock-free multi-producer single-consumer queue of closures.
+// Any thread may push, only the thread dispatching the display may run
+// or finish the queue. Internally a stack, the consumer takes all
+// entries at once and reverses them to restore submission order.
+struct swa_post_queue {
+	struct swa_posted* head; // only accessed atomically
+};
+
+// Pushes the given closure. Returns true if the queue was empty before,
+// i.e. if the caller has to wake up the consumer. Wakeups for following
+// pushes are only needed again once the consumer took the entries.
+bool swa_post_queue_push(struct swa_post_queue*, struct swa_posted*);
+
+// Calls the handlers of all entries pushed until now, in order.
+// Entries pushed by the handlers themselves are not run.
+void swa_post_queue_run(struct swa_post_queue*, struct swa_display*);
+
+// Frees all pending entries without calling them.
+void swa_post_queue_finish(struct swa_post_queue*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <swa/swa.h>
+#include <swa/private/timer.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deadline-aware draw scheduling, see `swa_window_set_draw_scheduling`.
+// Instead of emitting the draw event as soon as the backend allows
+// a new frame (frame callback, present notify, page flip) it is delayed
+// until (predicted next vblank - budget). The budget is a decaying peak
+// of the measured draw durations plus a fixed margin for the
+// compositor/driver.
+struct swa_draw_sched {
+	bool enabled;
+	int64_t margin;
+
+	// information from the last presentation feedback, 0 if unknown
+	int64_t last_present;
+	int64_t refresh;
+
+	int64_t peak; // decaying peak draw duration; 0 if not measured yet
+	int64_t draw_start; // start of the current draw; 0 if not drawing
+
+	struct swa_timer* timer; // lazily created
+};
+
+void swa_draw_sched_finish(struct swa_draw_sched*);
+
+// Feeds presentation feedback into the scheduler.
+void swa_draw_sched_presented(struct swa_draw_sched*,
+	const struct swa_present_event*);
+
+// Must be called immediately before the draw event is emitted and when
+// the contents of a frame are applied (i.e. on surface_frame),
+// respectively. Used to measure the draw duration.
+void swa_draw_sched_begin(struct swa_draw_sched*);
+void swa_draw_sched_end(struct swa_draw_sched*);
+
+// To be called when the backend would emit a draw event for a new frame.
+// Returns false if the draw event should be emitted immediately.
+// Otherwise arms a timer on the given queue that will call the given
+// handler (with the given data as timer userdata) and returns true.
+bool swa_draw_sched_defer(struct swa_draw_sched*,
+	struct swa_timer_queue*, swa_timer_handler, void* data);
+
+// Returns whether a deferred draw event is pending.
+bool swa_draw_sched_pending(struct swa_draw_sched*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <swa/swa.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct swa_timer_queue;
+
+struct swa_timer {
+	struct swa_timer_queue* queue;
+	struct swa_timer* next;
+	struct swa_timer* prev;
+
+	int64_t deadline; // CLOCK_MONOTONIC ns; negative when disarmed
+	int64_t slack;
+	unsigned fired; // queue generation in which it was last dispatched
+
+	swa_timer_handler handler;
+	void* userdata;
+};
+
+// Shared timer implementation for backends. Backends only have to
+// wake up at `swa_timer_queue_next` and then call `swa_timer_queue_dispatch`.
+struct swa_timer_queue {
+	struct swa_timer* first;
+	unsigned generation;
+
+	// Called whenever the next wakeup time of the queue might
+	// have changed. Can be NULL, backends that compute their poll timeout
+	// via `swa_timer_queue_next` before every wait don't need it.
+	void (*update)(struct swa_timer_queue*);
+	void* data;
+};
+
+struct swa_timer* swa_timer_create(struct swa_timer_queue*,
+	int64_t deadline, swa_timer_handler, void* userdata);
+
+// Returns the timepoint at which the backend has to wake up to dispatch
+// the next timers. Returns a negative value if there are no armed timers.
+int64_t swa_timer_queue_next(struct swa_timer_queue*);
+
+// Dispatches all timers whose deadline is before the given timepoint.
+// Timers that are re-armed from within their handler to an already
+// expired deadline are dispatched in the next call.
+void swa_timer_queue_dispatch(struct swa_timer_queue*, int64_t now);
+
+// Destroys all timers in the queue.
+void swa_timer_queue_finish(struct swa_timer_queue*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,6 +2,9 @@
 
 #include <swa/private/impl.h>
 #include <swa/private/xkb.h>
+#include <swa/private/timer.h>
+#include <swa/private/sched.h>
+#include <swa/private/cursor_cache.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -27,11 +30,15 @@ struct swa_display_wl {
 	struct zxdg_exporter_v2* xdg_exporter;
 	struct zxdg_importer_v2* xdg_importer;
 	struct zwp_pointer_constraints_v1* pointer_constraints;
+	struct wp_presentation* presentation;
 	struct zwp_relative_pointer_manager_v1* relative_pointer_manager;
 
 	struct wl_keyboard* keyboard;
 	struct wl_pointer* pointer;
-	struct wl_touch* touch;
+	struct wl_touch* touch; // only while n_touch_windows > 0
+	uint32_t seat_caps;
+	// number of windows whose listener handles touch events
+	unsigned n_touch_windows;
 	struct wl_data_device* data_dev;
 	struct zwp_relative_pointer_v1* relative_pointer;
 
@@ -39,11 +46,17 @@ struct swa_display_wl {
 	bool error;
 	bool ready;
 
+	// clock used by the compositor for presentation timestamps
+	clockid_t presentation_clock;
+
 	struct swa_xkb_context xkb;
 
 	const char* appname;
 	int wakeup_pipe_w, wakeup_pipe_r;
 	struct pml_io* wakeup_io;
+	struct pml_timer* dispatch_timer; // for dispatch_timeout
+	struct pml_timer* timers_source; // armed for the next timer
+	struct swa_timer_queue timers;
 	uint64_t key_states[16]; // bitset
 	uint64_t mouse_button_states; // bitset
 	int mouse_x, mouse_y;
@@ -60,6 +73,8 @@ struct swa_display_wl {
 		struct wl_callback* frame_callback;
 		struct wl_cursor* active;
 		bool redraw;
+		// image cursors, shared between windows
+		struct swa_cursor_cache cache;
 	} cursor;
 
 	struct {
@@ -89,6 +104,7 @@ struct swa_display_wl {
 
 	struct swa_data_offer_wl* data_offer_list;
 	struct swa_data_offer_wl* selection;
+	struct swa_data_source_wl* data_source_list;
 
 	struct swa_egl_display* egl;
 };
@@ -125,6 +141,13 @@ struct swa_wl_vk_surface {
 	swa_proc destroy_surface_pfn;
 };
 
+// Pending presentation feedback for a committed frame.
+struct swa_wl_feedback {
+	struct swa_window_wl* win;
+	struct wp_presentation_feedback* feedback;
+	struct swa_wl_feedback* next;
+};
+
 enum swa_wl_defer {
 	swa_wl_defer_draw = (1u << 0),
 	swa_wl_defer_size = (1u << 1),
@@ -149,6 +172,7 @@ struct swa_window_wl {
 	bool pointer_locked;
 
 	struct wl_callback* frame_callback;
+	struct swa_wl_feedback* feedbacks; // linked list
 	// whether the window received at least one toplevel configure event
 	// if this is true, the width and height are just the values this
 	// window was constructed with
@@ -162,16 +186,25 @@ struct swa_window_wl {
 	uint32_t decoration_mode;
 	enum swa_window_state state;
 	struct pml_defer* defer_redraw;
+	struct swa_draw_sched sched;
+
+	// Visibility tracking. We consider a window invisible when it is
+	// suspended (xdg_toplevel) or the compositor hasn't sent a frame
+	// callback for a while, see frame_stall_timeout in wayland.c.
+	bool suspended;
+	bool frame_stalled;
+	bool visible; // last reported state
+	struct swa_timer* frame_timer; // lazily created
+	// whether this window is counted in dpy->n_touch_windows
+	bool touch_listener;
 
 	struct {
 		// if this is != NULL, this window has a native cursor that
 		// can be animated, that will be used.
 		struct wl_cursor* native;
-		// Otherwise, will use the wl_buffer in this buffer.
+		// Otherwise, will use this image cursor (data is a swa_wl_buffer).
 		// If that is NULL, the window has no cursor.
-		struct swa_wl_buffer buffer;
-		// Cursor hotspot only relevant when using the buffer.
-		int hx, hy;
+		struct swa_cursor_cache_entry* image;
 	} cursor;
 
 	enum swa_surface_type surface_type;
@@ -202,12 +235,44 @@ struct swa_data_offer_wl {
 		const char* format;
 		int fd;
 		swa_data_handler handler;
+		swa_data_stream_handler stream; // only one of handler, stream set
 		uint64_t n_bytes;
-		char* bytes;
+		uint64_t cap; // allocated size of bytes
+		char* bytes; // accumulated data or scratch buffer when streaming
 		struct pml_io* io;
 	} data;
 };
 
+// Wraps an application-provided swa_data_source.
+// Kept alive until the compositor cancelled it and all pending
+// transfers have finished.
+struct swa_data_source_wl {
+	struct swa_display_wl* dpy;
+	struct swa_data_source* source;
+	struct wl_data_source* wl_source; // NULL once cancelled
+
+	// they form a linked list
+	struct swa_data_source_wl* next;
+	struct swa_data_source_wl* prev;
+
+	struct swa_data_transfer_wl* transfers;
+};
+
+// A single send request of a data source, written asynchronously
+// whenever the receiving side is ready for more data.
+struct swa_data_transfer_wl {
+	struct swa_data_source_wl* source;
+	struct swa_data_transfer_wl* next;
+	struct swa_data_transfer_wl* prev;
+
+	struct pml_io* io;
+	int fd; // receiving end
+	int src_fd; // fd returned by the data_fd source hook or -1
+	bool sendfile; // splice not supported for src_fd
+	struct swa_exchange_data data; // used when there is no src_fd
+	uint64_t offset;
+};
+
 #ifdef __cplusplus
 }
 #endif
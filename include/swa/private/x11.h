@@ -3,6 +3,9 @@
 #include <swa/swa.h>
 #include <swa/private/impl.h>
 #include <swa/private/xkb.h>
+#include <swa/private/timer.h>
+#include <swa/private/sched.h>
+#include <swa/private/cursor_cache.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/present.h>
 
@@ -14,11 +17,52 @@ extern "C" {
 typedef struct _XDisplay Display;
 typedef struct xcb_cursor_context_t xcb_cursor_context_t;
 
+// Number of recently issued requests we remember to map asynchronous
+// errors back to the swa call that caused them.
+#define SWA_X11_TRACKED_REQUESTS 32u
+
+struct swa_x11_request {
+	uint32_t sequence;
+	const char* name;
+};
+
+// Open addressing hash map (linear probing) from xcb_window_t to
+// swa_window_x11, used to route events to windows in constant time.
+struct swa_x11_window_map {
+	unsigned capacity; // power of two or zero
+	unsigned count;
+	struct swa_window_x11** slots;
+};
+
+// Visual chosen for a combination of the window settings that
+// are relevant for choosing it, see find_visual.
+struct swa_x11_visual_choice {
+	// key
+	bool buffer;
+	enum swa_image_format preferred_format; // only relevant for buffer
+	bool transparent;
+
+	xcb_visualtype_t* visualtype; // NULL if there is no valid visual
+	unsigned depth;
+	unsigned scanline_pad;
+	enum swa_image_format format;
+};
+
+// Colormap shared between all windows using the same visual.
+struct swa_x11_colormap {
+	xcb_visualid_t visual;
+	xcb_colormap_t colormap;
+	unsigned refs;
+};
+
 struct swa_display_x11 {
 	struct swa_display base;
 	bool error;
 
+	// Only set when xlib is needed, see xlib_display in x11.c.
+	// xlib_conn: whether conn belongs to the xlib display
 	Display* display;
+	bool xlib_conn;
 	xcb_connection_t* conn;
 	xcb_ewmh_connection_t ewmh;
 	xcb_screen_t* screen;
@@ -26,13 +70,47 @@ struct swa_display_x11 {
 	const xcb_generic_event_t* curr_event; // only for public api
 	xcb_generic_event_t* next_event;
 
+	// Requests are usually not checked synchronously, errors are
+	// reported when dispatching. With SWA_X11_SYNC set in the environment
+	// all tracked requests are checked immediately, for debugging.
+	bool sync_requests;
+	unsigned request_head; // next slot in the requests ring buffer
+	struct swa_x11_request requests[SWA_X11_TRACKED_REQUESTS];
+
 	xcb_window_t dummy_window;
-	struct swa_window_x11* window_list;
+	struct swa_window_x11* window_list; // linked list, newest first
+	// Queue of windows with a refresh requested via swa_window_refresh.
+	// Their draw events are emitted at the end of the current (or next)
+	// dispatch, without going through the server.
+	struct {
+		struct swa_window_x11* first;
+		struct swa_window_x11* last;
+	} deferred_draws;
+	struct swa_x11_window_map window_map;
 	struct swa_window_x11* focus;
+	struct swa_timer_queue timers;
 
-	unsigned n_cursors;
-	struct swa_x11_cursor* cursors;
+	struct swa_cursor_cache cursors;
 	struct swa_egl_display* egl;
+	bool egl_xcb; // whether egl uses the xcb platform
+	xcb_cursor_context_t* cursor_context; // lazily created
+
+	// window creation usually uses the same few settings, so we
+	// don't have to iterate all visuals or create a colormap each time
+	struct {
+		unsigned n_choices;
+		struct swa_x11_visual_choice* choices;
+		unsigned n_colormaps;
+		struct swa_x11_colormap* colormaps;
+	} visuals;
+
+	struct {
+		struct swa_data_offer_x11* offer; // current clipboard offer
+		struct swa_data_source_x11* source; // clipboard source we own
+		// all sources, including old ones with pending transfers
+		struct swa_data_source_x11* sources;
+		uint32_t chunk_size; // maximum bytes sent per property change
+	} selection;
 
 	struct {
 		unsigned x,y;
@@ -54,12 +132,16 @@ struct swa_display_x11 {
 		uint8_t xpresent;
 		uint8_t xinput;
 		uint8_t xkb;
+		uint8_t xfixes; // first event
 		bool shm;
 	} ext;
 
 	struct {
 		xcb_atom_t clipboard;
 		xcb_atom_t targets;
+		xcb_atom_t incr;
+		xcb_atom_t swa_selection; // property we receive selection data in
+		xcb_atom_t swa_targets; // property we receive selection targets in
 		xcb_atom_t text;
 		xcb_atom_t utf8_string;
 		xcb_atom_t file_name;
@@ -130,11 +212,24 @@ struct swa_window_x11 {
 	xcb_window_t window;
 	xcb_colormap_t colormap;
 	xcb_visualtype_t* visualtype;
-	xcb_cursor_t cursor;
+	struct swa_cursor_cache_entry* cursor; // NULL for the default cursor
 	unsigned depth;
 	bool client_decorated;
 	bool init_size_pending;
 
+	// see swa_display_x11.deferred_draws
+	bool draw_deferred;
+	struct swa_window_x11* next_deferred;
+
+	// see update_visibility
+	struct {
+		bool mapped;
+		bool obscured; // fully obscured, from VisibilityNotify
+		bool hidden; // _NET_WM_STATE_HIDDEN, e.g. minimized
+		bool visible; // last reported state
+		bool redraw; // a draw was requested while not visible
+	} visibility;
+
 	// only when using present extension:
 	struct {
 		// whether we asked the server to notify us on vsync
@@ -146,8 +241,14 @@ struct swa_window_x11 {
 		// the msc (counter) we want to get notified for redrawing
 		uint64_t target_msc;
 		uint32_t serial;
+		// ust (microseconds) and msc of the last complete notify,
+		// used to estimate the refresh interval
+		uint64_t last_ust;
+		uint64_t last_msc;
 	} present;
 
+	struct swa_draw_sched sched;
+
 	bool send_draw;
 	bool send_resize;
 
@@ -162,6 +263,62 @@ struct swa_window_x11 {
 	};
 };
 
+// A selection owned by another client (or ourselves), e.g. the clipboard.
+struct swa_data_offer_x11 {
+	struct swa_data_offer base;
+	struct swa_display_x11* dpy;
+	xcb_atom_t selection;
+	xcb_window_t owner;
+
+	// formats are only known after the TARGETS conversion finished
+	bool formats_known;
+	unsigned n_formats;
+	const char** formats;
+	xcb_atom_t* format_atoms; // parallel to formats
+	swa_formats_handler formats_handler;
+
+	struct {
+		const char* format;
+		swa_data_handler handler;
+		swa_data_stream_handler stream; // only one of handler, stream set
+		bool incr; // receiving chunks via the INCR protocol
+		uint64_t n_bytes;
+		uint64_t cap;
+		char* bytes;
+	} data;
+};
+
+// Answer to a selection request. Small data is written at once, larger
+// data in chunks via the INCR protocol, each chunk written when the
+// requestor deleted the previous one.
+struct swa_x11_selection_transfer {
+	struct swa_x11_selection_transfer* next;
+	xcb_window_t requestor;
+	xcb_atom_t property;
+	xcb_atom_t target;
+	struct swa_exchange_data data;
+	uint64_t offset;
+};
+
+// Wraps an application-provided swa_data_source we own a selection for.
+// Kept alive after losing ownership until pending transfers finished.
+struct swa_data_source_x11 {
+	struct swa_display_x11* dpy;
+	struct swa_data_source* source;
+	xcb_atom_t selection; // XCB_ATOM_NONE once ownership was lost
+
+	// they form a linked list
+	struct swa_data_source_x11* next;
+	struct swa_data_source_x11* prev;
+
+	// targets we advertise and the source format they map to
+	unsigned n_targets;
+	xcb_atom_t* targets;
+	const char** target_formats;
+
+	struct swa_x11_selection_transfer* transfers;
+};
+
 #ifdef __cplusplus
 }
 #endif
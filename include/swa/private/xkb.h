@@ -9,15 +9,41 @@
 extern "C" {
 #endif
 
+// Size of the buffer swa_xkb_key writes text input into. Even composed
+// text is usually just a few bytes.
+#define SWA_XKB_TEXT_SIZE 64u
+
+// Key names of a keymap, filled lazily by swa_xkb_key_name_keymap.
+// Holds a reference on the keymap it was filled for so that a new
+// keymap is reliably detected.
+struct swa_xkb_key_names {
+	struct xkb_keymap* keymap;
+	struct xkb_state* state; // nothing pressed
+	uint8_t known[32]; // bitset over all 256 xkb keycodes
+	char names[256][8];
+};
+
 struct swa_xkb_context {
 	struct xkb_context* context;
 	struct xkb_keymap* keymap;
 	struct xkb_state* state;
 
+	// Loading the compose table is expensive (it parses the Compose
+	// file of the locale) so it is loaded lazily by swa_xkb_key when
+	// it's needed for the first time.
 	struct xkb_compose_table* compose_table;
 	struct xkb_compose_state* compose_state;
+	bool compose_failed; // don't retry
+
+	struct swa_xkb_key_names names;
 };
 
+// Like xkb_keymap_new_from_names but uses an on-disk cache of compiled
+// keymaps, keyed by the (resolved) names and xkeyboard-config version.
+// Setting SWA_XKB_NO_CACHE in the environment disables the cache.
+struct xkb_keymap* swa_xkb_keymap_new_from_names(struct xkb_context*,
+	const struct xkb_rule_names*);
+
 bool swa_xkb_init_default(struct swa_xkb_context*);
 bool swa_xkb_init_compose(struct swa_xkb_context*);
 void swa_xkb_finish(struct swa_xkb_context*);
@@ -26,13 +52,18 @@ void swa_xkb_finish(struct swa_xkb_context*);
 enum swa_keyboard_mod swa_xkb_modifiers(struct swa_xkb_context*);
 enum swa_keyboard_mod swa_xkb_modifiers_state(struct xkb_state*);
 
-// Returns the null-terminated utf8 text input generated by this
-// in *out_utf8 if there is any. Must be freed.
+// Writes the null-terminated utf8 text input generated by this key
+// into the given buffer and returns it, or returns NULL if there is none.
 // Returns whether a compose sequence was canceled in *cancelled.
-void swa_xkb_key(struct swa_xkb_context*, uint8_t keycode,
-	char** out_utf8, bool* canceled);
+const char* swa_xkb_key(struct swa_xkb_context*, uint8_t keycode,
+	char buf[static SWA_XKB_TEXT_SIZE], bool* canceled);
+
+// The returned names are owned by the cache and remain valid until
+// the keymap changes or the cache is finished.
 const char* swa_xkb_key_name(struct swa_xkb_context*, enum swa_key);
-const char* swa_xkb_key_name_keymap(struct xkb_keymap*, enum swa_key);
+const char* swa_xkb_key_name_keymap(struct swa_xkb_key_names*,
+	struct xkb_keymap*, enum swa_key);
+void swa_xkb_key_names_finish(struct swa_xkb_key_names*);
 void swa_xkb_update_state(struct swa_xkb_context*, int mods[3],
 	int layouts[3]);
 
@@ -17,8 +17,11 @@ struct swa_window;
 struct swa_data_offer;
 struct swa_data_source;
 struct swa_window_listener;
+struct swa_timer;
 
 typedef void (*swa_proc)(void);
+typedef void (*swa_timer_handler)(struct swa_timer*);
+typedef void (*swa_post_handler)(struct swa_display*, void* data);
 
 // When this value is specified as size in swa_window_settings,
 // the system default will be used.
@@ -64,6 +67,8 @@ enum swa_display_cap {
 	swa_display_cap_client_decoration = (1 << 8),
 	swa_display_cap_server_decoration = (1 << 9),
 	swa_display_cap_child_windows = (1 << 10),
+	// whether the display supports timers, see `swa_display_add_timer`
+	swa_display_cap_timers = (1 << 11),
 };
 
 // Keyboard modifier.
@@ -170,6 +175,21 @@ enum swa_preference {
 	swa_preference_no,
 };
 
+// Controls when requests are sent to the display server.
+// See `swa_display_set_flush_policy`.
+enum swa_flush_policy {
+	// Requests are flushed when dispatching, before waiting for events
+	// and after all events were handled. The default.
+	swa_flush_policy_dispatch = 0,
+	// Requests are additionally flushed right after every swa function
+	// that issues visible requests (e.g. window changes, committing a frame).
+	// Lowest latency outside of dispatch but the most syscalls.
+	swa_flush_policy_immediate,
+	// Requests are only flushed on `swa_display_flush` and when
+	// dispatching has to wait for events.
+	swa_flush_policy_explicit,
+};
+
 enum swa_api {
 	swa_api_gl,
 	swa_api_gles,
@@ -264,7 +284,7 @@ struct swa_window_settings {
 	enum swa_preference client_decorate; // prefer client decorations?
 
 	// The listener object must remain valid until it is changed or the window
-	// is destroyed. Must not be NULL.
+	// is destroyed. Must not be NULL. See also `swa_window_set_listener`.
 	const struct swa_window_listener* listener;
 
 	// If not NULL, use that native window handle as window parent.
@@ -278,6 +298,7 @@ struct swa_key_event {
 	// The text input this key event generated.
 	// May be NULL, usually this is the case for key release events
 	// or special keys such as escape.
+	// Only valid during the callback, copy it to keep it.
 	const char* utf8;
 	// Keycode of the pressed or release key.
 	enum swa_key keycode;
@@ -289,6 +310,12 @@ struct swa_key_event {
 	// Usually only true for press events.
 	// In some cases it may be useful to ignore repeated events.
 	bool repeated;
+	// Timestamp of the event in microseconds. On posix platforms, this
+	// is a CLOCK_MONOTONIC timepoint, i.e. directly comparable with the
+	// deadlines of `swa_display_add_timer`. On windows, it uses the
+	// clock of GetTickCount64. Should be the time the event was generated,
+	// not the time it was dispatched, if the backend knows it.
+	uint64_t time_usec;
 };
 
 struct swa_mouse_button_event {
@@ -298,6 +325,8 @@ struct swa_mouse_button_event {
 	enum swa_mouse_button button;
 	// Whether the button was pressed or released.
 	bool pressed;
+	// Timestamp of the event in microseconds, see `swa_key_event`.
+	uint64_t time_usec;
 };
 
 struct swa_mouse_move_event {
@@ -308,6 +337,8 @@ struct swa_mouse_move_event {
 	// The delta, i.e. the current mouse position minus the last
 	// known position in window-local cordinates.
 	int dx, dy;
+	// Timestamp of the event in microseconds, see `swa_key_event`.
+	uint64_t time_usec;
 };
 
 struct swa_mouse_cross_event {
@@ -336,6 +367,24 @@ struct swa_touch_event {
 	unsigned id;
 	// Position of the touch point in window-local coordinates.
 	int x, y;
+	// Timestamp of the event in microseconds, see `swa_key_event`.
+	uint64_t time_usec;
+};
+
+struct swa_present_event {
+	// The time at which the frame was presented, i.e. when it started
+	// to be scanned out, in nanoseconds. On posix platforms, this
+	// is a CLOCK_MONOTONIC timepoint, just like the deadlines of
+	// `swa_display_add_timer`.
+	uint64_t time_ns;
+	// The duration of one refresh cycle of the output the frame was
+	// presented on, in nanoseconds. Zero if unknown, e.g. for outputs
+	// with variable refresh rate.
+	uint64_t refresh_ns;
+	// Vertical retrace counter of the output at presentation.
+	// Zero if unknown. Note that this is not guaranteed to increase
+	// by one between frames, frames might be skipped.
+	uint64_t seq;
 };
 
 // All callbacks are guaranteed to only be called from inside
@@ -414,6 +463,25 @@ struct swa_window_listener {
 
 	void (*surface_destroyed)(struct swa_window*);
 	void (*surface_created)(struct swa_window*);
+
+	// Called when a frame of this window was presented, i.e. shown
+	// on screen. Presentation feedback is only requested for frames
+	// that were committed after `swa_window_surface_frame` (or implicitly
+	// via `swa_window_apply_buffer` and `swa_window_gl_swap_buffers`) while
+	// this callback was set. Frames that were never shown (e.g. because
+	// they were replaced by a newer frame) don't generate this event.
+	// Backends that can't provide presentation feedback will never
+	// call this.
+	void (*presented)(struct swa_window*, const struct swa_present_event*);
+
+	// Called when the window becomes visible or invisible to the user,
+	// e.g. because it was minimized, is fully occluded, on another
+	// workspace or the session became inactive. Windows are initially
+	// considered visible (unless created hidden). While a window is
+	// invisible, no draw events are emitted for it, a redraw requested
+	// in the meantime is emitted once it becomes visible again.
+	// Backends that can't detect this will never call it.
+	void (*visibility)(struct swa_window*, bool visible);
 };
 
 struct swa_exchange_data {
@@ -421,6 +489,13 @@ struct swa_exchange_data {
 	uint64_t size;
 };
 
+// Passed to a swa_data_stream_handler, see swa_data_offer_data_stream.
+enum swa_data_stream_status {
+	swa_data_stream_chunk, // a chunk of data was received
+	swa_data_stream_done, // all data was received, no more chunks follow
+	swa_data_stream_error, // the transfer failed, no more chunks follow
+};
+
 enum swa_data_action {
 	swa_data_action_none = 0,
 	swa_data_action_copy,
@@ -430,10 +505,20 @@ enum swa_data_action {
 struct swa_data_source_interface {
 	void (*destroy)(struct swa_data_source*);
 	const char** (*formats)(struct swa_data_source*, unsigned* count);
+	// The returned data is not copied by the display. It might be sent
+	// asynchronously and must therefore remain valid until the source
+	// is destroyed, ownership stays with the source.
 	struct swa_exchange_data (*data)(struct swa_data_source*, const char* format);
 	struct swa_image (*image)(struct swa_data_source*);
 	enum swa_data_action (*supported_actions)(struct swa_data_source*);
 	void (*selected_action)(struct swa_data_source*, enum swa_data_action);
+	// Optional, may be NULL.
+	// Returns a readable file descriptor (e.g. a file or memfd) whose
+	// remaining contents are the data in the given format. Ownership of
+	// the fd is passed to the display. Allows backends to send large
+	// data without copying it through memory, e.g. using splice.
+	// Return -1 to fall back to `data` for this format.
+	int (*data_fd)(struct swa_data_source*, const char* format);
 };
 
 struct swa_data_source {
@@ -460,12 +545,46 @@ SWA_API void swa_display_destroy(struct swa_display*);
 // a callback triggered from this function.
 SWA_API bool swa_display_dispatch(struct swa_display*, bool block);
 
+// Like `swa_display_dispatch` but if no event is currently available,
+// waits at most `timeout_ns` nanoseconds for one.
+// A timeout of zero will not block at all, a negative timeout will
+// block without limit (both just like `swa_display_dispatch`).
+// Useful to wait exactly until the next frame deadline without
+// having to busy-poll or wake up the display from another thread.
+// Returns false if there was a critical error, see `swa_display_dispatch`.
+// Returning true does not mean that an event was dispatched, the
+// timeout might have simply elapsed.
+SWA_API bool swa_display_dispatch_timeout(struct swa_display*,
+	int64_t timeout_ns);
+
 // Can be used to wakeup `swa_display_wait_events` from another thread.
 // Has no effect when `swa_display_wait_events` isn't currently called.
 // Note that it never makes sense to call this from the same thread
 // that called `swa_display_wait_events`.
 SWA_API void swa_display_wakeup(struct swa_display*);
 
+// Queues the given handler to be called with `data` on the thread
+// dispatching the display, from within the next `swa_display_dispatch`
+// (or `swa_display_dispatch_timeout`) call. In contrast to all other
+// display and window functions, this can be called from any thread at
+// any time. Wakes up the display if needed, so the handler is run in
+// finite time even when the display thread is blocked waiting for events.
+// Handlers are called in submission order. Handlers posted by another
+// handler are only run in the following dispatch call.
+// Handlers still pending when the display is destroyed are not called.
+// Returns false if the handler could not be queued (allocation failure).
+SWA_API bool swa_display_post(struct swa_display*,
+	swa_post_handler handler, void* data);
+
+// Sets the policy for flushing requests to the display server.
+// Has no effect on backends that don't buffer requests (e.g. kms,
+// where every request is a direct syscall anyways).
+SWA_API void swa_display_set_flush_policy(struct swa_display*,
+	enum swa_flush_policy);
+
+// Sends all buffered requests to the display server.
+SWA_API void swa_display_flush(struct swa_display*);
+
 // Returns the capabilities of the passed display.
 // See `swa_display_cap` for details.
 SWA_API enum swa_display_cap swa_display_capabilities(struct swa_display*);
@@ -490,7 +609,9 @@ SWA_API bool swa_display_key_pressed(struct swa_display*, enum swa_key);
 // for this key that is nontheless dependent on the keyboard layout and
 // could e.g. be shown to the user when configuring keyboard shortcuts.
 // Might return NULL on failure or when there is no name for this keycode.
-// The returned buffer must be freed.
+// The returned string is owned by the display and must not be freed.
+// It remains valid until the keyboard layout changes or the
+// display is destroyed.
 // Only valid if the display has the 'keyboard' capability.
 SWA_API const char* swa_display_key_name(struct swa_display*, enum swa_key);
 
@@ -542,6 +663,8 @@ SWA_API struct swa_data_offer* swa_display_get_clipboard(struct swa_display*);
 // This call passes ownership of the given `swa_data_source` to the display.
 // It must remain valid (and able to provide data) until the display destroys it.
 // Will return whether setting the clipboard was succesful.
+// Backends might send the data asynchronously while events are
+// dispatched.
 // Only valid if the display has the 'clipboard' capability.
 SWA_API bool swa_display_set_clipboard(struct swa_display*, struct swa_data_source*);
 
@@ -584,6 +707,21 @@ SWA_API swa_proc swa_display_get_gl_proc_addr(struct swa_display*,
 SWA_API struct swa_window* swa_display_create_window(struct swa_display*,
 	const struct swa_window_settings*);
 
+// Creates a new timer that will call the given handler from within
+// `swa_display_dispatch` (or `swa_display_dispatch_timeout`) once the
+// given deadline has passed. The deadline is a CLOCK_MONOTONIC timepoint
+// in nanoseconds, a negative deadline creates a disarmed timer.
+// Timers are one-shot: after the handler was called, the timer is
+// disarmed but can be re-armed using `swa_timer_set_deadline`, e.g. from
+// within the handler. Timer events are delivered in the same wakeup as
+// other events, dispatching will return when a timer fired.
+// Returns NULL on error or if the display doesn't have the 'timers'
+// capability. The returned timer must be destroyed using
+// `swa_timer_destroy` before the display is destroyed. Must only be used
+// from the thread dispatching the display.
+SWA_API struct swa_timer* swa_display_add_timer(struct swa_display*,
+	int64_t deadline_ns, swa_timer_handler handler, void* userdata);
+
 // window api
 SWA_API void swa_window_destroy(struct swa_window*);
 SWA_API enum swa_window_cap swa_window_get_capabilities(struct swa_window*);
@@ -669,6 +807,20 @@ SWA_API void swa_window_set_icon(struct swa_window*, const struct swa_image* ima
 // Only valid if the window has the 'lock_pointer' capability.
 SWA_API void swa_window_lock_pointer(struct swa_window* win, bool locked);
 
+// Enables or disables deadline-aware draw scheduling for the window.
+// Normally, draw events requested via `swa_window_refresh` are emitted as
+// soon as the backend allows a new frame, i.e. usually right after a
+// vblank. Input is therefore sampled almost a full refresh cycle
+// before the frame is shown. With scheduling enabled, the backend predicts
+// the next vblank from presentation feedback and delays the draw event
+// until shortly before it. The reserved time adapts to the measured draw
+// durations (from the draw event to `swa_window_surface_frame` or its
+// implicit equivalents) plus the given margin for the compositor or driver.
+// Draws that would be late anyways are emitted immediately.
+// Has no effect on backends that don't provide presentation feedback.
+SWA_API void swa_window_set_draw_scheduling(struct swa_window*, bool enable,
+	uint64_t margin_ns);
+
 // Returns whether the window should be decorated by the user.
 // This can either be the case because the backend uses client-side decorations
 // by default or because the window was explicitly created with client decorations
@@ -676,6 +828,19 @@ SWA_API void swa_window_lock_pointer(struct swa_window* win, bool locked);
 SWA_API bool swa_window_is_client_decorated(struct swa_window*);
 SWA_API const struct swa_window_listener* swa_window_get_listener(struct swa_window*);
 
+// Changes the listener of the window. Must not be NULL and must remain
+// valid until it is changed again or the window is destroyed.
+// Backends only request those input events from the system for which
+// the listener has callbacks, e.g. windows without `mouse_move` callback
+// don't receive pointer motion events at all. Therefore this must also
+// be called (with the same listener) after callbacks of the current
+// listener object were changed. Note that this also means that
+// display-wide input state (e.g. `swa_display_key_pressed`) might not be
+// updated while the pointer or focus is over a window that doesn't
+// listen for the respective events.
+SWA_API void swa_window_set_listener(struct swa_window*,
+	const struct swa_window_listener*);
+
 // Allows to set a word of custom data.
 // Can be later on retrieved using `swa_window_get_userdata`.
 // Mainly present for window listeners.
@@ -730,6 +895,15 @@ typedef void (*swa_formats_handler)(struct swa_data_offer*,
 typedef void (*swa_data_handler)(struct swa_data_offer*,
 	const char* format, struct swa_exchange_data);
 
+// Called for every chunk of data as it arrives and once more with
+// `done` or `error` status (and an empty chunk) at the end.
+// The chunk data is only valid during the callback, ownership
+// is not transferred. It's only safe to destroy the data offer
+// from this callback when the transfer has ended.
+typedef void (*swa_data_stream_handler)(struct swa_data_offer*,
+	const char* format, struct swa_exchange_data chunk,
+	enum swa_data_stream_status status);
+
 SWA_API void swa_data_offer_destroy(struct swa_data_offer*);
 
 // Requests all formats in which this data offer can provide its data.
@@ -754,6 +928,29 @@ SWA_API bool swa_data_offer_formats(struct swa_data_offer*, swa_formats_handler
 SWA_API bool swa_data_offer_data(struct swa_data_offer*, const char* format,
 	swa_data_handler cb);
 
+// Like swa_data_offer_data but hands the data to the application in
+// chunks as soon as they arrive instead of accumulating all of it first.
+// Useful for large transfers that the application can process or
+// write out incrementally. The same restrictions as for
+// swa_data_offer_data apply, there can only be one data request (of
+// either kind) at a time.
+// Returns false on error or when the backend doesn't support
+// streamed data transfers.
+SWA_API bool swa_data_offer_data_stream(struct swa_data_offer*,
+	const char* format, swa_data_stream_handler cb);
+
+// Enables or disables caching of received data for this offer.
+// When enabled, data received via swa_data_offer_data is kept
+// and further requests for the same format are answered from memory
+// instead of transferring it from the source again. Useful e.g. when
+// pasting the same selection multiple times. The cache lives as long
+// as the offer, offers are destroyed when the selection they represent
+// changes. Disabling the cache frees all cached data.
+// Caching is disabled by default. Data requested with
+// swa_data_offer_data_stream is never cached but served from
+// the cache if already available.
+SWA_API void swa_data_offer_set_cache(struct swa_data_offer*, bool enable);
+
 // Sets the preferred format and action on a data offer.
 // Only relevant and expected to be used for data offers introduced
 // by dnd events.
@@ -770,6 +967,23 @@ SWA_API enum swa_data_action swa_data_offer_supported_actions(struct swa_data_of
 SWA_API void swa_data_offer_set_userdata(struct swa_data_offer*, void*);
 SWA_API void* swa_data_offer_get_userdata(struct swa_data_offer*);
 
+// timer api
+// Re-arms the timer to fire at the given CLOCK_MONOTONIC deadline in
+// nanoseconds. Pass a negative deadline to disarm it.
+SWA_API void swa_timer_set_deadline(struct swa_timer*, int64_t deadline_ns);
+
+// Allows the timer to fire up to 'slack_ns' after its deadline.
+// The display will use this to coalesce the wakeups of timers with nearby
+// deadlines. Defaults to 0.
+SWA_API void swa_timer_set_slack(struct swa_timer*, int64_t slack_ns);
+
+// Returns the deadline the timer is armed for or a negative value
+// if it is not armed.
+SWA_API int64_t swa_timer_get_deadline(struct swa_timer*);
+SWA_API void swa_timer_set_userdata(struct swa_timer*, void*);
+SWA_API void* swa_timer_get_userdata(struct swa_timer*);
+SWA_API void swa_timer_destroy(struct swa_timer*);
+
 // utility
 // Initializes the given settings to the default state.
 // Will especially set width, height to SWA_DEFAULT_SIZE and x, y
@@ -14,7 +14,8 @@ struct swa_ext_x11_window_settings {
 
 	// If true: use the vulkan xlib extension for surface creation
 	// instead of xcb (default). Only relevant if only that extension
-	// is supported/enabled for some reason.
+	// is supported/enabled for some reason. Requires an additional xlib
+	// connection to be opened.
 	bool vk_use_xlib;
 
 	// Create the window as input-only window, not able to show anything.
@@ -23,6 +24,9 @@ struct swa_ext_x11_window_settings {
 };
 
 // Creates an x11 display implementation.
+// Errors of requests are reported asynchronously (logged while dispatching).
+// For debugging, setting the SWA_X11_SYNC environment variable makes the
+// backend check critical requests synchronously instead.
 SWA_API struct swa_display* swa_display_x11_create(const char* appname);
 SWA_API xcb_connection_t* swa_display_x11_connection(struct swa_display* dpy);
 
@@ -1,5 +1,6 @@
 #include <swa/android.h>
 #include <swa/private/android.h>
+#include <swa/private/clock.h>
 #include <dlg/dlg.h>
 #include <dlg/output.h>
 #include <string.h>
@@ -704,7 +705,9 @@ static void display_destroy(struct swa_display* base) {
 	}
 #endif
 
+	swa_timer_queue_finish(&dpy->timers);
 	free(dpy->events);
+	free(dpy->key_names);
 	free((char*) dpy->appname);
 	dpy->activity->dpy = NULL;
 	free(dpy);
@@ -847,6 +850,8 @@ static bool handle_key_event(struct swa_display_android* dpy, AInputEvent* ev) {
 		.modifiers = mods,
 		.pressed = pressed,
 		.repeated = AKeyEvent_getRepeatCount(ev) != 0,
+		// event times are CLOCK_MONOTONIC nanoseconds
+		.time_usec = AKeyEvent_getEventTime(ev) / 1000,
 	};
 
 	dpy->window->base.listener->key(&dpy->window->base, &kev);
@@ -858,6 +863,8 @@ static bool handle_motion_event(struct swa_display_android* dpy, AInputEvent* ev
 	int32_t action = AMotionEvent_getAction(ev);
 
 	size_t count = AMotionEvent_getPointerCount(ev);
+	// event times are CLOCK_MONOTONIC nanoseconds
+	uint64_t time = AMotionEvent_getEventTime(ev) / 1000;
 	switch(action & AMOTION_EVENT_ACTION_MASK) {
 	case AMOTION_EVENT_ACTION_DOWN: {
 		if(!dpy->window || !dpy->window->base.listener->touch_begin) {
@@ -869,6 +876,7 @@ static bool handle_motion_event(struct swa_display_android* dpy, AInputEvent* ev
 				.id = AMotionEvent_getPointerId(ev, i),
 				.x = AMotionEvent_getX(ev, i),
 				.y = AMotionEvent_getY(ev, i),
+				.time_usec = time,
 			};
 			dpy->window->base.listener->touch_begin(&dpy->window->base, &tev);
 		}
@@ -893,6 +901,7 @@ static bool handle_motion_event(struct swa_display_android* dpy, AInputEvent* ev
 				.id = AMotionEvent_getPointerId(ev, i),
 				.x = AMotionEvent_getX(ev, i),
 				.y = AMotionEvent_getY(ev, i),
+				.time_usec = time,
 			};
 
 			dpy->window->base.listener->touch_update(&dpy->window->base, &tev);
@@ -918,6 +927,7 @@ static bool handle_motion_event(struct swa_display_android* dpy, AInputEvent* ev
 			.id = id,
 			.x = AMotionEvent_getX(ev, idx),
 			.y = AMotionEvent_getY(ev, idx),
+			.time_usec = time,
 		};
 
 		dpy->window->base.listener->touch_begin(&dpy->window->base, &tev);
@@ -1079,7 +1089,8 @@ static void handle_event(struct swa_display_android* dpy, const struct event* ev
 	}
 }
 
-static bool display_dispatch(struct swa_display* base, bool block) {
+static bool display_dispatch_timeout(struct swa_display* base,
+		int64_t timeout_ns) {
 	struct swa_display_android* dpy = get_display_android(base);
 
 	// process events from activity thread
@@ -1118,17 +1129,33 @@ static bool display_dispatch(struct swa_display* base, bool block) {
 
 	pthread_mutex_unlock(&dpy->activity->mutex);
 
+	// don't sleep past the next timer
+	int64_t timers = swa_timer_queue_next(&dpy->timers);
+	if(timers >= 0) {
+		int64_t until = timers - swa_monotonic_ns();
+		if(until < 0) {
+			until = 0;
+		}
+		if(timeout_ns < 0 || until < timeout_ns) {
+			timeout_ns = until;
+		}
+	}
+
 	// process looper events
 	int outFd, outEvents;
 	void* outData;
-	int timeout = block ? -1 : 0;
+	int timeout = swa_timeout_ns_to_ms(timeout_ns);
 	int err = ALooper_pollAll(timeout, &outFd, &outEvents, &outData);
 	if(err == ALOOPER_POLL_ERROR) {
 		dlg_error("ALooper_pollAll error");
 	}
 
+	swa_timer_queue_dispatch(&dpy->timers, swa_monotonic_ns());
 	return !is_destroyed(dpy->activity);
+}
 
+static bool display_dispatch(struct swa_display* base, bool block) {
+	return display_dispatch_timeout(base, block ? -1 : 0);
 }
 
 static void display_wakeup(struct swa_display* base) {
@@ -1150,7 +1177,8 @@ static enum swa_display_cap display_capabilities(struct swa_display* base) {
 #ifdef SWA_WITH_VK
 		swa_display_cap_vk |
 #endif
-		swa_display_cap_buffer_surface;
+		swa_display_cap_buffer_surface |
+		swa_display_cap_timers;
 
 	return caps;
 }
@@ -1171,6 +1199,12 @@ static const char** display_vk_extensions(struct swa_display* base, unsigned* co
 #endif
 }
 
+static struct swa_timer* display_add_timer(struct swa_display* base,
+		int64_t deadline, swa_timer_handler handler, void* userdata) {
+	struct swa_display_android* dpy = get_display_android(base);
+	return swa_timer_create(&dpy->timers, deadline, handler, userdata);
+}
+
 static swa_proc display_get_gl_proc_addr(struct swa_display* base,
 		const char* name) {
 #ifdef SWA_WITH_GL
@@ -1202,8 +1236,21 @@ static const char* display_key_name(struct swa_display* base, enum swa_key key)
 		return "";
 	}
 
-	char* name = malloc(5);
-	get_utf8(dpy->activity, name, keycode, 0);
+	// names are queried once and kept for the lifetime of the display
+	const unsigned n_keys = 8 * sizeof(dpy->key_states);
+	if((unsigned) key >= n_keys) {
+		return NULL;
+	}
+
+	if(!dpy->key_names) {
+		dpy->key_names = calloc(n_keys, sizeof(*dpy->key_names));
+	}
+
+	char* name = dpy->key_names[key];
+	if(!name[0]) {
+		get_utf8(dpy->activity, name, keycode, 0);
+	}
+
 	return name;
 }
 
@@ -1278,6 +1325,7 @@ error:
 static const struct swa_display_interface display_impl = {
 	.destroy = display_destroy,
 	.dispatch = display_dispatch,
+	.dispatch_timeout = display_dispatch_timeout,
 	.wakeup = display_wakeup,
 	.capabilities = display_capabilities,
 	.vk_extensions = display_vk_extensions,
@@ -1292,6 +1340,7 @@ static const struct swa_display_interface display_impl = {
 	.set_clipboard = display_set_clipboard,
 	.start_dnd = display_start_dnd,
 	.get_gl_proc_addr = display_get_gl_proc_addr,
+	.add_timer = display_add_timer,
 	.create_window = display_create_window,
 };
 
@@ -0,0 +1,42 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <swa/private/clock.h>
+#include <dlg/dlg.h>
+
+int64_t swa_monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return swa_timespec_to_ns(&ts);
+}
+
+int64_t swa_timespec_to_ns(const struct timespec* ts) {
+	return (int64_t) ts->tv_sec * 1000 * 1000 * 1000 + ts->tv_nsec;
+}
+
+struct timespec swa_timespec_from_ns(int64_t ns) {
+	struct timespec ts;
+	ts.tv_sec = ns / (1000 * 1000 * 1000);
+	ts.tv_nsec = ns % (1000 * 1000 * 1000);
+	return ts;
+}
+
+uint64_t swa_event_time_usec(uint32_t ms) {
+	uint64_t now = swa_monotonic_ns() / 1000;
+
+	// Compare with the lower 32 bit of our current millisecond time.
+	// If the event lies in the recent past, the server (most likely)
+	// uses the same clock and we can just reconstruct the upper bits.
+	const uint32_t max_age = 10 * 1000; // ms
+	uint32_t age = (uint32_t)(now / 1000) - ms;
+	if(age > max_age) {
+		return now;
+	}
+
+	return now - (uint64_t) age * 1000;
+}
+
+void swa_log_elapsed(int64_t* last, const char* step) {
+	int64_t now = swa_monotonic_ns();
+	dlg_debug("%s: %.3f ms", step, (now - *last) / (1000.0 * 1000.0));
+	*last = now;
+}
@@ -0,0 +1,176 @@
+#include <swa/private/cursor_cache.h>
+#include <swa/image.h>
+#include <dlg/dlg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const uint8_t* data, size_t size) {
+	for(size_t i = 0u; i < size; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+void swa_cursor_key_init(struct swa_cursor_key* key,
+		const struct swa_cursor* cursor) {
+	memset(key, 0x0, sizeof(*key));
+	key->type = cursor->type;
+	if(cursor->type != swa_cursor_image) {
+		return;
+	}
+
+	const struct swa_image* img = &cursor->image;
+	key->width = img->width;
+	key->height = img->height;
+	key->hx = cursor->hx;
+	key->hy = cursor->hy;
+	key->format = img->format;
+	key->data = img->data;
+	key->stride = img->stride;
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint32_t fmt = img->format;
+	hash = hash_bytes(hash, (const uint8_t*) &fmt, sizeof(fmt));
+
+	// hash row-wise, the padding between rows is undefined
+	size_t row_size = (size_t) img->width * swa_image_format_size(img->format);
+	for(unsigned y = 0u; y < img->height; ++y) {
+		hash = hash_bytes(hash, img->data + (size_t) y * img->stride, row_size);
+	}
+
+	key->hash = hash;
+}
+
+static size_t key_row_size(const struct swa_cursor_key* key) {
+	return (size_t) key->width * swa_image_format_size(key->format);
+}
+
+static bool key_equal(const struct swa_cursor_key* a,
+		const struct swa_cursor_key* b) {
+	if(a->type != b->type || a->hash != b->hash ||
+			a->width != b->width || a->height != b->height ||
+			a->hx != b->hx || a->hy != b->hy || a->format != b->format) {
+		return false;
+	}
+
+	if(a->type != swa_cursor_image) {
+		return true;
+	}
+
+	// the hash matched, make sure it's not a collision
+	size_t row_size = key_row_size(a);
+	for(unsigned y = 0u; y < a->height; ++y) {
+		if(memcmp(a->data + (size_t) y * a->stride,
+				b->data + (size_t) y * b->stride, row_size) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void unlink_entry(struct swa_cursor_cache* cache,
+		struct swa_cursor_cache_entry* entry) {
+	if(entry->prev) entry->prev->next = entry->next;
+	else cache->first = entry->next;
+	if(entry->next) entry->next->prev = entry->prev;
+	else cache->last = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void link_front(struct swa_cursor_cache* cache,
+		struct swa_cursor_cache_entry* entry) {
+	entry->prev = NULL;
+	entry->next = cache->first;
+	if(cache->first) cache->first->prev = entry;
+	else cache->last = entry;
+	cache->first = entry;
+}
+
+static void destroy_entry(struct swa_cursor_cache* cache,
+		struct swa_cursor_cache_entry* entry) {
+	unlink_entry(cache, entry);
+	cache->size -= entry->size;
+	--cache->count;
+	cache->destroy(cache, entry);
+	free((uint8_t*) entry->key.data);
+	free(entry);
+}
+
+struct swa_cursor_cache_entry* swa_cursor_cache_find(
+		struct swa_cursor_cache* cache, const struct swa_cursor_key* key) {
+	for(struct swa_cursor_cache_entry* it = cache->first; it; it = it->next) {
+		if(key_equal(&it->key, key)) {
+			if(it != cache->first) {
+				unlink_entry(cache, it);
+				link_front(cache, it);
+			}
+			return it;
+		}
+	}
+
+	return NULL;
+}
+
+struct swa_cursor_cache_entry* swa_cursor_cache_insert(
+		struct swa_cursor_cache* cache, const struct swa_cursor_key* key,
+		size_t size) {
+	struct swa_cursor_cache_entry* entry = calloc(1, sizeof(*entry));
+	entry->key = *key;
+	entry->size = size;
+
+	// keep a copy of the pixels, the key only references them
+	if(key->type == swa_cursor_image) {
+		size_t row_size = key_row_size(key);
+		uint8_t* data = malloc(row_size * key->height);
+		for(unsigned y = 0u; y < key->height; ++y) {
+			memcpy(data + (size_t) y * row_size,
+				key->data + (size_t) y * key->stride, row_size);
+		}
+
+		entry->key.data = data;
+		entry->key.stride = row_size;
+	} else {
+		entry->key.data = NULL;
+	}
+
+	link_front(cache, entry);
+	cache->size += size;
+	++cache->count;
+	return entry;
+}
+
+void swa_cursor_cache_set(struct swa_cursor_cache* cache,
+		struct swa_cursor_cache_entry** slot,
+		struct swa_cursor_cache_entry* entry) {
+	if(entry) {
+		++entry->refs;
+	}
+
+	if(*slot) {
+		dlg_assert((*slot)->refs > 0);
+		--(*slot)->refs;
+	}
+
+	*slot = entry;
+
+	// evict, starting with the least recently used entry
+	struct swa_cursor_cache_entry* it = cache->last;
+	while(it && (cache->size > SWA_CURSOR_CACHE_MAX_SIZE ||
+			cache->count > SWA_CURSOR_CACHE_MAX_COUNT)) {
+		struct swa_cursor_cache_entry* prev = it->prev;
+		if(!it->refs) {
+			destroy_entry(cache, it);
+		}
+		it = prev;
+	}
+}
+
+void swa_cursor_cache_finish(struct swa_cursor_cache* cache) {
+	while(cache->first) {
+		dlg_assertm(!cache->first->refs, "Cursor still in use");
+		destroy_entry(cache, cache->first);
+	}
+}
@@ -4,6 +4,7 @@
 #include <swa/private/kms/props.h>
 #include <swa/private/kms/xcursor.h>
 #include <swa/private/xkb.h>
+#include <swa/private/clock.h>
 #include <dlg/dlg.h>
 #include <assert.h>
 #include <errno.h>
@@ -206,11 +207,95 @@ static void atomic_add(struct atomic* atom, uint32_t id, uint32_t prop, uint64_t
 	}
 }
 
+static void atomic_add_cursor(struct atomic* atom, struct swa_display_kms* dpy,
+		struct swa_kms_output* output) {
+	uint32_t plane_id = output->cursor_plane.id;
+	union drm_plane_props* pprops = &output->cursor_plane.props;
+	struct swa_kms_dumb_buffer* buf = output->cursor.buffer;
+	if(!buf) {
+		atomic_add(atom, plane_id, pprops->fb_id, 0);
+		atomic_add(atom, plane_id, pprops->crtc_id, 0);
+	} else {
+		uint64_t width = dpy->cursor_width;
+		uint64_t height = dpy->cursor_height;
+		atomic_add(atom, plane_id, pprops->crtc_id, output->crtc.id);
+		atomic_add(atom, plane_id, pprops->fb_id, buf->fb_id);
+		atomic_add(atom, plane_id, pprops->src_x, 0);
+		atomic_add(atom, plane_id, pprops->src_y, 0);
+		atomic_add(atom, plane_id, pprops->src_w, width << 16);
+		atomic_add(atom, plane_id, pprops->src_h, height << 16);
+
+		// crtc_x and crtc_y are signed
+		atomic_add(atom, plane_id, pprops->crtc_x, (uint64_t) output->cursor.x);
+		atomic_add(atom, plane_id, pprops->crtc_y, (uint64_t) output->cursor.y);
+		atomic_add(atom, plane_id, pprops->crtc_w, width);
+		atomic_add(atom, plane_id, pprops->crtc_h, height);
+	}
+}
+
+// Commits the pending cursor state of the given output, if any.
+static void commit_cursor(struct swa_display_kms* dpy,
+		struct swa_kms_output* output) {
+	if(!output->cursor.dirty) {
+		return;
+	}
+
+	struct swa_kms_dumb_buffer* buf = output->cursor.buffer;
+	int err;
+	if(!output->cursor_plane.id) {
+		if(output->cursor.buffer_changed) {
+			output->cursor.buffer_changed = false;
+			if(buf) {
+				err = drmModeSetCursor(dpy->drm.fd, output->crtc.id,
+					buf->gem_handle, dpy->cursor_width, dpy->cursor_height);
+			} else {
+				err = drmModeSetCursor(dpy->drm.fd, output->crtc.id, 0, 0, 0);
+			}
+			dlg_assertm(!err, "drmModeSetCursor: %s", strerror(errno));
+		}
+
+		if(buf) {
+			err = drmModeMoveCursor(dpy->drm.fd, output->crtc.id,
+				output->cursor.x, output->cursor.y);
+			dlg_assertm(!err, "drmModeMoveCursor: %s", strerror(errno));
+		}
+
+		output->cursor.dirty = false;
+		return;
+	}
+
+	// There can only be one atomic commit in flight. The cursor state
+	// will be committed when the pending commit completes.
+	if(output->commit != swa_kms_commit_none) {
+		return;
+	}
+
+	drmModeAtomicReq* req = drmModeAtomicAlloc();
+	struct atomic atom = {req, false};
+	atomic_add_cursor(&atom, dpy, output);
+	if(!atom.failed) {
+		uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+		err = drmModeAtomicCommit(dpy->drm.fd, req, flags, dpy);
+		if(err != 0) {
+			dlg_error("drmModeAtomicCommit (cursor): %s", strerror(errno));
+		} else {
+			output->commit = swa_kms_commit_cursor;
+			output->cursor.dirty = false;
+		}
+	}
+
+	drmModeAtomicFree(req);
+}
+
 
 // window
 static void win_destroy(struct swa_window* base) {
 	struct swa_window_kms* win = get_window_kms(base);
-	if(win->output) win->output->window = NULL;
+	if(win->output) {
+		win->output->window = NULL;
+		win->output->cursor.buffer = NULL;
+		win->output->deferred_flip.fb_id = 0;
+	}
 	if(win->dpy->input.pointer.over == win) {
 		win->dpy->input.pointer.over = NULL;
 	}
@@ -218,6 +303,10 @@ static void win_destroy(struct swa_window* base) {
 		win->dpy->input.keyboard.focus = NULL;
 	}
 
+	swa_draw_sched_finish(&win->sched);
+	swa_cursor_cache_set(&win->dpy->cursor_cache,
+		&win->cursor.buffer.entry, NULL);
+
 	// TODO: full cleanup
 	free(win);
 }
@@ -247,158 +336,232 @@ static void win_set_size(struct swa_window* base, unsigned w, unsigned h) {
 	dlg_error("win_set_size not supported");
 }
 
-static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
-	struct swa_window_kms* win = get_window_kms(base);
+static void schedule_cursor_commit(struct swa_window_kms* win) {
+	// Pointer events are usually read in batches from libinput. Committing
+	// after all of them were processed means we don't do it per event.
+	win->output->cursor.dirty = true;
+	win->defer_events |= swa_kms_defer_cursor;
+	pml_defer_enable(win->defer, true);
+}
 
-	// TODO: For vulkan this will be somewhat complicated. We probably
-	// have to create our own, internal vulkan device i guess?
-	// Combining vkdisplay with drm calls isn't something we want to start.
-	// But we would also have to create pipelines to render the cursor
-	// into the surface (created from the cursor plane)...
-	// NOTE: when already using a gl render surface, we could use
-	// gbm_bo's. Shouldn't really improve anything but may be useful
-	// when the drm driver doesn't have the dumb buffer capability i guess?
-	// are there drivers that implement gbm (with mapping, we don't want to
-	// create a pipeline/surface/fbo/whatever just for that) but not dumb
-	// buffers though? rather unlikely i guess
-	if(win->surface_type != swa_surface_buffer &&
-			win->surface_type != swa_surface_gl) {
-		dlg_error("TODO: not implemented");
+static void update_cursor_position(struct swa_display_kms* dpy) {
+	// TODO: fix for vulkan
+	struct swa_window_kms* win = dpy->input.pointer.over;
+	if(!win || !win->output || !win->cursor.buffer.entry) {
 		return;
 	}
 
-	/*
-	if(!win->output->cursor_plane.id) {
-		dlg_error("No cursor plane");
+	struct swa_cursor_cache_entry* entry = win->cursor.buffer.entry;
+	int32_t x = dpy->input.pointer.x - entry->hx;
+	int32_t y = dpy->input.pointer.y - entry->hy;
+	if(x == win->output->cursor.x && y == win->output->cursor.y) {
 		return;
 	}
-	*/
 
-	enum swa_cursor_type type = cursor.type;
-	if(type == swa_cursor_default) {
-		type = swa_cursor_left_pointer;
+	win->output->cursor.x = x;
+	win->output->cursor.y = y;
+	schedule_cursor_commit(win);
+}
+
+static void destroy_cursor(struct swa_cursor_cache* cache,
+		struct swa_cursor_cache_entry* entry) {
+	struct swa_display_kms* dpy = cache->data;
+	finish_dumb_buffer(dpy, entry->data);
+	free(entry->data);
+}
+
+static struct swa_xcursor_theme* get_cursor_theme(struct swa_display_kms* dpy) {
+	if(dpy->cursor_theme) {
+		return dpy->cursor_theme;
+	}
+
+	const char* theme = getenv("XCURSOR_THEME");
+	const char* size_str = getenv("XCURSOR_SIZE");
+	unsigned size = 32u;
+	if(size_str) {
+		long s = strtol(size_str, NULL, 10);
+		if(s <= 0) {
+			dlg_warn("Invalid XCURSOR_SIZE: %s", size_str);
+		} else {
+			size = s;
+		}
+	}
+
+	// if XCURSOR_THEME is not set, we pass in null, which will result
+	// in the default cursor theme being used.
+	dpy->cursor_theme = swa_xcursor_theme_load(theme, size);
+	if(!dpy->cursor_theme) {
+		dlg_error("Could not load cursor theme");
+	}
+
+	return dpy->cursor_theme;
+}
+
+// Returns the cached cursor buffer for the given cursor, creating it
+// if needed. The cursor must not be swa_cursor_default or swa_cursor_none.
+static struct swa_cursor_cache_entry* get_cursor(struct swa_display_kms* dpy,
+		const struct swa_cursor* cursor) {
+	struct swa_cursor_key key;
+	swa_cursor_key_init(&key, cursor);
+	struct swa_cursor_cache_entry* entry =
+		swa_cursor_cache_find(&dpy->cursor_cache, &key);
+	if(entry) {
+		return entry;
 	}
 
 	struct swa_image cursor_image = {0};
-	bool valid = false;
-	if(type == swa_cursor_image) {
-		cursor_image = cursor.image;
-		valid = cursor_image.width > 0 && cursor_image.height > 0;
-
-		win->cursor.buffer.hx = cursor.hx;
-		win->cursor.buffer.hy = cursor.hy;
-	} else if(type != swa_cursor_none) {
-		if(!win->dpy->cursor_theme) {
-			const char* theme = getenv("XCURSOR_THEME");
-			const char* size_str = getenv("XCURSOR_SIZE");
-			unsigned size = 32u;
-			if(size_str) {
-				long s = strtol(size_str, NULL, 10);
-				if(s <= 0) {
-					dlg_warn("Invalid XCURSOR_SIZE: %s", size_str);
-				} else {
-					size = s;
-				}
-			}
+	int hx, hy;
+	if(cursor->type == swa_cursor_image) {
+		cursor_image = cursor->image;
+		if(cursor_image.width == 0 || cursor_image.height == 0) {
+			return NULL;
+		}
 
-			// if XCURSOR_THEME is not set, we pass in null, which will result
-			// in the default cursor theme being used.
-			win->dpy->cursor_theme = swa_xcursor_theme_load(theme, size);
-			if(!win->dpy->cursor_theme) {
-				dlg_error("Could not load cursor theme");
-				return;
-			}
+		hx = cursor->hx;
+		hy = cursor->hy;
+	} else {
+		struct swa_xcursor_theme* theme = get_cursor_theme(dpy);
+		if(!theme) {
+			return NULL;
 		}
 
 		// TODO: support animated cursor. See wayland backend
-		const char* const* names = swa_get_xcursor_names(type);
+		const char* const* names = swa_get_xcursor_names(cursor->type);
 		if(!names) {
-			dlg_warn("failed to convert cursor type %d to xcursor", type);
-			return;
+			dlg_warn("failed to convert cursor type %d to xcursor", cursor->type);
+			return NULL;
 		}
 
-		struct swa_xcursor* cursor = NULL;
+		struct swa_xcursor* xcursor = NULL;
 		for(; *names; ++names) {
-			cursor = swa_xcursor_theme_get_cursor(win->dpy->cursor_theme, *names);
-			if(cursor) {
+			xcursor = swa_xcursor_theme_get_cursor(theme, *names);
+			if(xcursor) {
 				break;
 			} else {
 				dlg_debug("failed to retrieve cursor %s", *names);
 			}
 		}
 
-		if(!cursor) {
-			dlg_warn("failed to get any cursor for cursor type %d", type);
-			return;
+		if(!xcursor) {
+			dlg_warn("failed to get any cursor for cursor type %d", cursor->type);
+			return NULL;
 		}
 
-		struct swa_xcursor_image* img = cursor->images[0];
+		struct swa_xcursor_image* img = xcursor->images[0];
 		cursor_image.width = img->width;
 		cursor_image.height = img->height;
 		cursor_image.stride = 4 * img->width;
 		cursor_image.format = swa_image_format_bgra32;
 		cursor_image.data = img->buffer;
-		valid = true;
 
-		win->cursor.buffer.hx = img->hotspot_x;
-		win->cursor.buffer.hy = img->hotspot_y;
+		hx = img->hotspot_x;
+		hy = img->hotspot_y;
 	}
 
-	// create buffer if needed
-	if(!valid) {
-		finish_dumb_buffer(win->dpy, &win->cursor.buffer.buffer);
-	} else if(!win->cursor.buffer.buffer.data) {
+	if(!dpy->cursor_width) {
 		int err;
 		uint64_t w, h;
-		err = drmGetCap(win->dpy->drm.fd, DRM_CAP_CURSOR_WIDTH, &w);
+		err = drmGetCap(dpy->drm.fd, DRM_CAP_CURSOR_WIDTH, &w);
 		dlg_assertlm(dlg_level_warn, !err, "%d (%s)", err, strerror(errno));
 		w = err ? 64 : w;
-		err = drmGetCap(win->dpy->drm.fd, DRM_CAP_CURSOR_HEIGHT, &h);
+		err = drmGetCap(dpy->drm.fd, DRM_CAP_CURSOR_HEIGHT, &h);
 		dlg_assertlm(dlg_level_warn, !err, "%d (%s)", err, strerror(errno));
 		h = err ? 64 : h;
 
-		// TODO: we don't really need a drm framebuffer for this
-		// buffer. Maybe add an additional function that doesn't
-		// create one?
-		if(!init_dumb_buffer(win->dpy, w, h, DRM_FORMAT_ARGB8888,
-				&win->cursor.buffer.buffer)) {
-			dlg_warn("failed to create cursor dumb buffer");
-			return;
-		}
-
-		win->cursor.buffer.width = w;
-		win->cursor.buffer.height = h;
+		dpy->cursor_width = w;
+		dpy->cursor_height = h;
 	}
 
-	if(cursor_image.width > win->cursor.buffer.width ||
-			cursor_image.height > win->cursor.buffer.height) {
+	if(cursor_image.width > dpy->cursor_width ||
+			cursor_image.height > dpy->cursor_height) {
 		dlg_error("cursor image too large");
-		return;
+		return NULL;
+	}
+
+	// TODO: we don't really need a drm framebuffer for this
+	// buffer. Maybe add an additional function that doesn't
+	// create one?
+	struct swa_kms_dumb_buffer* buf = calloc(1, sizeof(*buf));
+	if(!init_dumb_buffer(dpy, dpy->cursor_width, dpy->cursor_height,
+			DRM_FORMAT_ARGB8888, buf)) {
+		dlg_warn("failed to create cursor dumb buffer");
+		free(buf);
+		return NULL;
 	}
 
 	// clear first (important for overflow)
-	if(valid) {
-		memset(win->cursor.buffer.buffer.data, 0x0, win->cursor.buffer.buffer.size);
-		if(valid) {
-			struct swa_image dst = {
-				.width = cursor_image.width,
-				.height = cursor_image.height,
-				.stride = win->cursor.buffer.buffer.stride,
-				.format = swa_image_format_bgra32,
-				.data = win->cursor.buffer.buffer.data,
-			};
-			swa_convert_image(&cursor_image, &dst);
+	memset(buf->data, 0x0, buf->size);
+	struct swa_image dst = {
+		.width = cursor_image.width,
+		.height = cursor_image.height,
+		.stride = buf->stride,
+		.format = swa_image_format_bgra32,
+		.data = buf->data,
+	};
+	swa_convert_image(&cursor_image, &dst);
+
+	entry = swa_cursor_cache_insert(&dpy->cursor_cache, &key, buf->size);
+	entry->data = buf;
+	entry->hx = hx;
+	entry->hy = hy;
+	return entry;
+}
+
+static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
+	struct swa_window_kms* win = get_window_kms(base);
+
+	// TODO: For vulkan this will be somewhat complicated. We probably
+	// have to create our own, internal vulkan device i guess?
+	// Combining vkdisplay with drm calls isn't something we want to start.
+	// But we would also have to create pipelines to render the cursor
+	// into the surface (created from the cursor plane)...
+	// NOTE: when already using a gl render surface, we could use
+	// gbm_bo's. Shouldn't really improve anything but may be useful
+	// when the drm driver doesn't have the dumb buffer capability i guess?
+	// are there drivers that implement gbm (with mapping, we don't want to
+	// create a pipeline/surface/fbo/whatever just for that) but not dumb
+	// buffers though? rather unlikely i guess
+	if(win->surface_type != swa_surface_buffer &&
+			win->surface_type != swa_surface_gl) {
+		dlg_error("TODO: not implemented");
+		return;
+	}
+
+	if(cursor.type == swa_cursor_default) {
+		cursor.type = swa_cursor_left_pointer;
+	}
+
+	struct swa_cursor_cache_entry* entry = NULL;
+	if(cursor.type != swa_cursor_none) {
+		entry = get_cursor(win->dpy, &cursor);
+		if(!entry) {
+			return;
 		}
+	}
 
-		int err = drmModeSetCursor(win->dpy->drm.fd, win->output->crtc.id,
-			win->cursor.buffer.buffer.gem_handle,
-			win->cursor.buffer.width, win->cursor.buffer.height);
-		dlg_assertm(!err, "drmModeSetCursor: %s", strerror(errno));
+	if(entry == win->cursor.buffer.entry) {
+		return;
 	}
+
+	struct swa_display_kms* dpy = win->dpy;
+	swa_cursor_cache_set(&dpy->cursor_cache, &win->cursor.buffer.entry, entry);
+
+	win->output->cursor.buffer = entry ? entry->data : NULL;
+	win->output->cursor.buffer_changed = true;
+	schedule_cursor_commit(win);
+
+	// the hotspot might have changed
+	update_cursor_position(dpy);
 }
 
 static void win_refresh(struct swa_window* base) {
 	struct swa_window_kms* win = get_window_kms(base);
+
+	// the draw event was already scheduled
+	if(swa_draw_sched_pending(&win->sched)) {
+		return;
+	}
+
 	if(win->surface_type == swa_surface_buffer) {
 		if(!win->buffer.pending && !win->buffer.active) {
 			if(win->base.listener->draw) {
@@ -552,8 +715,9 @@ static uint32_t fb_for_bo(struct gbm_bo* bo, uint32_t drm_format) {
 }
 #endif // SWA_WITH_GL
 
-static bool pageflip(struct swa_window_kms* win, uint32_t fb_id,
+static bool commit_flip(struct swa_window_kms* win, uint32_t fb_id,
 		uint64_t width, uint64_t height) {
+	dlg_assert(win->output->commit == swa_kms_commit_none);
 	drmModeAtomicReq* req = drmModeAtomicAlloc();
 	struct atomic atom = {req, false};
 
@@ -580,6 +744,12 @@ static bool pageflip(struct swa_window_kms* win, uint32_t fb_id,
 	atomic_add(&atom, crtc_id, crtc_props->mode_id, win->output->mode_id);
 	atomic_add(&atom, crtc_id, crtc_props->active, 1);
 
+	// commit pending cursor changes together with the flip
+	bool cursor = win->output->cursor_plane.id && win->output->cursor.dirty;
+	if(cursor) {
+		atomic_add_cursor(&atom, win->dpy, win->output);
+	}
+
 	uint32_t flags = (DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
 	if(win->output->needs_modeset) {
 		win->output->needs_modeset = false;
@@ -587,18 +757,41 @@ static bool pageflip(struct swa_window_kms* win, uint32_t fb_id,
 	}
 
 	if(atom.failed) {
+		drmModeAtomicFree(req);
 		return false;
 	}
 
 	int err = drmModeAtomicCommit(win->dpy->drm.fd, req, flags, win->dpy);
 	if(err != 0) {
 		dlg_error("drmModeAtomicCommit: %s", strerror(errno));
+	} else {
+		win->output->commit = swa_kms_commit_flip;
+		win->output->cursor.dirty &= !cursor;
 	}
 
 	drmModeAtomicFree(req);
 	return err == 0;
 }
 
+static bool pageflip(struct swa_window_kms* win, uint32_t fb_id,
+		uint64_t width, uint64_t height) {
+	swa_draw_sched_end(&win->sched);
+
+	// A cursor-only commit is in flight, we have to wait for it.
+	// It completes on the next vblank, we wouldn't have been able to
+	// flip before that anyways.
+	if(win->output->commit != swa_kms_commit_none) {
+		dlg_assert(win->output->commit == swa_kms_commit_cursor);
+		dlg_assert(!win->output->deferred_flip.fb_id);
+		win->output->deferred_flip.fb_id = fb_id;
+		win->output->deferred_flip.width = width;
+		win->output->deferred_flip.height = height;
+		return true;
+	}
+
+	return commit_flip(win, fb_id, width, height);
+}
+
 static bool win_gl_swap_buffers(struct swa_window* base) {
 #ifdef SWA_WITH_GL
 	struct swa_window_kms* win = get_window_kms(base);
@@ -711,6 +904,13 @@ static void win_apply_buffer(struct swa_window* base) {
 	win->buffer.active = NULL;
 }
 
+static void win_set_draw_scheduling(struct swa_window* base, bool enable,
+		uint64_t margin) {
+	struct swa_window_kms* win = get_window_kms(base);
+	win->sched.enabled = enable;
+	win->sched.margin = margin;
+}
+
 static const struct swa_window_interface window_impl = {
 	.destroy = win_destroy,
 	.get_capabilities = win_get_capabilities,
@@ -732,7 +932,8 @@ static const struct swa_window_interface window_impl = {
 	.gl_swap_buffers = win_gl_swap_buffers,
 	.gl_set_swap_interval = win_gl_set_swap_interval,
 	.get_buffer = win_get_buffer,
-	.apply_buffer = win_apply_buffer
+	.apply_buffer = win_apply_buffer,
+	.set_draw_scheduling = win_set_draw_scheduling,
 };
 
 // display
@@ -767,18 +968,82 @@ static void display_destroy(struct swa_display* base) {
 	if(dpy->wakeup_pipe_r) close(dpy->wakeup_pipe_r);
 	if(dpy->wakeup_pipe_w) close(dpy->wakeup_pipe_w);
 	if(dpy->wakeup_io) pml_io_destroy(dpy->wakeup_io);
+	if(dpy->dispatch_timer) pml_timer_destroy(dpy->dispatch_timer);
+	if(dpy->timers_source) pml_timer_destroy(dpy->timers_source);
+	swa_timer_queue_finish(&dpy->timers);
+
+	swa_cursor_cache_finish(&dpy->cursor_cache);
+	if(dpy->cursor_theme) swa_xcursor_theme_destroy(dpy->cursor_theme);
 
 	// TODO: cleanup libinput, udev stuff
+	swa_xkb_key_names_finish(&dpy->input.keyboard.names);
 	drm_finish(dpy);
 	free(dpy);
 }
 
-static bool display_dispatch(struct swa_display* base, bool block) {
+static void dispatch_timeout_cb(struct pml_timer* timer) {
+	// no-op, only used to wake up pml_iterate in display_dispatch_timeout
+	(void) timer;
+}
+
+static bool display_dispatch_timeout(struct swa_display* base,
+		int64_t timeout_ns) {
 	struct swa_display_kms* dpy = get_display_kms(base);
-	pml_iterate(dpy->pml, block);
+	if(timeout_ns > 0) {
+		if(!dpy->dispatch_timer) {
+			dpy->dispatch_timer = pml_timer_new(dpy->pml, NULL,
+				dispatch_timeout_cb);
+			pml_timer_set_clock(dpy->dispatch_timer, CLOCK_MONOTONIC);
+		}
+
+		int64_t deadline = swa_monotonic_ns() + timeout_ns;
+		pml_timer_set_time(dpy->dispatch_timer,
+			swa_timespec_from_ns(deadline));
+		pml_iterate(dpy->pml, true);
+		pml_timer_disable(dpy->dispatch_timer);
+	} else {
+		pml_iterate(dpy->pml, timeout_ns < 0);
+	}
+
 	return !dpy->quit;
 }
 
+static bool display_dispatch(struct swa_display* base, bool block) {
+	return display_dispatch_timeout(base, block ? -1 : 0);
+}
+
+static void timers_cb(struct pml_timer* timer) {
+	struct swa_display_kms* dpy = pml_timer_get_data(timer);
+	swa_timer_queue_dispatch(&dpy->timers, swa_monotonic_ns());
+}
+
+// Called by the timer queue whenever the next timer deadline might
+// have changed. We only use one pml timer for all swa timers.
+static void timers_update(struct swa_timer_queue* queue) {
+	struct swa_display_kms* dpy = queue->data;
+	int64_t next = swa_timer_queue_next(queue);
+	if(next < 0) {
+		if(dpy->timers_source) {
+			pml_timer_disable(dpy->timers_source);
+		}
+		return;
+	}
+
+	if(!dpy->timers_source) {
+		dpy->timers_source = pml_timer_new(dpy->pml, NULL, timers_cb);
+		pml_timer_set_data(dpy->timers_source, dpy);
+		pml_timer_set_clock(dpy->timers_source, CLOCK_MONOTONIC);
+	}
+
+	pml_timer_set_time(dpy->timers_source, swa_timespec_from_ns(next));
+}
+
+static struct swa_timer* display_add_timer(struct swa_display* base,
+		int64_t deadline, swa_timer_handler handler, void* userdata) {
+	struct swa_display_kms* dpy = get_display_kms(base);
+	return swa_timer_create(&dpy->timers, deadline, handler, userdata);
+}
+
 static void display_wakeup(struct swa_display* base) {
 	struct swa_display_kms* dpy = get_display_kms(base);
 	int err = write(dpy->wakeup_pipe_w, " ", 1);
@@ -799,7 +1064,8 @@ static enum swa_display_cap display_capabilities(struct swa_display* base) {
 #ifdef SWA_WITH_VK
 		swa_display_cap_vk |
 #endif
-		swa_display_cap_buffer_surface;
+		swa_display_cap_buffer_surface |
+		swa_display_cap_timers;
 
 	if(dpy->input.keyboard.present) caps |= swa_display_cap_keyboard;
 	if(dpy->input.pointer.present) caps |= swa_display_cap_mouse;
@@ -850,7 +1116,8 @@ static const char* display_key_name(struct swa_display* base, enum swa_key key)
 		return NULL;
 	}
 
-	return swa_xkb_key_name_keymap(dpy->input.keyboard.keymap, key);
+	return swa_xkb_key_name_keymap(&dpy->input.keyboard.names,
+		dpy->input.keyboard.keymap, key);
 }
 
 static enum swa_keyboard_mod display_active_keyboard_mods(struct swa_display* base) {
@@ -943,6 +1210,23 @@ static void win_get_size(struct swa_window_kms* win, unsigned* width,
 	}
 }
 
+static void emit_draw(struct swa_window_kms* win) {
+	// output windows are invisible while our vt is inactive, they are
+	// redrawn when it's reacquired, see sigusr_handler
+	if(win->output && !win->dpy->session.active) {
+		return;
+	}
+
+	if(win->base.listener->draw) {
+		swa_draw_sched_begin(&win->sched);
+		win->base.listener->draw(&win->base);
+	}
+}
+
+static void sched_draw_cb(struct swa_timer* timer) {
+	emit_draw(swa_timer_get_userdata(timer));
+}
+
 static void win_handle_deferred(struct pml_defer* defer) {
 	struct swa_window_kms* win = pml_defer_get_data(defer);
 	pml_defer_enable(defer, false);
@@ -958,12 +1242,29 @@ static void win_handle_deferred(struct pml_defer* defer) {
 
 	if(win->defer_events & swa_kms_defer_draw) {
 		win->defer_events &= ~swa_kms_defer_draw;
-		if(win->base.listener->draw) {
-			win->base.listener->draw(&win->base);
+		emit_draw(win);
+	}
+
+	// after draw, the cursor might be committed with the flip
+	if(win->defer_events & swa_kms_defer_cursor) {
+		win->defer_events &= ~swa_kms_defer_cursor;
+		if(win->output) {
+			commit_cursor(win->dpy, win->output);
 		}
 	}
 }
 
+// Returns the duration of one refresh cycle of the given mode in ns.
+static uint64_t mode_refresh_ns(const drmModeModeInfo* mode) {
+	// clock is given in kHz
+	uint64_t pixels = (uint64_t) mode->htotal * mode->vtotal;
+	if(!mode->clock || !pixels) {
+		return 0;
+	}
+
+	return (1000 * 1000 * pixels) / mode->clock;
+}
+
 static void page_flip_handler(int fd, unsigned seq,
 		unsigned tv_sec, unsigned tv_usec, unsigned crtc_id, void *data) {
 	struct swa_display_kms* dpy = data;
@@ -983,14 +1284,53 @@ static void page_flip_handler(int fd, unsigned seq,
 		return;
 	}
 
+	enum swa_kms_commit commit = output->commit;
+	output->commit = swa_kms_commit_none;
+
 	// This might happen if the window is destroyed in between i guess
 	if(!output->window) {
 		dlg_debug("[CRTC:%u] atomic completion for windowless output", crtc_id);
 		return;
 	}
 
-	// manage buffers
 	struct swa_window_kms* win = output->window;
+	if(commit == swa_kms_commit_cursor) {
+		uint32_t fb_id = output->deferred_flip.fb_id;
+		if(!fb_id) {
+			commit_cursor(dpy, output);
+			if(win->redraw) {
+				win->redraw = false;
+				win->defer_events |= swa_kms_defer_draw;
+				pml_defer_enable(win->defer, true);
+			}
+			return;
+		}
+
+		output->deferred_flip.fb_id = 0;
+		if(commit_flip(win, fb_id, output->deferred_flip.width,
+				output->deferred_flip.height)) {
+			return;
+		}
+
+		// give the buffer back and let the application redraw, the
+		// frame was lost
+		if(win->surface_type == swa_surface_buffer && win->buffer.pending) {
+			win->buffer.pending->in_use = false;
+			win->buffer.pending = NULL;
+		} else if(win->surface_type == swa_surface_gl && win->gl.pending) {
+#ifdef SWA_WITH_GL
+			gbm_surface_release_buffer(win->gl.gbm_surface, win->gl.pending);
+#endif // SWA_WITH_GL
+			win->gl.pending = NULL;
+		}
+
+		win->redraw = false;
+		win->defer_events |= swa_kms_defer_draw;
+		pml_defer_enable(win->defer, true);
+		return;
+	}
+
+	// manage buffers
 	if(win->surface_type == swa_surface_buffer) {
 		dlg_assert(win->buffer.pending);
 		dlg_assert(win->buffer.pending->in_use);
@@ -1012,14 +1352,34 @@ static void page_flip_handler(int fd, unsigned seq,
 		output->window->gl.pending = NULL;
 	}
 
+	// drm timestamps are CLOCK_MONOTONIC
+	struct swa_present_event ev = {
+		.time_ns = 1000 * (1000 * 1000 * (uint64_t) tv_sec + tv_usec),
+		.refresh_ns = mode_refresh_ns(&output->mode),
+		.seq = seq,
+	};
+	swa_draw_sched_presented(&win->sched, &ev);
+	if(win->base.listener->presented) {
+		win->base.listener->presented(&win->base, &ev);
+		if(!output->window) { // destroyed in callback
+			return;
+		}
+	}
+
 	// redraw, if requested
-	if(output->window->redraw) {
-		output->window->redraw = false;
-		struct swa_window* base = &output->window->base;
-		if(base->listener->draw) {
-			base->listener->draw(base);
+	if(win->redraw) {
+		win->redraw = false;
+		if(!swa_draw_sched_defer(&win->sched, &dpy->timers,
+				sched_draw_cb, win)) {
+			emit_draw(win);
+			if(!output->window) { // destroyed in callback
+				return;
+			}
 		}
 	}
+
+	// cursor changes that weren't committed with a new flip
+	commit_cursor(dpy, output);
 }
 
 static void drm_io(struct pml_io* io, unsigned revents) {
@@ -1036,6 +1396,16 @@ static void drm_io(struct pml_io* io, unsigned revents) {
 	}
 }
 
+static bool cursor_plane_used(struct swa_display_kms* dpy, uint32_t plane_id) {
+	for(unsigned i = 0u; i < dpy->drm.n_outputs; ++i) {
+		if(dpy->drm.outputs[i].cursor_plane.id == plane_id) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static bool output_init(struct swa_display_kms* dpy,
 		struct swa_kms_output* output, drmModeConnectorPtr connector) {
 	bool success = false;
@@ -1063,9 +1433,11 @@ static bool output_init(struct swa_display_kms* dpy,
 	}
 
 	drmModeCrtcPtr crtc = NULL;
+	unsigned crtc_index = 0u;
 	for(int c = 0; c < dpy->drm.res->count_crtcs; c++) {
 		if(dpy->drm.res->crtcs[c] == encoder->crtc_id) {
 			crtc = drmModeGetCrtc(dpy->drm.fd, dpy->drm.res->crtcs[c]);
+			crtc_index = c;
 			break;
 		}
 	}
@@ -1100,12 +1472,14 @@ static bool output_init(struct swa_display_kms* dpy,
 			dpy->drm.planes[p]->crtc_id,
 			dpy->drm.planes[p]->fb_id,
 			type);
-		/*
 		if(type == DRM_PLANE_TYPE_CURSOR && !output->cursor_plane.id) {
+			if((dpy->drm.planes[p]->possible_crtcs & (1u << crtc_index)) &&
+					!cursor_plane_used(dpy, plane_id)) {
 				dlg_debug("  used as cursor plane");
-				output->cursor_plane.id = dpy->drm.planes[p]->plane_id;
+				output->cursor_plane.id = plane_id;
 				output->cursor_plane.props = props;
-		} else */ if(type == DRM_PLANE_TYPE_PRIMARY && !output->primary_plane.id) {
+			}
+		} else if(type == DRM_PLANE_TYPE_PRIMARY && !output->primary_plane.id) {
 			if(dpy->drm.planes[p]->crtc_id == crtc->crtc_id &&
 					dpy->drm.planes[p]->fb_id == crtc->buffer_id) {
 				dlg_debug("  used as primary plane");
@@ -1120,6 +1494,10 @@ static bool output_init(struct swa_display_kms* dpy,
 		goto out_crtc;
 	}
 
+	if(!output->cursor_plane.id) {
+		dlg_debug("No cursor plane, using legacy cursor api");
+	}
+
 	// DRM is supposed to provide a refresh interval, but often doesn't;
 	// calculate our own in milliHz for higher precision anyway.
 	uint64_t refresh = ((crtc->mode.clock * 1000000LL / crtc->mode.htotal) +
@@ -1334,6 +1712,9 @@ static void sigusr_handler(struct pml_io* io, unsigned revents) {
 				}
 
 				struct swa_window* base = &dpy->drm.outputs[i].window->base;
+				if(base->listener->visibility) {
+					base->listener->visibility(base, false);
+				}
 				if(base->listener->focus) {
 					base->listener->focus(base, false);
 				}
@@ -1360,6 +1741,9 @@ static void sigusr_handler(struct pml_io* io, unsigned revents) {
 				dpy->drm.outputs[i].window->defer_events |= swa_kms_defer_draw;
 				pml_defer_enable(dpy->drm.outputs[i].window->defer, true);
 				struct swa_window* base = &dpy->drm.outputs[i].window->base;
+				if(base->listener->visibility) {
+					base->listener->visibility(base, true);
+				}
 				if(base->listener->focus) {
 					base->listener->focus(base, true);
 				}
@@ -1691,6 +2075,7 @@ error:
 static const struct swa_display_interface display_impl = {
 	.destroy = display_destroy,
 	.dispatch = display_dispatch,
+	.dispatch_timeout = display_dispatch_timeout,
 	.wakeup = display_wakeup,
 	.capabilities = display_capabilities,
 	.vk_extensions = display_vk_extensions,
@@ -1705,6 +2090,7 @@ static const struct swa_display_interface display_impl = {
 	.set_clipboard = display_set_clipboard,
 	.start_dnd = display_start_dnd,
 	.create_window = display_create_window,
+	.add_timer = display_add_timer,
 };
 
 static void udev_io(struct pml_io* io, unsigned revents) {
@@ -1777,8 +2163,7 @@ static const struct libinput_interface libinput_impl = {
 static bool init_xkb(struct swa_display_kms* dpy) {
 	struct xkb_rule_names rules = { 0 };
 	struct xkb_context* context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	dpy->input.keyboard.keymap = xkb_map_new_from_names(context, &rules,
-		XKB_KEYMAP_COMPILE_NO_FLAGS);
+	dpy->input.keyboard.keymap = swa_xkb_keymap_new_from_names(context, &rules);
 	if(!dpy->input.keyboard.keymap) {
 		dlg_error("Failed to create xkb keymap: %s", strerror(errno));
 		return false;
@@ -1894,6 +2279,7 @@ static void handle_keyboard_key(struct swa_display_kms* dpy,
 			.utf8 = utf8,
 			.repeated = false,
 			.modifiers = swa_xkb_modifiers_state(dpy->input.keyboard.state),
+			.time_usec = libinput_event_keyboard_get_time_usec(kbevent),
 		};
 		focus->base.listener->key(&focus->base, &ev);
 	}
@@ -1901,36 +2287,18 @@ static void handle_keyboard_key(struct swa_display_kms* dpy,
 	// TODO: manually trigger repeat events via a timer
 }
 
-static void update_cursor_position(struct swa_display_kms* dpy) {
-	// TODO: fix for vulkan
-	if(!dpy->input.pointer.over ||
-			!dpy->input.pointer.over->output ||
-			// !dpy->input.pointer.over->output->cursor_plane.id ||
-			!dpy->input.pointer.over->cursor.buffer.buffer.fb_id) {
+// Motion events are merged until all events read from libinput were
+// processed or a different event arrives (to keep the order of events).
+// With high-rate mice, there are often dozens of motion events per
+// dispatch and there is no point in forwarding every single one of them.
+static void flush_pointer_motion(struct swa_display_kms* dpy) {
+	if(!dpy->input.pointer.motion.pending) {
 		return;
 	}
 
-	struct swa_window_kms* win = dpy->input.pointer.over;
-	struct swa_kms_output* output = win->output;
-
-	int32_t x = win->dpy->input.pointer.x - win->cursor.buffer.hx;
-	int32_t y = win->dpy->input.pointer.y - win->cursor.buffer.hy;
-	int err = drmModeMoveCursor(dpy->drm.fd, output->crtc.id, x, y);
-	dlg_assertm(!err, "drmModeMoveCursor: %s", strerror(errno));
-}
-
-static void handle_pointer_motion(struct swa_display_kms* dpy,
-		struct libinput_event* base_ev) {
-	struct libinput_event_pointer* ev =
-		libinput_event_get_pointer_event(base_ev);
-
-	double dx = libinput_event_pointer_get_dx(ev);
-	double dy = libinput_event_pointer_get_dy(ev);
-	int ox = dpy->input.pointer.x;
-	int oy = dpy->input.pointer.y;
-	dpy->input.pointer.x += dx;
-	dpy->input.pointer.y += dy;
-
+	dpy->input.pointer.motion.pending = false;
+	int ox = dpy->input.pointer.motion.x;
+	int oy = dpy->input.pointer.motion.y;
 	if(ox == (int) dpy->input.pointer.x && oy == (int) dpy->input.pointer.y) {
 		return;
 	}
@@ -1942,6 +2310,7 @@ static void handle_pointer_motion(struct swa_display_kms* dpy,
 			.y = (int) dpy->input.pointer.y,
 			.dx = (int) dpy->input.pointer.x - ox,
 			.dy = (int) dpy->input.pointer.y - oy,
+			.time_usec = dpy->input.pointer.motion.time_usec,
 		};
 		over->base.listener->mouse_move(&over->base, &ev);
 	}
@@ -1949,6 +2318,32 @@ static void handle_pointer_motion(struct swa_display_kms* dpy,
 	update_cursor_position(dpy);
 }
 
+static void add_pointer_motion(struct swa_display_kms* dpy,
+		double x, double y, uint64_t time) {
+	if(!dpy->input.pointer.motion.pending) {
+		dpy->input.pointer.motion.pending = true;
+		dpy->input.pointer.motion.x = dpy->input.pointer.x;
+		dpy->input.pointer.motion.y = dpy->input.pointer.y;
+	}
+
+	// the timestamp of the last merged event
+	dpy->input.pointer.motion.time_usec = time;
+	dpy->input.pointer.x = x;
+	dpy->input.pointer.y = y;
+}
+
+static void handle_pointer_motion(struct swa_display_kms* dpy,
+		struct libinput_event* base_ev) {
+	struct libinput_event_pointer* ev =
+		libinput_event_get_pointer_event(base_ev);
+
+	double dx = libinput_event_pointer_get_dx(ev);
+	double dy = libinput_event_pointer_get_dy(ev);
+	uint64_t time = libinput_event_pointer_get_time_usec(ev);
+	add_pointer_motion(dpy, dpy->input.pointer.x + dx,
+		dpy->input.pointer.y + dy, time);
+}
+
 static void handle_pointer_motion_abs(struct swa_display_kms* dpy,
 		struct libinput_event* base_ev) {
 	struct libinput_event_pointer* ev =
@@ -1957,28 +2352,8 @@ static void handle_pointer_motion_abs(struct swa_display_kms* dpy,
 	// TODO: real width/height of current output here?
 	double x = libinput_event_pointer_get_absolute_x_transformed(ev, 1);
 	double y = libinput_event_pointer_get_absolute_y_transformed(ev, 1);
-
-	int ox = dpy->input.pointer.x;
-	int oy = dpy->input.pointer.y;
-	dpy->input.pointer.x = x;
-	dpy->input.pointer.y = y;
-
-	if(ox == (int) dpy->input.pointer.x && oy == (int) dpy->input.pointer.y) {
-		return;
-	}
-
-	struct swa_window_kms* over = dpy->input.pointer.over;
-	if(over && over->base.listener->mouse_move) {
-		struct swa_mouse_move_event ev = {
-			.x = (int) dpy->input.pointer.x,
-			.y = (int) dpy->input.pointer.y,
-			.dx = (int) dpy->input.pointer.x - ox,
-			.dy = (int) dpy->input.pointer.y - oy,
-		};
-		over->base.listener->mouse_move(&over->base, &ev);
-	}
-
-	update_cursor_position(dpy);
+	uint64_t time = libinput_event_pointer_get_time_usec(ev);
+	add_pointer_motion(dpy, x, y, time);
 }
 
 static enum swa_mouse_button linux_to_button(uint32_t buttoncode) {
@@ -2016,6 +2391,7 @@ static void handle_pointer_button(struct swa_display_kms* dpy,
 	struct swa_window_kms* over = dpy->input.pointer.over;
 	uint32_t linux_button = libinput_event_pointer_get_button(ev);
 	enum swa_mouse_button button = linux_to_button(linux_button);
+	uint64_t time = libinput_event_pointer_get_time_usec(ev);
 
 	if(pressed) {
 		dpy->input.pointer.button_states |= (uint64_t)(1 << button);
@@ -2029,6 +2405,7 @@ static void handle_pointer_button(struct swa_display_kms* dpy,
 			.y = (int) dpy->input.pointer.y,
 			.button = button,
 			.pressed = pressed,
+			.time_usec = time,
 		};
 		over->base.listener->mouse_button(&over->base, &ev);
 	}
@@ -2038,6 +2415,11 @@ static void handle_libinput_event(struct swa_display_kms* dpy,
 		struct libinput_event* event) {
 	struct libinput_device* libinput_dev = libinput_event_get_device(event);
 	enum libinput_event_type event_type = libinput_event_get_type(event);
+	if(event_type != LIBINPUT_EVENT_POINTER_MOTION &&
+			event_type != LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE) {
+		flush_pointer_motion(dpy);
+	}
+
 	switch (event_type) {
 	case LIBINPUT_EVENT_DEVICE_ADDED:
 		handle_device_added(dpy, libinput_dev);
@@ -2089,6 +2471,8 @@ static void libinput_io(struct pml_io* io, unsigned revents) {
 		handle_libinput_event(dpy, event);
 		libinput_event_destroy(event);
 	}
+
+	flush_pointer_motion(dpy);
 }
 
 static void log_libinput(struct libinput *libinput_context,
@@ -2185,6 +2569,10 @@ struct swa_display* swa_display_kms_create(const char* appname) {
 	struct swa_display_kms* dpy = calloc(1, sizeof(*dpy));
 	dpy->base.impl = &display_impl;
 	dpy->pml = pml_new();
+	dpy->cursor_cache.destroy = destroy_cursor;
+	dpy->cursor_cache.data = dpy;
+	dpy->timers.update = timers_update;
+	dpy->timers.data = dpy;
 
 	// create wakeup pipes
 	int fds[2];
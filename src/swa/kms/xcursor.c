@@ -25,10 +25,14 @@
  */
 
 #define _DEFAULT_SOURCE
-#include <dirent.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 typedef int		XcursorBool;
 typedef unsigned int	XcursorUInt;
@@ -36,37 +40,6 @@ typedef unsigned int	XcursorUInt;
 typedef XcursorUInt	XcursorDim;
 typedef XcursorUInt	XcursorPixel;
 
-typedef struct _XcursorImage {
-    XcursorUInt	    version;	/* version of the image data */
-    XcursorDim	    size;	/* nominal size for matching */
-    XcursorDim	    width;	/* actual width */
-    XcursorDim	    height;	/* actual height */
-    XcursorDim	    xhot;	/* hot spot x (must be inside image) */
-    XcursorDim	    yhot;	/* hot spot y (must be inside image) */
-    XcursorUInt	    delay;	/* animation delay to next frame (ms) */
-    XcursorPixel    *pixels;	/* pointer to pixels */
-} XcursorImage;
-
-/*
- * Other data structures exposed by the library API
- */
-typedef struct _XcursorImages {
-    int		    nimage;	/* number of images */
-    XcursorImage    **images;	/* array of XcursorImage pointers */
-    char	    *name;	/* name used to load images */
-} XcursorImages;
-
-XcursorImages *
-XcursorLibraryLoadImages (const char *file, const char *theme, int size);
-
-void
-XcursorImagesDestroy (XcursorImages *images);
-
-void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
-		    void *user_data);
-
 /*
  * From libXcursor/include/X11/extensions/Xcursor.h
  */
@@ -217,429 +190,6 @@ typedef struct _XcursorComment {
 #define XCURSOR_IMAGE_HEADER_LEN    (XCURSOR_CHUNK_HEADER_LEN + (5*4))
 #define XCURSOR_IMAGE_MAX_SIZE	    0x7fff	/* 32767x32767 max cursor size */
 
-typedef struct _XcursorFile XcursorFile;
-
-struct _XcursorFile {
-    void    *closure;
-    int	    (*read)  (XcursorFile *file, unsigned char *buf, int len);
-    int	    (*write) (XcursorFile *file, unsigned char *buf, int len);
-    int	    (*seek)  (XcursorFile *file, long offset, int whence);
-};
-
-typedef struct _XcursorComments {
-    int		    ncomment;	/* number of comments */
-    XcursorComment  **comments;	/* array of XcursorComment pointers */
-} XcursorComments;
-
-/*
- * From libXcursor/src/file.c
- */
-
-static XcursorImage *
-XcursorImageCreate (int width, int height)
-{
-    XcursorImage    *image;
-
-    image = malloc (sizeof (XcursorImage) +
-		    width * height * sizeof (XcursorPixel));
-    if (!image)
-	return NULL;
-    image->version = XCURSOR_IMAGE_VERSION;
-    image->pixels = (XcursorPixel *) (image + 1);
-    image->size = width > height ? width : height;
-    image->width = width;
-    image->height = height;
-    image->delay = 0;
-    return image;
-}
-
-static void
-XcursorImageDestroy (XcursorImage *image)
-{
-    free (image);
-}
-
-static XcursorImages *
-XcursorImagesCreate (int size)
-{
-    XcursorImages   *images;
-
-    images = malloc (sizeof (XcursorImages) +
-		     size * sizeof (XcursorImage *));
-    if (!images)
-	return NULL;
-    images->nimage = 0;
-    images->images = (XcursorImage **) (images + 1);
-    images->name = NULL;
-    return images;
-}
-
-void
-XcursorImagesDestroy (XcursorImages *images)
-{
-    int	n;
-
-    if (!images)
-        return;
-
-    for (n = 0; n < images->nimage; n++)
-	XcursorImageDestroy (images->images[n]);
-    if (images->name)
-	free (images->name);
-    free (images);
-}
-
-static void
-XcursorImagesSetName (XcursorImages *images, const char *name)
-{
-    char    *new;
-
-    if (!images || !name)
-        return;
-
-    new = malloc (strlen (name) + 1);
-
-    if (!new)
-	return;
-
-    strcpy (new, name);
-    if (images->name)
-	free (images->name);
-    images->name = new;
-}
-
-static XcursorBool
-_XcursorReadUInt (XcursorFile *file, XcursorUInt *u)
-{
-    unsigned char   bytes[4];
-
-    if (!file || !u)
-        return XcursorFalse;
-
-    if ((*file->read) (file, bytes, 4) != 4)
-	return XcursorFalse;
-    *u = ((bytes[0] << 0) |
-	  (bytes[1] << 8) |
-	  (bytes[2] << 16) |
-	  (bytes[3] << 24));
-    return XcursorTrue;
-}
-
-static void
-_XcursorFileHeaderDestroy (XcursorFileHeader *fileHeader)
-{
-    free (fileHeader);
-}
-
-static XcursorFileHeader *
-_XcursorFileHeaderCreate (int ntoc)
-{
-    XcursorFileHeader	*fileHeader;
-
-    if (ntoc > 0x10000)
-	return NULL;
-    fileHeader = malloc (sizeof (XcursorFileHeader) +
-			 ntoc * sizeof (XcursorFileToc));
-    if (!fileHeader)
-	return NULL;
-    fileHeader->magic = XCURSOR_MAGIC;
-    fileHeader->header = XCURSOR_FILE_HEADER_LEN;
-    fileHeader->version = XCURSOR_FILE_VERSION;
-    fileHeader->ntoc = ntoc;
-    fileHeader->tocs = (XcursorFileToc *) (fileHeader + 1);
-    return fileHeader;
-}
-
-static XcursorFileHeader *
-_XcursorReadFileHeader (XcursorFile *file)
-{
-    XcursorFileHeader	head, *fileHeader;
-    XcursorUInt		skip;
-    unsigned int	n;
-
-    if (!file)
-        return NULL;
-
-    if (!_XcursorReadUInt (file, &head.magic))
-	return NULL;
-    if (head.magic != XCURSOR_MAGIC)
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.header))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.version))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.ntoc))
-	return NULL;
-    skip = head.header - XCURSOR_FILE_HEADER_LEN;
-    if (skip)
-	if ((*file->seek) (file, skip, SEEK_CUR) == EOF)
-	    return NULL;
-    fileHeader = _XcursorFileHeaderCreate (head.ntoc);
-    if (!fileHeader)
-	return NULL;
-    fileHeader->magic = head.magic;
-    fileHeader->header = head.header;
-    fileHeader->version = head.version;
-    fileHeader->ntoc = head.ntoc;
-    for (n = 0; n < fileHeader->ntoc; n++)
-    {
-	if (!_XcursorReadUInt (file, &fileHeader->tocs[n].type))
-	    break;
-	if (!_XcursorReadUInt (file, &fileHeader->tocs[n].subtype))
-	    break;
-	if (!_XcursorReadUInt (file, &fileHeader->tocs[n].position))
-	    break;
-    }
-    if (n != fileHeader->ntoc)
-    {
-	_XcursorFileHeaderDestroy (fileHeader);
-	return NULL;
-    }
-    return fileHeader;
-}
-
-static XcursorBool
-_XcursorSeekToToc (XcursorFile		*file,
-		   XcursorFileHeader	*fileHeader,
-		   int			toc)
-{
-    if (!file || !fileHeader || \
-        (*file->seek) (file, fileHeader->tocs[toc].position, SEEK_SET) == EOF)
-	return XcursorFalse;
-    return XcursorTrue;
-}
-
-static XcursorBool
-_XcursorFileReadChunkHeader (XcursorFile	*file,
-			     XcursorFileHeader	*fileHeader,
-			     int		toc,
-			     XcursorChunkHeader	*chunkHeader)
-{
-    if (!file || !fileHeader || !chunkHeader)
-        return XcursorFalse;
-    if (!_XcursorSeekToToc (file, fileHeader, toc))
-	return XcursorFalse;
-    if (!_XcursorReadUInt (file, &chunkHeader->header))
-	return XcursorFalse;
-    if (!_XcursorReadUInt (file, &chunkHeader->type))
-	return XcursorFalse;
-    if (!_XcursorReadUInt (file, &chunkHeader->subtype))
-	return XcursorFalse;
-    if (!_XcursorReadUInt (file, &chunkHeader->version))
-	return XcursorFalse;
-    /* sanity check */
-    if (chunkHeader->type != fileHeader->tocs[toc].type ||
-	chunkHeader->subtype != fileHeader->tocs[toc].subtype)
-	return XcursorFalse;
-    return XcursorTrue;
-}
-
-#define dist(a,b)   ((a) > (b) ? (a) - (b) : (b) - (a))
-
-static XcursorDim
-_XcursorFindBestSize (XcursorFileHeader *fileHeader,
-		      XcursorDim	size,
-		      int		*nsizesp)
-{
-    unsigned int n;
-    int		nsizes = 0;
-    XcursorDim	bestSize = 0;
-    XcursorDim	thisSize;
-
-    if (!fileHeader || !nsizesp)
-        return 0;
-
-    for (n = 0; n < fileHeader->ntoc; n++)
-    {
-	if (fileHeader->tocs[n].type != XCURSOR_IMAGE_TYPE)
-	    continue;
-	thisSize = fileHeader->tocs[n].subtype;
-	if (!bestSize || dist (thisSize, size) < dist (bestSize, size))
-	{
-	    bestSize = thisSize;
-	    nsizes = 1;
-	}
-	else if (thisSize == bestSize)
-	    nsizes++;
-    }
-    *nsizesp = nsizes;
-    return bestSize;
-}
-
-static int
-_XcursorFindImageToc (XcursorFileHeader	*fileHeader,
-		      XcursorDim	size,
-		      int		count)
-{
-    unsigned int	toc;
-    XcursorDim		thisSize;
-
-    if (!fileHeader)
-        return 0;
-
-    for (toc = 0; toc < fileHeader->ntoc; toc++)
-    {
-	if (fileHeader->tocs[toc].type != XCURSOR_IMAGE_TYPE)
-	    continue;
-	thisSize = fileHeader->tocs[toc].subtype;
-	if (thisSize != size)
-	    continue;
-	if (!count)
-	    break;
-	count--;
-    }
-    if (toc == fileHeader->ntoc)
-	return -1;
-    return toc;
-}
-
-static XcursorImage *
-_XcursorReadImage (XcursorFile		*file,
-		   XcursorFileHeader	*fileHeader,
-		   int			toc)
-{
-    XcursorChunkHeader	chunkHeader;
-    XcursorImage	head;
-    XcursorImage	*image;
-    int			n;
-    XcursorPixel	*p;
-
-    if (!file || !fileHeader)
-        return NULL;
-
-    if (!_XcursorFileReadChunkHeader (file, fileHeader, toc, &chunkHeader))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.width))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.height))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.xhot))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.yhot))
-	return NULL;
-    if (!_XcursorReadUInt (file, &head.delay))
-	return NULL;
-    /* sanity check data */
-    if (head.width >= 0x10000 || head.height > 0x10000)
-	return NULL;
-    if (head.width == 0 || head.height == 0)
-	return NULL;
-    if (head.xhot > head.width || head.yhot > head.height)
-	return NULL;
-
-    /* Create the image and initialize it */
-    image = XcursorImageCreate (head.width, head.height);
-    if (image == NULL)
-	    return NULL;
-    if (chunkHeader.version < image->version)
-	image->version = chunkHeader.version;
-    image->size = chunkHeader.subtype;
-    image->xhot = head.xhot;
-    image->yhot = head.yhot;
-    image->delay = head.delay;
-    n = image->width * image->height;
-    p = image->pixels;
-    while (n--)
-    {
-	if (!_XcursorReadUInt (file, p))
-	{
-	    XcursorImageDestroy (image);
-	    return NULL;
-	}
-	p++;
-    }
-    return image;
-}
-
-static XcursorImages *
-XcursorXcFileLoadImages (XcursorFile *file, int size)
-{
-    XcursorFileHeader	*fileHeader;
-    XcursorDim		bestSize;
-    int			nsize;
-    XcursorImages	*images;
-    int			n;
-    int			toc;
-
-    if (!file || size < 0)
-	return NULL;
-    fileHeader = _XcursorReadFileHeader (file);
-    if (!fileHeader)
-	return NULL;
-    bestSize = _XcursorFindBestSize (fileHeader, (XcursorDim) size, &nsize);
-    if (!bestSize)
-    {
-        _XcursorFileHeaderDestroy (fileHeader);
-	return NULL;
-    }
-    images = XcursorImagesCreate (nsize);
-    if (!images)
-    {
-        _XcursorFileHeaderDestroy (fileHeader);
-	return NULL;
-    }
-    for (n = 0; n < nsize; n++)
-    {
-	toc = _XcursorFindImageToc (fileHeader, bestSize, n);
-	if (toc < 0)
-	    break;
-	images->images[images->nimage] = _XcursorReadImage (file, fileHeader,
-							    toc);
-	if (!images->images[images->nimage])
-	    break;
-	images->nimage++;
-    }
-    _XcursorFileHeaderDestroy (fileHeader);
-    if (images->nimage != nsize)
-    {
-	XcursorImagesDestroy (images);
-	images = NULL;
-    }
-    return images;
-}
-
-static int
-_XcursorStdioFileRead (XcursorFile *file, unsigned char *buf, int len)
-{
-    FILE    *f = file->closure;
-    return fread (buf, 1, len, f);
-}
-
-static int
-_XcursorStdioFileWrite (XcursorFile *file, unsigned char *buf, int len)
-{
-    FILE    *f = file->closure;
-    return fwrite (buf, 1, len, f);
-}
-
-static int
-_XcursorStdioFileSeek (XcursorFile *file, long offset, int whence)
-{
-    FILE    *f = file->closure;
-    return fseek (f, offset, whence);
-}
-
-static void
-_XcursorStdioFileInitialize (FILE *stdfile, XcursorFile *file)
-{
-    file->closure = stdfile;
-    file->read = _XcursorStdioFileRead;
-    file->write = _XcursorStdioFileWrite;
-    file->seek = _XcursorStdioFileSeek;
-}
-
-static XcursorImages *
-XcursorFileLoadImages (FILE *file, int size)
-{
-    XcursorFile	f;
-
-    if (!file)
-        return NULL;
-
-    _XcursorStdioFileInitialize (file, &f);
-    return XcursorXcFileLoadImages (&f, size);
-}
-
 /*
  * From libXcursor/src/library.c
  */
@@ -825,187 +375,6 @@ _XcursorThemeInherits (const char *full)
     return result;
 }
 
-static FILE *
-XcursorScanTheme (const char *theme, const char *name)
-{
-    FILE	*f = NULL;
-    char	*full;
-    char	*dir;
-    const char  *path;
-    char	*inherits = NULL;
-    const char	*i;
-
-    if (!theme || !name)
-        return NULL;
-
-    /*
-     * Scan this theme
-     */
-    for (path = XcursorLibraryPath ();
-	 path && f == NULL;
-	 path = _XcursorNextPath (path))
-    {
-	dir = _XcursorBuildThemeDir (path, theme);
-	if (dir)
-	{
-	    full = _XcursorBuildFullname (dir, "cursors", name);
-	    if (full)
-	    {
-		f = fopen (full, "r");
-		free (full);
-	    }
-	    if (!f && !inherits)
-	    {
-		full = _XcursorBuildFullname (dir, "", "index.theme");
-		if (full)
-		{
-		    inherits = _XcursorThemeInherits (full);
-		    free (full);
-		}
-	    }
-	    free (dir);
-	}
-    }
-    /*
-     * Recurse to scan inherited themes
-     */
-    for (i = inherits; i && f == NULL; i = _XcursorNextPath (i))
-	f = XcursorScanTheme (i, name);
-    if (inherits != NULL)
-	free (inherits);
-    return f;
-}
-
-XcursorImages *
-XcursorLibraryLoadImages (const char *file, const char *theme, int size)
-{
-    FILE	    *f = NULL;
-    XcursorImages   *images = NULL;
-
-    if (!file)
-        return NULL;
-
-    if (theme)
-	f = XcursorScanTheme (theme, file);
-    if (!f)
-	f = XcursorScanTheme ("default", file);
-    if (f)
-    {
-	images = XcursorFileLoadImages (f, size);
-	if (images)
-	    XcursorImagesSetName (images, file);
-	fclose (f);
-    }
-    return images;
-}
-
-static void
-load_all_cursors_from_dir(const char *path, int size,
-			  void (*load_callback)(XcursorImages *, void *),
-			  void *user_data)
-{
-	FILE *f;
-	DIR *dir = opendir(path);
-	struct dirent *ent;
-	char *full;
-	XcursorImages *images;
-
-	if (!dir)
-		return;
-
-	for(ent = readdir(dir); ent; ent = readdir(dir)) {
-		if (ent->d_type != DT_UNKNOWN &&
-		    (ent->d_type != DT_REG && ent->d_type != DT_LNK))
-			continue;
-
-		full = _XcursorBuildFullname(path, "", ent->d_name);
-		if (!full)
-			continue;
-
-		f = fopen(full, "r");
-		if (!f) {
-			free(full);
-			continue;
-		}
-
-		images = XcursorFileLoadImages(f, size);
-
-		if (images) {
-			XcursorImagesSetName(images, ent->d_name);
-			load_callback(images, user_data);
-		}
-
-		fclose (f);
-		free(full);
-	}
-
-	closedir(dir);
-}
-
-/** Load all the cursor of a theme
- *
- * This function loads all the cursor images of a given theme and its
- * inherited themes. Each cursor is loaded into an XcursorImages object
- * which is passed to the caller's load callback. If a cursor appears
- * more than once across all the inherited themes, the load callback
- * will be called multiple times, with possibly different XcursorImages
- * object which have the same name. The user is expected to destroy the
- * XcursorImages objects passed to the callback with
- * XcursorImagesDestroy().
- *
- * \param theme The name of theme that should be loaded
- * \param size The desired size of the cursor images
- * \param load_callback A callback function that will be called
- * for each cursor loaded. The first parameter is the XcursorImages
- * object representing the loaded cursor and the second is a pointer
- * to data provided by the user.
- * \param user_data The data that should be passed to the load callback
- */
-void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
-		    void *user_data)
-{
-	char *full, *dir;
-	char *inherits = NULL;
-	const char *path, *i;
-
-	if (!theme)
-		theme = "default";
-
-	for (path = XcursorLibraryPath();
-	     path;
-	     path = _XcursorNextPath(path)) {
-		dir = _XcursorBuildThemeDir(path, theme);
-		if (!dir)
-			continue;
-
-		full = _XcursorBuildFullname(dir, "cursors", "");
-
-		if (full) {
-			load_all_cursors_from_dir(full, size, load_callback,
-						  user_data);
-			free(full);
-		}
-
-		if (!inherits) {
-			full = _XcursorBuildFullname(dir, "", "index.theme");
-			if (full) {
-				inherits = _XcursorThemeInherits(full);
-				free(full);
-			}
-		}
-
-		free(dir);
-	}
-
-	for (i = inherits; i; i = _XcursorNextPath(i))
-		xcursor_load_theme(i, size, load_callback, user_data);
-
-	if (inherits)
-		free(inherits);
-}
-
 // wayland xcursor api
 #include <swa/private/kms/xcursor.h>
 #include <dlg/dlg.h>
@@ -1022,6 +391,7 @@ static void xcursor_destroy(struct swa_xcursor *cursor) {
 	free(cursor);
 }
 
+
 static struct swa_xcursor *xcursor_create_from_data(
 		struct cursor_metadata *metadata, struct swa_xcursor_theme *theme) {
 	struct swa_xcursor *cursor;
@@ -1078,121 +448,316 @@ err_free_cursor:
 	return NULL;
 }
 
-static void load_default_theme(struct swa_xcursor_theme *theme) {
-	uint32_t i;
+// Lazy theme index.
+// Instead of loading all cursors of the theme (and all inherited themes)
+// up front, only the list of cursor directories is built, on the first
+// lookup. Cursors are then loaded individually when first requested.
 
-	free(theme->name);
-	theme->name = strdup("default");
+static bool theme_has_dir(struct swa_xcursor_theme *theme, const char *dir) {
+	for (unsigned int i = 0; i < theme->dir_count; i++) {
+		if (strcmp(theme->dirs[i], dir) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void theme_add_dir(struct swa_xcursor_theme *theme, char *dir) {
+	char **dirs = realloc(theme->dirs,
+		(theme->dir_count + 1) * sizeof(*theme->dirs));
+	if (!dirs) {
+		free(dir);
+		return;
+	}
+
+	theme->dirs = dirs;
+	theme->dirs[theme->dir_count++] = dir;
+}
 
-	theme->cursor_count = sizeof(cursor_metadata) / sizeof(cursor_metadata[0]);
-	theme->cursors = malloc(theme->cursor_count * sizeof(*theme->cursors));
+// Mirrors the lookup order of libXcursor: the theme in all library
+// paths first, then the inherited themes (recursively).
+static void index_theme(struct swa_xcursor_theme *theme, const char *name,
+		unsigned depth) {
+	char *full, *dir;
+	char *inherits = NULL;
+	const char *path, *i;
 
-	if (theme->cursors == NULL) {
-		theme->cursor_count = 0;
+	// guard against inheritance cycles
+	if (depth > 16) {
 		return;
 	}
 
-	for (i = 0; i < theme->cursor_count; ++i) {
-		theme->cursors[i] =
-			xcursor_create_from_data(&cursor_metadata[i], theme);
+	for (path = XcursorLibraryPath();
+	     path;
+	     path = _XcursorNextPath(path)) {
+		dir = _XcursorBuildThemeDir(path, name);
+		if (!dir)
+			continue;
+
+		full = _XcursorBuildFullname(dir, "cursors", "");
+		if (full) {
+			struct stat st;
+			if (stat(full, &st) == 0 && S_ISDIR(st.st_mode) &&
+					!theme_has_dir(theme, full)) {
+				theme_add_dir(theme, full);
+			} else {
+				free(full);
+			}
+		}
 
-		if (theme->cursors[i] == NULL) {
-			break;
+		if (!inherits) {
+			full = _XcursorBuildFullname(dir, "", "index.theme");
+			if (full) {
+				inherits = _XcursorThemeInherits(full);
+				free(full);
+			}
 		}
+
+		free(dir);
 	}
-	theme->cursor_count = i;
+
+	for (i = inherits; i; i = _XcursorNextPath(i))
+		index_theme(theme, i, depth + 1);
+
+	if (inherits)
+		free(inherits);
 }
 
-static struct swa_xcursor *xcursor_create_from_xcursor_images(
-		XcursorImages *images, struct swa_xcursor_theme *theme) {
-	struct swa_xcursor *cursor;
-	struct swa_xcursor_image *image;
-	int i, size;
+// Decoding of xcursor files, directly from a (mmapped) buffer.
+// Checks all offsets against the file size since the file might be broken.
 
-	cursor = malloc(sizeof(*cursor));
+#define dist(a,b)   ((a) > (b) ? (a) - (b) : (b) - (a))
+
+static bool read_uint(const uint8_t *data, size_t size, uint64_t offset,
+		uint32_t *out) {
+	if (offset > size || size - offset < 4) {
+		return false;
+	}
+
+	const uint8_t *b = data + offset;
+	*out = ((uint32_t) b[0] << 0) |
+		((uint32_t) b[1] << 8) |
+		((uint32_t) b[2] << 16) |
+		((uint32_t) b[3] << 24);
+	return true;
+}
+
+static struct swa_xcursor_image *decode_image(const uint8_t *data,
+		size_t size, uint32_t position, uint32_t nominal_size) {
+	uint32_t type, subtype;
+	uint32_t width, height, xhot, yhot, delay;
+	if (!read_uint(data, size, position + 4ull, &type) ||
+			!read_uint(data, size, position + 8ull, &subtype) ||
+			!read_uint(data, size, position + 16ull, &width) ||
+			!read_uint(data, size, position + 20ull, &height) ||
+			!read_uint(data, size, position + 24ull, &xhot) ||
+			!read_uint(data, size, position + 28ull, &yhot) ||
+			!read_uint(data, size, position + 32ull, &delay)) {
+		return NULL;
+	}
+
+	// sanity checks, same as libXcursor
+	if (type != XCURSOR_IMAGE_TYPE || subtype != nominal_size) {
+		return NULL;
+	}
+	if (width >= 0x10000 || height > 0x10000) {
+		return NULL;
+	}
+	if (width == 0 || height == 0) {
+		return NULL;
+	}
+	if (xhot > width || yhot > height) {
+		return NULL;
+	}
+
+	uint64_t offset = position + (uint64_t) XCURSOR_IMAGE_HEADER_LEN;
+	uint64_t count = (uint64_t) width * height;
+	if (offset > size || (size - offset) / 4 < count) {
+		return NULL;
+	}
+
+	struct swa_xcursor_image *image = malloc(sizeof(*image));
+	if (!image) {
+		return NULL;
+	}
+
+	image->width = width;
+	image->height = height;
+	image->hotspot_x = xhot;
+	image->hotspot_y = yhot;
+	image->delay = delay;
+	image->buffer = malloc(count * 4);
+	if (!image->buffer) {
+		free(image);
+		return NULL;
+	}
+
+	// pixels are stored as little endian ARGB words
+	uint32_t *pixels = (uint32_t *) image->buffer;
+	for (uint64_t p = 0; p < count; p++) {
+		read_uint(data, size, offset + 4 * p, &pixels[p]);
+	}
+
+	return image;
+}
+
+static struct swa_xcursor *decode_cursor(const uint8_t *data, size_t size,
+		int nominal_size) {
+	uint32_t magic, header, ntoc;
+	if (!read_uint(data, size, 0, &magic) || magic != XCURSOR_MAGIC ||
+			!read_uint(data, size, 4, &header) ||
+			!read_uint(data, size, 12, &ntoc)) {
+		return NULL;
+	}
+	if (ntoc > 0x10000) {
+		return NULL;
+	}
+
+	// find the image size closest to the requested one
+	uint32_t best = 0;
+	unsigned int nbest = 0;
+	for (uint32_t n = 0; n < ntoc; n++) {
+		uint64_t toc = header + (uint64_t) n * XCURSOR_FILE_TOC_LEN;
+		uint32_t type, subtype;
+		if (!read_uint(data, size, toc, &type) ||
+				!read_uint(data, size, toc + 4, &subtype)) {
+			return NULL;
+		}
+
+		if (type != XCURSOR_IMAGE_TYPE) {
+			continue;
+		}
+
+		if (!best || dist(subtype, (uint32_t) nominal_size) <
+				dist(best, (uint32_t) nominal_size)) {
+			best = subtype;
+			nbest = 1;
+		} else if (subtype == best) {
+			nbest++;
+		}
+	}
+
+	if (!best) {
+		return NULL;
+	}
+
+	struct swa_xcursor *cursor = calloc(1, sizeof(*cursor));
 	if (!cursor) {
 		return NULL;
 	}
 
-	cursor->images = malloc(images->nimage * sizeof(cursor->images[0]));
+	cursor->images = calloc(nbest, sizeof(*cursor->images));
 	if (!cursor->images) {
 		free(cursor);
 		return NULL;
 	}
 
-	cursor->name = strdup(images->name);
-	cursor->total_delay = 0;
-
-	for (i = 0; i < images->nimage; i++) {
-		image = malloc(sizeof(*image));
-		if (image == NULL) {
-			break;
+	for (uint32_t n = 0; n < ntoc && cursor->image_count < nbest; n++) {
+		uint64_t toc = header + (uint64_t) n * XCURSOR_FILE_TOC_LEN;
+		uint32_t type, subtype, position;
+		read_uint(data, size, toc, &type);
+		read_uint(data, size, toc + 4, &subtype);
+		if (type != XCURSOR_IMAGE_TYPE || subtype != best) {
+			continue;
 		}
 
-		image->buffer = NULL;
-
-		image->width = images->images[i]->width;
-		image->height = images->images[i]->height;
-		image->hotspot_x = images->images[i]->xhot;
-		image->hotspot_y = images->images[i]->yhot;
-		image->delay = images->images[i]->delay;
+		struct swa_xcursor_image *image = NULL;
+		if (read_uint(data, size, toc + 8, &position)) {
+			image = decode_image(data, size, position, best);
+		}
 
-		size = image->width * image->height * 4;
-		image->buffer = malloc(size);
-		if (!image->buffer) {
-			free(image);
+		if (!image) {
 			break;
 		}
 
-		/* copy pixels to shm pool */
-		memcpy(image->buffer, images->images[i]->pixels, size);
+		cursor->images[cursor->image_count++] = image;
 		cursor->total_delay += image->delay;
-		cursor->images[i] = image;
 	}
-	cursor->image_count = i;
 
-	if (cursor->image_count == 0) {
-		free(cursor->name);
-		free(cursor->images);
-		free(cursor);
+	if (cursor->image_count != nbest) {
+		xcursor_destroy(cursor);
 		return NULL;
 	}
 
 	return cursor;
 }
 
-static void load_callback(XcursorImages *images, void *data) {
-	struct swa_xcursor_theme *theme = data;
-	struct swa_xcursor *cursor;
+static struct swa_xcursor *load_cursor_file(const char *path, int size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
 
-	if (swa_xcursor_theme_get_cursor(theme, images->name)) {
-		XcursorImagesDestroy(images);
-		return;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < XCURSOR_FILE_HEADER_LEN) {
+		close(fd);
+		return NULL;
+	}
+
+	// Only the pages of the chosen image size will actually be read
+	size_t len = st.st_size;
+	void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		dlg_debug("mmap of cursor file %s failed", path);
+		return NULL;
+	}
+
+	struct swa_xcursor *cursor = decode_cursor(data, len, size);
+	munmap(data, len);
+	return cursor;
+}
+
+static struct swa_xcursor *load_cursor(struct swa_xcursor_theme *theme,
+		const char *name) {
+	if (!theme->indexed) {
+		index_theme(theme, theme->name, 0);
+		if (strcmp(theme->name, "default") != 0) {
+			index_theme(theme, "default", 0);
+		}
+
+		theme->indexed = true;
+		dlg_debug("Indexed cursor theme '%s': %u directories",
+			theme->name, theme->dir_count);
 	}
 
-	cursor = xcursor_create_from_xcursor_images(images, theme);
+	for (unsigned int i = 0; i < theme->dir_count; i++) {
+		char *full = _XcursorBuildFullname(theme->dirs[i], "", name);
+		if (!full) {
+			continue;
+		}
+
+		struct swa_xcursor *cursor = load_cursor_file(full, theme->size);
+		if (cursor) {
+			struct swa_xcursor_image *img = cursor->images[0];
+			dlg_debug("Loaded cursor %s (%u images) %dx%d+%d,%d",
+				full, cursor->image_count,
+				img->width, img->height, img->hotspot_x, img->hotspot_y);
+			free(full);
+			return cursor;
+		}
 
-	if (cursor) {
-		theme->cursor_count++;
-		theme->cursors =
-			realloc(theme->cursors,
-				theme->cursor_count * sizeof(theme->cursors[0]));
+		free(full);
+	}
 
-		if (theme->cursors == NULL) {
-			theme->cursor_count--;
-			free(cursor);
-		} else {
-			theme->cursors[theme->cursor_count - 1] = cursor;
+	// no cursor theme is installed at all, use the builtin cursors
+	if (theme->dir_count == 0) {
+		size_t count = sizeof(cursor_metadata) / sizeof(cursor_metadata[0]);
+		for (size_t i = 0; i < count; i++) {
+			if (strcmp(cursor_metadata[i].name, name) == 0) {
+				return xcursor_create_from_data(&cursor_metadata[i], theme);
+			}
 		}
 	}
 
-	XcursorImagesDestroy(images);
+	return NULL;
 }
 
 struct swa_xcursor_theme *swa_xcursor_theme_load(const char *name, int size) {
 	struct swa_xcursor_theme *theme;
 
-	theme = malloc(sizeof(*theme));
+	theme = calloc(1, sizeof(*theme));
 	if (!theme) {
 		return NULL;
 	}
@@ -1203,32 +768,12 @@ struct swa_xcursor_theme *swa_xcursor_theme_load(const char *name, int size) {
 
 	theme->name = strdup(name);
 	if (!theme->name) {
-		goto out_error_name;
-	}
-	theme->size = size;
-	theme->cursor_count = 0;
-	theme->cursors = NULL;
-
-	xcursor_load_theme(name, size, load_callback, theme);
-
-	if (theme->cursor_count == 0) {
-		load_default_theme(theme);
-	}
-
-	dlg_debug("Loaded cursor theme '%s', available cursors:", theme->name);
-	for (size_t i = 0; i < theme->cursor_count; ++i) {
-		struct swa_xcursor *c = theme->cursors[i];
-		struct swa_xcursor_image *i = c->images[0];
-		dlg_debug("  %s (%u images) %dx%d+%d,%d",
-				c->name, c->image_count,
-				i->width, i->height, i->hotspot_x, i->hotspot_y);
+		free(theme);
+		return NULL;
 	}
 
+	theme->size = size;
 	return theme;
-
-out_error_name:
-	free(theme);
-	return NULL;
 }
 
 void swa_xcursor_theme_destroy(struct swa_xcursor_theme *theme) {
@@ -1238,22 +783,55 @@ void swa_xcursor_theme_destroy(struct swa_xcursor_theme *theme) {
 		xcursor_destroy(theme->cursors[i]);
 	}
 
+	for (i = 0; i < theme->dir_count; i++) {
+		free(theme->dirs[i]);
+	}
+
 	free(theme->name);
 	free(theme->cursors);
+	free(theme->dirs);
 	free(theme);
 }
 
 struct swa_xcursor *swa_xcursor_theme_get_cursor(struct swa_xcursor_theme *theme,
 		const char *name) {
 	unsigned int i;
+	struct swa_xcursor *cursor;
 
 	for (i = 0; i < theme->cursor_count; i++) {
-		if (strcmp(name, theme->cursors[i]->name) == 0) {
-			return theme->cursors[i];
+		cursor = theme->cursors[i];
+		if (strcmp(name, cursor->name) == 0) {
+			return cursor->image_count ? cursor : NULL;
 		}
 	}
 
-	return NULL;
+	cursor = load_cursor(theme, name);
+	if (!cursor) {
+		// remember that there is no such cursor, so we don't have to
+		// look through all theme directories again.
+		cursor = calloc(1, sizeof(*cursor));
+		if (!cursor) {
+			return NULL;
+		}
+	}
+
+	free(cursor->name);
+	cursor->name = strdup(name);
+	if (!cursor->name) {
+		xcursor_destroy(cursor);
+		return NULL;
+	}
+
+	struct swa_xcursor **cursors = realloc(theme->cursors,
+		(theme->cursor_count + 1) * sizeof(*theme->cursors));
+	if (!cursors) {
+		xcursor_destroy(cursor);
+		return NULL;
+	}
+
+	theme->cursors = cursors;
+	theme->cursors[theme->cursor_count++] = cursor;
+	return cursor->image_count ? cursor : NULL;
 }
 
 int swa_xcursor_frame_and_duration(struct swa_xcursor *cursor,
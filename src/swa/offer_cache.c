@@ -0,0 +1,53 @@
+#include <swa/private/offer_cache.h>
+#include <dlg/dlg.h>
+#include <stdlib.h>
+#include <string.h>
+
+const struct swa_exchange_data* swa_offer_cache_find(
+		const struct swa_offer_cache* cache, const char* format) {
+	for(unsigned i = 0u; i < cache->n_entries; ++i) {
+		if(strcmp(cache->entries[i].format, format) == 0) {
+			return &cache->entries[i].data;
+		}
+	}
+
+	return NULL;
+}
+
+bool swa_offer_cache_insert(struct swa_offer_cache* cache,
+		const char* format, struct swa_exchange_data data) {
+	dlg_assert(!swa_offer_cache_find(cache, format));
+
+	size_t format_len = strlen(format) + 1;
+	char* format_copy = malloc(format_len);
+	char* data_copy = malloc(data.size ? data.size : 1);
+	struct swa_offer_cache_entry* entries = realloc(cache->entries,
+		(cache->n_entries + 1) * sizeof(*entries));
+	if(!format_copy || !data_copy || !entries) {
+		dlg_warn("failed to allocate data offer cache entry");
+		free(format_copy);
+		free(data_copy);
+		if(entries) cache->entries = entries;
+		return false;
+	}
+
+	memcpy(format_copy, format, format_len);
+	if(data.size) memcpy(data_copy, data.data, data.size);
+
+	cache->entries = entries;
+	struct swa_offer_cache_entry* entry = &entries[cache->n_entries++];
+	entry->format = format_copy;
+	entry->data.data = data_copy;
+	entry->data.size = data.size;
+	return true;
+}
+
+void swa_offer_cache_finish(struct swa_offer_cache* cache) {
+	for(unsigned i = 0u; i < cache->n_entries; ++i) {
+		free((void*) cache->entries[i].format);
+		free((void*) cache->entries[i].data.data);
+	}
+
+	free(cache->entries);
+	memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,99 @@
+#include <swa/private/post.h>
+#include <dlg/dlg.h>
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+static struct swa_posted* exchange_head(struct swa_post_queue* queue,
+		struct swa_posted* val) {
+	return InterlockedExchangePointer((void* volatile*) &queue->head, val);
+}
+
+static struct swa_posted* load_head(struct swa_post_queue* queue) {
+	return InterlockedCompareExchangePointer(
+		(void* volatile*) &queue->head, NULL, NULL);
+}
+
+static bool replace_head(struct swa_post_queue* queue,
+		struct swa_posted** expected, struct swa_posted* val) {
+	struct swa_posted* prev = InterlockedCompareExchangePointer(
+		(void* volatile*) &queue->head, val, *expected);
+	if(prev == *expected) {
+		return true;
+	}
+
+	*expected = prev;
+	return false;
+}
+
+#else // _MSC_VER
+
+static struct swa_posted* exchange_head(struct swa_post_queue* queue,
+		struct swa_posted* val) {
+	return __atomic_exchange_n(&queue->head, val, __ATOMIC_ACQUIRE);
+}
+
+static struct swa_posted* load_head(struct swa_post_queue* queue) {
+	return __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+}
+
+static bool replace_head(struct swa_post_queue* queue,
+		struct swa_posted** expected, struct swa_posted* val) {
+	return __atomic_compare_exchange_n(&queue->head, expected, val, true,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+#endif // _MSC_VER
+
+bool swa_post_queue_push(struct swa_post_queue* queue,
+		struct swa_posted* posted) {
+	struct swa_posted* head = load_head(queue);
+	do {
+		posted->next = head;
+	} while(!replace_head(queue, &head, posted));
+
+	return head == NULL;
+}
+
+void swa_post_queue_run(struct swa_post_queue* queue,
+		struct swa_display* dpy) {
+	// fast path, don't write the cache line when there is nothing to do
+	if(!load_head(queue)) {
+		return;
+	}
+
+	struct swa_posted* it = exchange_head(queue, NULL);
+
+	// reverse: the stack holds the last submitted closure first
+	struct swa_posted* first = NULL;
+	while(it) {
+		struct swa_posted* next = it->next;
+		it->next = first;
+		first = it;
+		it = next;
+	}
+
+	while(first) {
+		struct swa_posted* next = first->next;
+		first->handler(dpy, first->data);
+		free(first);
+		first = next;
+	}
+}
+
+void swa_post_queue_finish(struct swa_post_queue* queue) {
+	struct swa_posted* it = exchange_head(queue, NULL);
+	unsigned count = 0u;
+	while(it) {
+		struct swa_posted* next = it->next;
+		free(it);
+		it = next;
+		++count;
+	}
+
+	if(count) {
+		dlg_debug("Dropped %u posted closures on display destruction", count);
+	}
+}
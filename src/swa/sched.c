@@ -0,0 +1,74 @@
+#include <swa/private/sched.h>
+#include <swa/private/clock.h>
+#include <dlg/dlg.h>
+
+void swa_draw_sched_finish(struct swa_draw_sched* sched) {
+	swa_timer_destroy(sched->timer);
+	sched->timer = NULL;
+}
+
+void swa_draw_sched_presented(struct swa_draw_sched* sched,
+		const struct swa_present_event* ev) {
+	if(ev->time_ns) {
+		sched->last_present = ev->time_ns;
+	}
+	if(ev->refresh_ns) {
+		sched->refresh = ev->refresh_ns;
+	}
+}
+
+void swa_draw_sched_begin(struct swa_draw_sched* sched) {
+	sched->draw_start = swa_monotonic_ns();
+}
+
+void swa_draw_sched_end(struct swa_draw_sched* sched) {
+	if(!sched->draw_start) {
+		return;
+	}
+
+	int64_t duration = swa_monotonic_ns() - sched->draw_start;
+	sched->draw_start = 0;
+
+	// decay slowly so that single fast frames don't shrink the
+	// budget but a permanently cheaper workload eventually does
+	int64_t decayed = sched->peak - sched->peak / 16;
+	sched->peak = duration > decayed ? duration : decayed;
+}
+
+bool swa_draw_sched_defer(struct swa_draw_sched* sched,
+		struct swa_timer_queue* queue, swa_timer_handler handler,
+		void* data) {
+	if(!sched->enabled || !sched->last_present ||
+			!sched->refresh || !sched->peak) {
+		return false;
+	}
+
+	// predict the next vblank. We might not have received the feedback
+	// for the last frame yet, so just skip over already passed vblanks
+	int64_t now = swa_monotonic_ns();
+	int64_t vblank = sched->last_present + sched->refresh;
+	if(vblank <= now) {
+		int64_t missed = (now - vblank) / sched->refresh + 1;
+		vblank += missed * sched->refresh;
+	}
+
+	int64_t deadline = vblank - sched->peak - sched->margin;
+	if(deadline <= now) {
+		return false;
+	}
+
+	if(!sched->timer) {
+		sched->timer = swa_timer_create(queue, deadline, handler, data);
+	} else {
+		dlg_assert(sched->timer->queue == queue);
+		sched->timer->handler = handler;
+		sched->timer->userdata = data;
+		swa_timer_set_deadline(sched->timer, deadline);
+	}
+
+	return true;
+}
+
+bool swa_draw_sched_pending(struct swa_draw_sched* sched) {
+	return sched->timer && sched->timer->deadline >= 0;
+}
@@ -289,15 +289,51 @@ enum swa_image_format swa_image_format_toggle_byte_word(enum swa_image_format fm
 // diplay api
 void swa_display_destroy(struct swa_display* dpy) {
 	if(dpy) {
+		swa_post_queue_finish(&dpy->posted);
 		dpy->impl->destroy(dpy);
 	}
 }
 bool swa_display_dispatch(struct swa_display* dpy, bool block) {
-	return dpy->impl->dispatch(dpy, block);
+	bool ret = dpy->impl->dispatch(dpy, block);
+	swa_post_queue_run(&dpy->posted, dpy);
+	return ret;
+}
+bool swa_display_dispatch_timeout(struct swa_display* dpy, int64_t timeout_ns) {
+	bool ret = dpy->impl->dispatch_timeout(dpy, timeout_ns);
+	swa_post_queue_run(&dpy->posted, dpy);
+	return ret;
 }
 void swa_display_wakeup(struct swa_display* dpy) {
 	dpy->impl->wakeup(dpy);
 }
+bool swa_display_post(struct swa_display* dpy, swa_post_handler handler,
+		void* data) {
+	dlg_assert(handler);
+	struct swa_posted* posted = malloc(sizeof(*posted));
+	if(!posted) {
+		return false;
+	}
+
+	posted->handler = handler;
+	posted->data = data;
+
+	// only the first closure after the display thread emptied the
+	// queue has to wake it up, following ones will be run with it.
+	if(swa_post_queue_push(&dpy->posted, posted)) {
+		dpy->impl->wakeup(dpy);
+	}
+
+	return true;
+}
+void swa_display_set_flush_policy(struct swa_display* dpy,
+		enum swa_flush_policy policy) {
+	dpy->flush_policy = policy;
+}
+void swa_display_flush(struct swa_display* dpy) {
+	if(dpy->impl->flush) {
+		dpy->impl->flush(dpy);
+	}
+}
 enum swa_display_cap swa_display_capabilities(struct swa_display* dpy) {
 	return dpy->impl->capabilities(dpy);
 }
@@ -344,6 +380,14 @@ struct swa_window* swa_display_create_window(struct swa_display* dpy,
 		const struct swa_window_settings* settings) {
 	return dpy->impl->create_window(dpy, settings);
 }
+struct swa_timer* swa_display_add_timer(struct swa_display* dpy,
+		int64_t deadline, swa_timer_handler handler, void* userdata) {
+	if(!dpy->impl->add_timer) {
+		dlg_warn("swa_display_add_timer: display doesn't support timers");
+		return NULL;
+	}
+	return dpy->impl->add_timer(dpy, deadline, handler, userdata);
+}
 
 // window api
 void swa_window_destroy(struct swa_window* win) {
@@ -395,6 +439,12 @@ void swa_window_lock_pointer(struct swa_window* win, bool locked) {
 		win->impl->lock_pointer(win, locked);
 	}
 }
+void swa_window_set_draw_scheduling(struct swa_window* win, bool enable,
+		uint64_t margin) {
+	if(win->impl->set_draw_scheduling) {
+		win->impl->set_draw_scheduling(win, enable, margin);
+	}
+}
 bool swa_window_is_client_decorated(struct swa_window* win) {
 	return win->impl->is_client_decorated(win);
 }
@@ -419,6 +469,14 @@ void swa_window_apply_buffer(struct swa_window* win) {
 const struct swa_window_listener* swa_window_get_listener(struct swa_window* win) {
 	return win->listener;
 }
+void swa_window_set_listener(struct swa_window* win,
+		const struct swa_window_listener* listener) {
+	dlg_assert(listener);
+	win->listener = listener;
+	if(win->impl->update_listener) {
+		win->impl->update_listener(win);
+	}
+}
 void swa_window_set_userdata(struct swa_window* win, void* data) {
 	win->userdata = data;
 }
@@ -439,10 +497,68 @@ bool swa_data_offer_formats(struct swa_data_offer* offer,
 		swa_formats_handler cb) {
 	return offer->impl->formats(offer, cb);
 }
+static struct swa_exchange_data copy_exchange_data(
+		const struct swa_exchange_data* src) {
+	struct swa_exchange_data ret = {0};
+	char* data = malloc(src->size ? src->size : 1);
+	if(data) {
+		if(src->size) memcpy(data, src->data, src->size);
+		ret.data = data;
+		ret.size = src->size;
+	}
+	return ret;
+}
+// Stores the received data in the offer's cache before passing
+// it on to the application.
+static void cache_data_handler(struct swa_data_offer* offer,
+		const char* format, struct swa_exchange_data data) {
+	swa_data_handler cb = offer->cache.pending;
+	offer->cache.pending = NULL;
+	if(data.data && offer->cache.enabled) {
+		swa_offer_cache_insert(&offer->cache, format, data);
+	}
+	cb(offer, format, data);
+}
 bool swa_data_offer_data(struct swa_data_offer* offer,
 		const char* format, swa_data_handler cb) {
+	if(offer->cache.enabled) {
+		const struct swa_exchange_data* cached =
+			swa_offer_cache_find(&offer->cache, format);
+		if(cached) {
+			cb(offer, format, copy_exchange_data(cached));
+			return true;
+		}
+
+		offer->cache.pending = cb;
+		cb = cache_data_handler;
+	}
 	return offer->impl->data(offer, format, cb);
 }
+void swa_data_offer_set_cache(struct swa_data_offer* offer, bool enable) {
+	if(!enable) {
+		swa_data_handler pending = offer->cache.pending;
+		swa_offer_cache_finish(&offer->cache);
+		offer->cache.pending = pending;
+	}
+	offer->cache.enabled = enable;
+}
+bool swa_data_offer_data_stream(struct swa_data_offer* offer,
+		const char* format, swa_data_stream_handler cb) {
+	const struct swa_exchange_data* cached =
+		swa_offer_cache_find(&offer->cache, format);
+	if(cached) {
+		cb(offer, format, *cached, swa_data_stream_chunk);
+		struct swa_exchange_data end = {0};
+		cb(offer, format, end, swa_data_stream_done);
+		return true;
+	}
+
+	if(!offer->impl->data_stream) {
+		dlg_warn("swa_data_offer_data_stream: backend doesn't support streaming");
+		return false;
+	}
+	return offer->impl->data_stream(offer, format, cb);
+}
 void swa_data_offer_set_preferred(struct swa_data_offer* offer,
 		const char* format, enum swa_data_action action) {
 	offer->impl->set_preferred(offer, format, action);
@@ -0,0 +1,127 @@
+#include <swa/private/timer.h>
+#include <dlg/dlg.h>
+#include <stdlib.h>
+
+static void update(struct swa_timer_queue* queue) {
+	if(queue->update) {
+		queue->update(queue);
+	}
+}
+
+struct swa_timer* swa_timer_create(struct swa_timer_queue* queue,
+		int64_t deadline, swa_timer_handler handler, void* userdata) {
+	dlg_assert(handler);
+
+	struct swa_timer* timer = calloc(1, sizeof(*timer));
+	timer->queue = queue;
+	timer->deadline = deadline;
+	timer->handler = handler;
+	timer->userdata = userdata;
+	timer->fired = queue->generation - 1;
+
+	timer->next = queue->first;
+	if(queue->first) {
+		queue->first->prev = timer;
+	}
+	queue->first = timer;
+
+	update(queue);
+	return timer;
+}
+
+int64_t swa_timer_queue_next(struct swa_timer_queue* queue) {
+	// Timers are allowed to fire up to 'slack' after their deadline.
+	// Waking up at the earliest (deadline + slack) and then dispatching
+	// all timers that have expired until then coalesces timers with
+	// nearby deadlines into a single wakeup.
+	int64_t next = -1;
+	for(struct swa_timer* t = queue->first; t; t = t->next) {
+		if(t->deadline < 0) {
+			continue;
+		}
+
+		int64_t wakeup = t->deadline + t->slack;
+		if(next < 0 || wakeup < next) {
+			next = wakeup;
+		}
+	}
+
+	return next;
+}
+
+void swa_timer_queue_dispatch(struct swa_timer_queue* queue, int64_t now) {
+	unsigned gen = ++queue->generation;
+
+	// Handlers may destroy or re-arm any timer, so we have to restart
+	// the search after each dispatched timer. The number of timers
+	// is expected to be small.
+	struct swa_timer* t = queue->first;
+	while(t) {
+		if(t->deadline < 0 || t->deadline > now || t->fired == gen) {
+			t = t->next;
+			continue;
+		}
+
+		t->deadline = -1;
+		t->fired = gen;
+		t->handler(t);
+		t = queue->first;
+	}
+
+	update(queue);
+}
+
+void swa_timer_queue_finish(struct swa_timer_queue* queue) {
+	struct swa_timer* t = queue->first;
+	while(t) {
+		struct swa_timer* next = t->next;
+		free(t);
+		t = next;
+	}
+
+	queue->first = NULL;
+}
+
+// public api
+void swa_timer_set_deadline(struct swa_timer* timer, int64_t deadline) {
+	timer->deadline = deadline;
+	update(timer->queue);
+}
+
+void swa_timer_set_slack(struct swa_timer* timer, int64_t slack) {
+	dlg_assert(slack >= 0);
+	timer->slack = slack;
+	update(timer->queue);
+}
+
+int64_t swa_timer_get_deadline(struct swa_timer* timer) {
+	return timer->deadline;
+}
+
+void swa_timer_set_userdata(struct swa_timer* timer, void* data) {
+	timer->userdata = data;
+}
+
+void* swa_timer_get_userdata(struct swa_timer* timer) {
+	return timer->userdata;
+}
+
+void swa_timer_destroy(struct swa_timer* timer) {
+	if(!timer) {
+		return;
+	}
+
+	struct swa_timer_queue* queue = timer->queue;
+	if(timer->prev) {
+		timer->prev->next = timer->next;
+	} else {
+		queue->first = timer->next;
+	}
+
+	if(timer->next) {
+		timer->next->prev = timer->prev;
+	}
+
+	free(timer);
+	update(queue);
+}
@@ -1,7 +1,9 @@
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // splice
 
 #include <swa/config.h>
 #include <swa/private/wayland.h>
+#include <swa/private/clock.h>
 #include <swa/wayland.h>
 #include <dlg/dlg.h>
 #include <pml.h>
@@ -14,6 +16,7 @@
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "pointer-constraints-unstable-v1-client-protocol.h"
 #include "relative-pointer-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -21,7 +24,11 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <poll.h>
+#include <signal.h>
+#include <pthread.h>
 #include <linux/input-event-codes.h>
 
 #ifdef SWA_WITH_VK
@@ -40,6 +47,10 @@
 
 #define SWA_DECORATION_MODE_PENDING 0xFFFFFFFFu
 
+// When the compositor doesn't send a frame callback for this long, we
+// assume that it throttles the window because it isn't visible.
+static const int64_t frame_stall_timeout = 1000 * 1000 * 1000; // 1s
+
 static const struct swa_display_interface display_impl;
 static const struct swa_window_interface window_impl;
 static const struct swa_data_offer_interface data_offer_impl;
@@ -49,6 +60,7 @@ static const struct xdg_surface_listener xdg_surface_listener;
 static const struct zwlr_layer_surface_v1_listener wlr_layer_surface_listener;
 static const struct zxdg_toplevel_decoration_v1_listener decoration_listener;
 static const struct wl_callback_listener cursor_frame_listener;
+static const struct wl_touch_listener touch_listener;
 
 static char* last_wl_log = NULL;
 
@@ -207,7 +219,27 @@ static bool add_fd_flags(int fd, int add_flags) {
 	return true;
 }
 
-static bool swa_pipe(int fds[static 2]) {
+// Like add_fd_flags but for file status flags such as O_NONBLOCK.
+static bool add_fl_flags(int fd, int add_flags) {
+	long flags = fcntl(fd, F_GETFL);
+	if(flags == -1) {
+		dlg_error("fcntl (get): %s (%d)", strerror(errno), errno);
+		return false;
+	}
+
+	if(fcntl(fd, F_SETFL, flags | add_flags) == -1) {
+		dlg_error("fcntl (set): %s (%d)", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+// The read end is always non-blocking. The write end only when
+// `nonblock_write` is set: O_NONBLOCK is a property of the shared open
+// file description, so it must not be set on ends passed to other
+// clients (e.g. for data offers) that might expect blocking writes.
+static bool swa_pipe(int fds[static 2], bool nonblock_write) {
 	// NOTE: on linux we could use pipe2 here, not as racy
 	int err = pipe(fds);
 	if(err < 0) {
@@ -215,8 +247,9 @@ static bool swa_pipe(int fds[static 2]) {
 		return false;
 	}
 
-	int flags = O_NONBLOCK | FD_CLOEXEC;
-	if(!add_fd_flags(fds[0], flags) || !add_fd_flags(fds[0], flags)) {
+	if(!add_fd_flags(fds[0], FD_CLOEXEC) || !add_fd_flags(fds[1], FD_CLOEXEC) ||
+			!add_fl_flags(fds[0], O_NONBLOCK) ||
+			(nonblock_write && !add_fl_flags(fds[1], O_NONBLOCK))) {
 		close(fds[0]);
 		close(fds[1]);
 		return false;
@@ -324,6 +357,76 @@ static void buffer_finish(struct swa_wl_buffer* buf) {
 	memset(buf, 0, sizeof(*buf));
 }
 
+static void destroy_cursor(struct swa_cursor_cache* cache,
+		struct swa_cursor_cache_entry* entry) {
+	struct swa_wl_buffer* buf = entry->data;
+	buffer_finish(buf);
+	free(buf);
+}
+
+static struct swa_cursor_cache_entry* get_image_cursor(
+		struct swa_display_wl* dpy, const struct swa_cursor* cursor) {
+	static const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
+	static const enum swa_image_format swa_fmt = swa_image_format_bgra32;
+
+	struct swa_cursor_key key;
+	swa_cursor_key_init(&key, cursor);
+	struct swa_cursor_cache_entry* entry =
+		swa_cursor_cache_find(&dpy->cursor.cache, &key);
+	if(entry) {
+		return entry;
+	}
+
+	struct swa_wl_buffer* buf = calloc(1, sizeof(*buf));
+	if(!buffer_init(buf, dpy->shm, cursor->image.width,
+			cursor->image.height, wl_fmt)) {
+		free(buf);
+		return NULL;
+	}
+
+	struct swa_image dst = {
+		.width = buf->width,
+		.height = buf->height,
+		.stride = 4 * buf->width,
+		.format = swa_fmt,
+		.data = buf->data,
+	};
+	swa_convert_image(&cursor->image, &dst);
+
+	entry = swa_cursor_cache_insert(&dpy->cursor.cache, &key, buf->size);
+	entry->data = buf;
+	entry->hx = cursor->hx;
+	entry->hy = cursor->hy;
+	return entry;
+}
+
+// Loading the cursor theme is expensive (it loads all cursor images
+// of the theme) so we only do it once a cursor is needed.
+static struct wl_cursor_theme* get_cursor_theme(struct swa_display_wl* dpy) {
+	if(dpy->cursor.theme || !dpy->shm) {
+		return dpy->cursor.theme;
+	}
+
+	const char* theme = getenv("XCURSOR_THEME");
+	const char* size_str = getenv("XCURSOR_SIZE");
+	unsigned size = 32u;
+	if(size_str) {
+		long s = strtol(size_str, NULL, 10);
+		if(s <= 0) {
+			dlg_warn("Invalid XCURSOR_SIZE: %s", size_str);
+		} else {
+			size = s;
+		}
+	}
+
+	// if XCURSOR_THEME is not set, we pass in null, which will result
+	// in the default cursor theme being used.
+	int64_t timing = swa_monotonic_ns();
+	dpy->cursor.theme = wl_cursor_theme_load(theme, size, dpy->shm);
+	swa_log_elapsed(&timing, "wayland: loading cursor theme");
+	return dpy->cursor.theme;
+}
+
 static void cursor_render(struct swa_display_wl* dpy) {
 	dlg_assert(dpy->cursor.timer);
 	dlg_assert(dpy->cursor.active);
@@ -413,9 +516,12 @@ static void set_cursor(struct swa_display_wl* dpy, struct swa_window_wl* win) {
 			pml_timer_set_time(dpy->cursor.timer, next);
 		}
 	} else {
-		buffer = win->cursor.buffer.buffer;
-		hx = win->cursor.hx;
-		hy = win->cursor.hy;
+		struct swa_cursor_cache_entry* image = win->cursor.image;
+		if(image) {
+			buffer = ((struct swa_wl_buffer*) image->data)->buffer;
+			hx = image->hx;
+			hy = image->hy;
+		}
 	}
 
 	wl_pointer_set_cursor(dpy->pointer, dpy->mouse_enter_serial,
@@ -426,7 +532,62 @@ static void set_cursor(struct swa_display_wl* dpy, struct swa_window_wl* win) {
 }
 
 
+// We only get the wl_touch object while there is at least one window
+// interested in touch events, otherwise the compositor would wake
+// us up for touch events we ignore anyways.
+static void update_touch(struct swa_display_wl* dpy) {
+	bool need = dpy->n_touch_windows &&
+		(dpy->seat_caps & WL_SEAT_CAPABILITY_TOUCH);
+	if(need && !dpy->touch) {
+		dpy->touch = wl_seat_get_touch(dpy->seat);
+		wl_touch_add_listener(dpy->touch, &touch_listener, dpy);
+	} else if(!need && dpy->touch) {
+		wl_touch_destroy(dpy->touch);
+		dpy->touch = NULL;
+		dpy->n_touch_points = 0u;
+	}
+}
+
+static void win_update_touch(struct swa_window_wl* win) {
+	const struct swa_window_listener* l = win->base.listener;
+	bool touch = l->touch_begin || l->touch_update ||
+		l->touch_end || l->touch_cancel;
+	if(touch == win->touch_listener) {
+		return;
+	}
+
+	win->touch_listener = touch;
+	if(touch) {
+		++win->dpy->n_touch_windows;
+	} else {
+		dlg_assert(win->dpy->n_touch_windows > 0);
+		--win->dpy->n_touch_windows;
+	}
+
+	update_touch(win->dpy);
+}
+
+// Flushes the display after requests were issued if the flush
+// policy requires it.
+static void request_flush(struct swa_display_wl* dpy) {
+	if(dpy->base.flush_policy == swa_flush_policy_immediate) {
+		wl_display_flush(dpy->display);
+	}
+}
+
 // window api
+static void feedback_destroy(struct swa_wl_feedback* fb) {
+	struct swa_wl_feedback** it = &fb->win->feedbacks;
+	while(*it != fb) {
+		dlg_assert(*it);
+		it = &(*it)->next;
+	}
+
+	*it = fb->next;
+	wp_presentation_feedback_destroy(fb->feedback);
+	free(fb);
+}
+
 static void win_destroy(struct swa_window* base) {
 	struct swa_window_wl* win = get_window_wl(base);
 
@@ -449,6 +610,13 @@ static void win_destroy(struct swa_window* base) {
 		}
 
 		win->dpy->n_touch_points = out;
+		swa_cursor_cache_set(&win->dpy->cursor.cache, &win->cursor.image, NULL);
+
+		if(win->touch_listener) {
+			dlg_assert(win->dpy->n_touch_windows > 0);
+			--win->dpy->n_touch_windows;
+			update_touch(win->dpy);
+		}
 	}
 
 	// destroy surface buffer
@@ -492,6 +660,13 @@ static void win_destroy(struct swa_window* base) {
 #endif
 	}
 
+	while(win->feedbacks) {
+		feedback_destroy(win->feedbacks);
+	}
+
+	swa_draw_sched_finish(&win->sched);
+	if(win->frame_timer) swa_timer_destroy(win->frame_timer);
+
 	if(win->defer_redraw) pml_defer_destroy(win->defer_redraw);
 	if(win->frame_callback) wl_callback_destroy(win->frame_callback);
 	if(win->decoration) zxdg_toplevel_decoration_v1_destroy(win->decoration);
@@ -524,7 +699,7 @@ static enum swa_window_cap win_get_capabilities(struct swa_window* base) {
 				swa_window_cap_begin_resize;
 		}
 	}
-	if(win->dpy->cursor.theme) {
+	if(win->dpy->cursor.surface) {
 		caps |= swa_window_cap_cursor;
 	}
 	if(win->dpy->pointer_constraints && win->dpy->relative_pointer) {
@@ -541,6 +716,7 @@ static void win_set_min_size(struct swa_window* base, unsigned w, unsigned h) {
 	}
 
 	xdg_toplevel_set_min_size(win->xdg_toplevel, w, h);
+	request_flush(win->dpy);
 }
 
 static void win_set_max_size(struct swa_window* base, unsigned w, unsigned h) {
@@ -551,6 +727,7 @@ static void win_set_max_size(struct swa_window* base, unsigned w, unsigned h) {
 	}
 
 	xdg_toplevel_set_max_size(win->xdg_toplevel, w, h);
+	request_flush(win->dpy);
 }
 
 static void win_show(struct swa_window* base, bool show) {
@@ -617,34 +794,19 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 		type = swa_cursor_left_pointer;
 	}
 
+	struct swa_cursor_cache* cache = &win->dpy->cursor.cache;
 	if(type == swa_cursor_none) {
-		buffer_finish(&win->cursor.buffer);
-		win->cursor.hx = win->cursor.hy = 0;
+		swa_cursor_cache_set(cache, &win->cursor.image, NULL);
 		win->cursor.native = NULL;
 	} else if(type == swa_cursor_image) {
-		static const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
-		static const enum swa_image_format swa_fmt = swa_image_format_bgra32;
-
-		win->cursor.hx = cursor.hx;
-		win->cursor.hy = cursor.hy;
-		if(!win->cursor.buffer.data ||
-				win->cursor.buffer.width != cursor.image.width ||
-				win->cursor.buffer.height != cursor.image.height) {
-			buffer_finish(&win->cursor.buffer);
-			if(!buffer_init(&win->cursor.buffer, win->dpy->shm,
-					cursor.image.width, cursor.image.height, wl_fmt)) {
-				return;
-			}
+		struct swa_cursor_cache_entry* entry =
+			get_image_cursor(win->dpy, &cursor);
+		if(!entry) {
+			return;
 		}
 
-		struct swa_image dst = {
-			.width = win->cursor.buffer.width,
-			.height = win->cursor.buffer.height,
-			.stride = 4 * win->cursor.buffer.width,
-			.format = swa_fmt,
-			.data = win->cursor.buffer.data,
-		};
-		swa_convert_image(&cursor.image, &dst);
+		swa_cursor_cache_set(cache, &win->cursor.image, entry);
+		win->cursor.native = NULL;
 	} else {
 		const char* const* names = swa_get_xcursor_names(type);
 		if(!names) {
@@ -652,9 +814,15 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 			return;
 		}
 
+		struct wl_cursor_theme* theme = get_cursor_theme(win->dpy);
+		if(!theme) {
+			dlg_warn("failed to load cursor theme");
+			return;
+		}
+
 		struct wl_cursor* cursor = NULL;
 		for(; *names; ++names) {
-			cursor = wl_cursor_theme_get_cursor(win->dpy->cursor.theme, *names);
+			cursor = wl_cursor_theme_get_cursor(theme, *names);
 			if(cursor) {
 				break;
 			} else {
@@ -667,13 +835,28 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 			return;
 		}
 
+		// theme cursors are owned (and shared) by the theme
 		win->cursor.native = cursor;
-		buffer_finish(&win->cursor.buffer);
+		swa_cursor_cache_set(cache, &win->cursor.image, NULL);
 	}
 
 	// update cursor if mouse is currently over window
 	if(win->dpy->mouse_over == win) {
 		set_cursor(win->dpy, win);
+		request_flush(win->dpy);
+	}
+}
+
+static void emit_draw(struct swa_window_wl* win) {
+	// will be drawn when it becomes visible again, see update_visibility
+	if(!win->visible) {
+		win->redraw = true;
+		return;
+	}
+
+	if(win->base.listener->draw && win->show) {
+		swa_draw_sched_begin(&win->sched);
+		win->base.listener->draw(&win->base);
 	}
 }
 
@@ -685,18 +868,26 @@ static void refresh_cb(struct pml_defer* defer) {
 	// it to potentially enable it again (e.g. when calling
 	// refresh without previous frame callback)
 	pml_defer_enable(defer, false);
-	if(win->base.listener->draw && win->show) {
-		win->base.listener->draw(&win->base);
-	}
+	emit_draw(win);
+}
+
+static void sched_draw_cb(struct swa_timer* timer) {
+	emit_draw(swa_timer_get_userdata(timer));
 }
 
 static void win_refresh(struct swa_window* base) {
 	struct swa_window_wl* win = get_window_wl(base);
-	if((win->xdg_surface && !win->configured) || win->frame_callback || !win->show) {
+	if((win->xdg_surface && !win->configured) || win->frame_callback ||
+			!win->show || !win->visible) {
 		win->redraw = true;
 		return;
 	}
 
+	// the draw event was already scheduled
+	if(swa_draw_sched_pending(&win->sched)) {
+		return;
+	}
+
 	if(!win->defer_redraw) {
 		win->defer_redraw = pml_defer_new(win->dpy->pml, refresh_cb);
 		pml_defer_set_data(win->defer_redraw, win);
@@ -704,16 +895,51 @@ static void win_refresh(struct swa_window* base) {
 	pml_defer_enable(win->defer_redraw, true);
 }
 
+static void update_visibility(struct swa_window_wl* win) {
+	bool visible = !win->suspended && !win->frame_stalled;
+	if(visible == win->visible) {
+		return;
+	}
+
+	win->visible = visible;
+	if(visible && win->redraw && !win->frame_callback) {
+		win->redraw = false;
+		win_refresh(&win->base);
+	}
+
+	if(win->base.listener->visibility) {
+		win->base.listener->visibility(&win->base, visible);
+	}
+}
+
+static void frame_stall_cb(struct swa_timer* timer) {
+	struct swa_window_wl* win = swa_timer_get_userdata(timer);
+	win->frame_stalled = true;
+	update_visibility(win);
+}
+
 static void win_frame_done(void* data, struct wl_callback* cb, uint32_t id) {
 	struct swa_window_wl* win = data;
 	dlg_assert(win->frame_callback == cb);
 	wl_callback_destroy(win->frame_callback);
 	win->frame_callback = NULL;
 
+	if(win->frame_timer) {
+		swa_timer_set_deadline(win->frame_timer, -1);
+	}
+
+	if(win->frame_stalled) {
+		// redraws if needed
+		win->frame_stalled = false;
+		update_visibility(win);
+		return;
+	}
+
 	if(win->redraw) {
 		win->redraw = false;
-		if(win->base.listener->draw && win->show) {
-			win->base.listener->draw(&win->base);
+		if(!swa_draw_sched_defer(&win->sched, &win->dpy->timers,
+				sched_draw_cb, win)) {
+			emit_draw(win);
 		}
 	}
 }
@@ -722,8 +948,59 @@ static const struct wl_callback_listener win_frame_listener = {
 	.done = win_frame_done,
 };
 
+static void feedback_sync_output(void* data,
+		struct wp_presentation_feedback* feedback, struct wl_output* output) {
+	// no-op
+}
+
+static void feedback_presented(void* data,
+		struct wp_presentation_feedback* feedback, uint32_t tv_sec_hi,
+		uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh,
+		uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+	struct swa_wl_feedback* fb = data;
+	struct swa_window_wl* win = fb->win;
+	struct swa_display_wl* dpy = win->dpy;
+
+	struct timespec ts = {
+		.tv_sec = ((uint64_t) tv_sec_hi << 32) | tv_sec_lo,
+		.tv_nsec = tv_nsec,
+	};
+	int64_t time = swa_timespec_to_ns(&ts);
+
+	// translate into CLOCK_MONOTONIC if the compositor uses another clock
+	if(dpy->presentation_clock != CLOCK_MONOTONIC) {
+		struct timespec now;
+		clock_gettime(dpy->presentation_clock, &now);
+		time += swa_monotonic_ns() - swa_timespec_to_ns(&now);
+	}
+
+	struct swa_present_event ev = {
+		.time_ns = time,
+		.refresh_ns = refresh,
+		.seq = ((uint64_t) seq_hi << 32) | seq_lo,
+	};
+
+	feedback_destroy(fb);
+	swa_draw_sched_presented(&win->sched, &ev);
+	if(win->base.listener->presented) {
+		win->base.listener->presented(&win->base, &ev);
+	}
+}
+
+static void feedback_discarded(void* data,
+		struct wp_presentation_feedback* feedback) {
+	feedback_destroy(data);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	.sync_output = feedback_sync_output,
+	.presented = feedback_presented,
+	.discarded = feedback_discarded,
+};
+
 static void win_surface_frame(struct swa_window* base) {
 	struct swa_window_wl* win = get_window_wl(base);
+	swa_draw_sched_end(&win->sched);
 	if(win->frame_callback) {
 		wl_callback_destroy(win->frame_callback);
 		win->frame_callback = NULL;
@@ -731,6 +1008,32 @@ static void win_surface_frame(struct swa_window* base) {
 
 	win->frame_callback = wl_surface_frame(win->wl_surface);
 	wl_callback_add_listener(win->frame_callback, &win_frame_listener, win);
+
+	if(!win->frame_stalled) {
+		int64_t deadline = swa_monotonic_ns() + frame_stall_timeout;
+		if(!win->frame_timer) {
+			win->frame_timer = swa_timer_create(&win->dpy->timers, deadline,
+				frame_stall_cb, win);
+			// no need to be exact, allow coalescing wakeups
+			swa_timer_set_slack(win->frame_timer, frame_stall_timeout / 4);
+		} else {
+			swa_timer_set_deadline(win->frame_timer, deadline);
+		}
+	}
+
+	// presentation feedback applies to the next commit as well
+	if(win->dpy->presentation &&
+			(win->base.listener->presented || win->sched.enabled)) {
+		struct swa_wl_feedback* fb = calloc(1, sizeof(*fb));
+		fb->win = win;
+		fb->feedback = wp_presentation_feedback(win->dpy->presentation,
+			win->wl_surface);
+		wp_presentation_feedback_add_listener(fb->feedback,
+			&feedback_listener, fb);
+
+		fb->next = win->feedbacks;
+		win->feedbacks = fb;
+	}
 }
 
 static void win_set_state(struct swa_window* base, enum swa_window_state state) {
@@ -762,6 +1065,8 @@ static void win_set_state(struct swa_window* base, enum swa_window_state state)
 			dlg_warn("Invalid window state %d", state);
 			break;
 	}
+
+	request_flush(win->dpy);
 }
 
 static void win_begin_move(struct swa_window* base) {
@@ -777,6 +1082,7 @@ static void win_begin_move(struct swa_window* base) {
 	}
 
 	xdg_toplevel_move(win->xdg_toplevel, win->dpy->seat, win->dpy->last_serial);
+	request_flush(win->dpy);
 }
 static void win_begin_resize(struct swa_window* base, enum swa_edge edges) {
 	struct swa_window_wl* win = get_window_wl(base);
@@ -794,6 +1100,7 @@ static void win_begin_resize(struct swa_window* base, enum swa_edge edges) {
 	enum xdg_toplevel_resize_edge wl_edges = (enum xdg_toplevel_resize_edge) edges;
 	xdg_toplevel_resize(win->xdg_toplevel, win->dpy->seat,
 		win->dpy->last_serial, wl_edges);
+	request_flush(win->dpy);
 }
 static void win_set_title(struct swa_window* base, const char* title) {
 	struct swa_window_wl* win = get_window_wl(base);
@@ -803,6 +1110,7 @@ static void win_set_title(struct swa_window* base, const char* title) {
 	}
 
 	xdg_toplevel_set_title(win->xdg_toplevel, title);
+	request_flush(win->dpy);
 }
 
 static void win_set_icon(struct swa_window* base, const struct swa_image* img) {
@@ -966,10 +1274,23 @@ static void win_apply_buffer(struct swa_window* base) {
 	wl_surface_damage(win->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
 	win_surface_frame(&win->base);
 	wl_surface_commit(win->wl_surface);
+	request_flush(win->dpy);
 
 	win->buffer.active = -1;
 }
 
+static void win_update_listener(struct swa_window* base) {
+	struct swa_window_wl* win = get_window_wl(base);
+	win_update_touch(win);
+}
+
+static void win_set_draw_scheduling(struct swa_window* base, bool enable,
+		uint64_t margin) {
+	struct swa_window_wl* win = get_window_wl(base);
+	win->sched.enabled = enable;
+	win->sched.margin = margin;
+}
+
 static void* win_native_handle(struct swa_window* base) {
 	struct swa_window_wl* win = get_window_wl(base);
 	return win->wl_surface;
@@ -1049,6 +1370,8 @@ static const struct swa_window_interface window_impl = {
 	.get_buffer = win_get_buffer,
 	.apply_buffer = win_apply_buffer,
 	.lock_pointer = win_lock_pointer,
+	.set_draw_scheduling = win_set_draw_scheduling,
+	.update_listener = win_update_listener,
 	.native_handle = win_native_handle,
 };
 
@@ -1110,6 +1433,18 @@ static const struct wl_data_offer_listener data_offer_listener = {
 	.action = data_offer_action
 };
 
+// Read size used when FIONREAD doesn't report anything useful.
+// The pipe buffer is 64KiB by default on linux.
+static const unsigned data_read_size = 64 * 1024;
+
+static void data_offer_reset_data(struct swa_data_offer_wl* offer) {
+	if(offer->data.io) pml_io_destroy(offer->data.io);
+	if(offer->data.fd) close(offer->data.fd);
+	free(offer->data.bytes);
+	free((void*) offer->data.format);
+	memset(&offer->data, 0, sizeof(offer->data));
+}
+
 static void data_offer_destroy(struct swa_data_offer* base) {
 	struct swa_data_offer_wl* offer = get_data_offer_wl(base);
 
@@ -1122,15 +1457,18 @@ static void data_offer_destroy(struct swa_data_offer* base) {
 
 	// TODO: finish dnd source if succesful
 
-	if(offer->data.handler) {
+	if(offer->data.handler || offer->data.stream) {
 		dlg_assert(offer->data.format);
 		struct swa_exchange_data data = {0};
-		offer->data.handler(&offer->base, offer->data.format, data);
+		if(offer->data.stream) {
+			offer->data.stream(&offer->base, offer->data.format, data,
+				swa_data_stream_error);
+		} else {
+			offer->data.handler(&offer->base, offer->data.format, data);
+		}
 	}
-	if(offer->data.format) free((void*)offer->data.format);
-	if(offer->data.bytes) free(offer->data.bytes);
-	if(offer->data.fd) close(offer->data.fd);
-	if(offer->data.io) pml_io_destroy(offer->data.io);
+	data_offer_reset_data(offer);
+	swa_offer_cache_finish(&offer->base.cache);
 
 	if(offer->offer) wl_data_offer_destroy(offer->offer);
 	for(unsigned i = 0u; i < offer->n_formats; ++i) {
@@ -1146,83 +1484,109 @@ static bool data_offer_formats(struct swa_data_offer* base, swa_formats_handler
 	return true;
 }
 
+// Ends the current data transfer and notifies the application.
+// The handler is allowed to destroy the offer, so all transfer state
+// is reset before calling it. On success, ownership of the
+// accumulated data is transferred to the application.
+static void data_transfer_finish(struct swa_data_offer_wl* offer,
+		bool success) {
+	swa_data_handler handler = offer->data.handler;
+	swa_data_stream_handler stream = offer->data.stream;
+	const char* format = offer->data.format;
+	struct swa_exchange_data data = {0};
+	if(success && handler) {
+		data.data = offer->data.bytes;
+		data.size = offer->data.n_bytes;
+		offer->data.bytes = NULL;
+	}
+
+	offer->data.format = NULL;
+	data_offer_reset_data(offer);
+
+	if(stream) {
+		enum swa_data_stream_status status = success ?
+			swa_data_stream_done : swa_data_stream_error;
+		stream(&offer->base, format, data, status);
+	} else {
+		handler(&offer->base, format, data);
+	}
+
+	free((void*) format);
+}
+
 static void data_pipe_cb(struct pml_io* io, unsigned revents) {
 	(void) revents;
 
 	struct swa_data_offer_wl* offer = pml_io_get_data(io);
-	dlg_assert(offer->data.fd == pml_io_get_fd(io));
+	int fd = offer->data.fd;
+	dlg_assert(fd == pml_io_get_fd(io));
 
-	// TODO: could use ioctl FIONREAD on most unixes for efficient
-	//   buffer sizing
-	// TODO: i guess we should be prepared for this offer to be destroyed
-	//   by the callback. kinda hard to handle though
-	unsigned readCount = 2048u;
 	while(true) {
-		unsigned size = offer->data.n_bytes;
-		offer->data.bytes = realloc(offer->data.bytes, size + readCount);
-		int ret = read(offer->data.fd, offer->data.bytes + size, readCount);
-		size += readCount;
+		// query how much data is currently buffered in the pipe so it
+		// can be read in one go. Returns 0 if the other side already
+		// closed the pipe or just didn't write anything yet.
+		int avail = 0;
+		if(ioctl(fd, FIONREAD, &avail) < 0 || avail <= 0) {
+			avail = data_read_size;
+		}
 
+		// when streaming, bytes is just a scratch buffer that gets
+		// reused for every chunk. Otherwise grow it geometrically so
+		// large transfers aren't copied over and over again.
+		uint64_t offset = offer->data.stream ? 0u : offer->data.n_bytes;
+		uint64_t needed = offset + avail;
+		if(needed > offer->data.cap) {
+			uint64_t cap = offer->data.cap * 2;
+			cap = cap > needed ? cap : needed;
+			char* bytes = realloc(offer->data.bytes, cap);
+			if(!bytes) {
+				dlg_error("failed to allocate data offer buffer");
+				data_transfer_finish(offer, false);
+				return;
+			}
+
+			offer->data.bytes = bytes;
+			offer->data.cap = cap;
+		}
+
+		ssize_t ret = read(fd, offer->data.bytes + offset, avail);
 		if(ret == 0) {
 			// other side closed, reading is finished
-			// transfer ownership of the data to the application
-			struct swa_exchange_data data = {
-				.data = offer->data.bytes,
-				.size = offer->data.n_bytes,
-			};
-			offer->data.handler(&offer->base, offer->data.format, data);
-
-			// unset handler data
-			pml_io_destroy(offer->data.io);
-			close(offer->data.fd);
-			free((void*) offer->data.format);
-			memset(&offer->data, 0, sizeof(offer->data));
+			data_transfer_finish(offer, true);
+			return;
 		} else if(ret < 0) {
 			// EINTR: interrupted by signal, just try again
-			// EAGAIN: no data available at the moment, continue polling,
-			// i.e. break below. Other errors here are unexpected,
-			// we cancel the data transfer
+			// EAGAIN: no data available at the moment, continue polling.
+			// Other errors here are unexpected, we cancel the transfer
 			if(errno == EINTR) {
 				continue;
 			} else if(errno != EAGAIN) {
 				dlg_warn("read(pipe): %s (%d)", strerror(errno), errno);
+				data_transfer_finish(offer, false);
+			}
 
-				struct swa_exchange_data data = {0};
-				offer->data.handler(&offer->base, offer->data.format, data);
+			return;
+		}
 
-				// unset handler data
-				pml_io_destroy(offer->data.io);
-				close(offer->data.fd);
-				free(offer->data.bytes);
-				free((void*) offer->data.format);
-				memset(&offer->data, 0, sizeof(offer->data));
-			}
-		} else if((unsigned) ret < readCount) {
-			// we finished reading avilable data
-			// try again to see whether we get eof or EAGAIN now
-			offer->data.n_bytes = size + ret;
-			continue;
-		} else if((unsigned) ret == readCount) {
-			// more data might be avilable, continue
-			// let read size grow exponentially for performance
-			readCount *= 2;
-			continue;
+		if(offer->data.stream) {
+			struct swa_exchange_data chunk = {
+				.data = offer->data.bytes,
+				.size = ret,
+			};
+			offer->data.stream(&offer->base, offer->data.format, chunk,
+				swa_data_stream_chunk);
 		} else {
-			dlg_error("unreachable: ret = %d; readCount = %d",
-				ret, readCount);
+			offer->data.n_bytes += ret;
 		}
-
-		break;
 	}
 }
 
-static bool data_offer_data(struct swa_data_offer* base, const char* format,
-		swa_data_handler cb) {
-	struct swa_data_offer_wl* offer = get_data_offer_wl(base);
-	dlg_assert(!offer->data.handler);
+static bool data_offer_receive(struct swa_data_offer_wl* offer,
+		const char* format) {
+	dlg_assert(!offer->data.handler && !offer->data.stream);
 
 	int fds[2];
-	if(!swa_pipe(fds)) {
+	if(!swa_pipe(fds, false)) {
 		return false;
 	}
 
@@ -1231,7 +1595,6 @@ static bool data_offer_data(struct swa_data_offer* base, const char* format,
 
 	offer->data.n_bytes = 0;
 	offer->data.fd = fds[0];
-	offer->data.handler = cb;
 	offer->data.format = strdup(format);
 	offer->data.io = pml_io_new(offer->dpy->pml, fds[0],
 		POLLIN, data_pipe_cb);
@@ -1239,6 +1602,29 @@ static bool data_offer_data(struct swa_data_offer* base, const char* format,
 
 	return true;
 }
+
+static bool data_offer_data(struct swa_data_offer* base, const char* format,
+		swa_data_handler cb) {
+	struct swa_data_offer_wl* offer = get_data_offer_wl(base);
+	if(!data_offer_receive(offer, format)) {
+		return false;
+	}
+
+	offer->data.handler = cb;
+	return true;
+}
+
+static bool data_offer_data_stream(struct swa_data_offer* base,
+		const char* format, swa_data_stream_handler cb) {
+	struct swa_data_offer_wl* offer = get_data_offer_wl(base);
+	if(!data_offer_receive(offer, format)) {
+		return false;
+	}
+
+	offer->data.stream = cb;
+	return true;
+}
+
 static void data_offer_set_preferred(struct swa_data_offer* base,
 		const char* format, enum swa_data_action action) {
 	struct swa_data_offer_wl* offer = get_data_offer_wl(base);
@@ -1278,6 +1664,7 @@ static const struct swa_data_offer_interface data_offer_impl = {
 	.destroy = data_offer_destroy,
 	.formats = data_offer_formats,
 	.data = data_offer_data,
+	.data_stream = data_offer_data_stream,
 	.set_preferred = data_offer_set_preferred,
 	.action = data_offer_get_action,
 	.supported_actions = data_offer_supported_actions
@@ -1355,6 +1742,275 @@ static const struct wl_data_device_listener data_dev_listener = {
 	.selection = data_dev_selection,
 };
 
+// Selection and dnd offers are only relevant once we have a window
+// (they are bound to keyboard/pointer focus) so the data device
+// is created with the first window.
+static void init_data_dev(struct swa_display_wl* dpy) {
+	if(dpy->data_dev || !dpy->data_dev_manager || !dpy->seat) {
+		return;
+	}
+
+	dpy->data_dev = wl_data_device_manager_get_data_device(
+		dpy->data_dev_manager, dpy->seat);
+	wl_data_device_add_listener(dpy->data_dev, &data_dev_listener, dpy);
+}
+
+// data source
+// The maximum number of bytes written for a transfer at once, matches
+// the default pipe buffer size on linux.
+static const unsigned data_write_size = 64 * 1024;
+
+static void data_source_destroy(struct swa_data_source_wl* source) {
+	dlg_assert(!source->transfers);
+	if(source->next) source->next->prev = source->prev;
+	if(source->prev) source->prev->next = source->next;
+	if(source->dpy->data_source_list == source) {
+		source->dpy->data_source_list = source->next;
+	}
+
+	if(source->wl_source) wl_data_source_destroy(source->wl_source);
+	source->source->impl->destroy(source->source);
+	free(source);
+}
+
+static void data_transfer_destroy(struct swa_data_transfer_wl* transfer) {
+	struct swa_data_source_wl* source = transfer->source;
+	if(transfer->next) transfer->next->prev = transfer->prev;
+	if(transfer->prev) transfer->prev->next = transfer->next;
+	if(source->transfers == transfer) {
+		source->transfers = transfer->next;
+	}
+
+	if(transfer->io) pml_io_destroy(transfer->io);
+	if(transfer->src_fd >= 0) close(transfer->src_fd);
+	close(transfer->fd);
+	free(transfer);
+
+	// the source was only kept alive for its pending transfers
+	if(!source->wl_source && !source->transfers) {
+		data_source_destroy(source);
+	}
+}
+
+static ssize_t data_transfer_write_raw(struct swa_data_transfer_wl* transfer) {
+	if(transfer->src_fd < 0) {
+		uint64_t left = transfer->data.size - transfer->offset;
+		if(left == 0) {
+			return 0;
+		}
+
+		size_t size = left < data_write_size ? left : data_write_size;
+		return write(transfer->fd, transfer->data.data + transfer->offset, size);
+	}
+
+	// splice needs one side to be a pipe. That is true for basically
+	// all receivers but fall back to sendfile otherwise.
+	if(!transfer->sendfile) {
+		ssize_t ret = splice(transfer->src_fd, NULL, transfer->fd, NULL,
+			data_write_size, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+		if(ret >= 0 || errno != EINVAL) {
+			return ret;
+		}
+
+		transfer->sendfile = true;
+	}
+
+	return sendfile(transfer->fd, transfer->src_fd, NULL, data_write_size);
+}
+
+// Writes the next part of the transfer. Returns the number of
+// bytes written, 0 when there is nothing left to write or -1 on error.
+// Writing to a pipe whose read end was closed raises SIGPIPE, which
+// terminates the process by default. We don't want to require
+// applications to ignore it, so it is blocked during the write and
+// consumed if we raised it. The write then fails with EPIPE.
+static ssize_t data_transfer_write(struct swa_data_transfer_wl* transfer) {
+	sigset_t sigpipe, old;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, &old);
+
+	// if it was already pending, it wasn't raised by us
+	sigset_t pending;
+	sigpending(&pending);
+	bool was_pending = sigismember(&pending, SIGPIPE);
+
+	ssize_t ret = data_transfer_write_raw(transfer);
+	int err = errno;
+	if(ret < 0 && err == EPIPE && !was_pending) {
+		struct timespec zero = {0};
+		int res;
+		do {
+			res = sigtimedwait(&sigpipe, NULL, &zero);
+		} while(res == -1 && errno == EINTR);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	errno = err;
+	return ret;
+}
+
+static void data_transfer_cb(struct pml_io* io, unsigned revents) {
+	struct swa_data_transfer_wl* transfer = pml_io_get_data(io);
+	dlg_assert(transfer->fd == pml_io_get_fd(io));
+
+	if(revents & (POLLERR | POLLHUP)) {
+		// the receiver closed its side before reading everything
+		dlg_debug("data transfer cancelled by receiver");
+		data_transfer_destroy(transfer);
+		return;
+	}
+
+	// write as long as the receiver takes data. Once its pipe is
+	// full we get EAGAIN and wait for the next POLLOUT.
+	while(true) {
+		ssize_t ret = data_transfer_write(transfer);
+		if(ret == 0) {
+			// everything was written, closing the fd signals eof
+			data_transfer_destroy(transfer);
+			return;
+		} else if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			} else if(errno == EPIPE) {
+				dlg_debug("data transfer cancelled by receiver");
+				data_transfer_destroy(transfer);
+			} else if(errno != EAGAIN) {
+				dlg_warn("data transfer: %s (%d)", strerror(errno), errno);
+				data_transfer_destroy(transfer);
+			}
+
+			return;
+		}
+
+		transfer->offset += ret;
+	}
+}
+
+static void data_source_target(void* data, struct wl_data_source* wl_source,
+		const char* mime_type) {
+	// no swa equivalent, we just send what is requested
+}
+
+static void data_source_send(void* data, struct wl_data_source* wl_source,
+		const char* mime_type, int32_t fd) {
+	struct swa_data_source_wl* source = data;
+	dlg_assert(source->wl_source == wl_source);
+
+	// never block on the receiver, a slow (or malicious) client
+	// would otherwise stall our event loop
+	if(!add_fl_flags(fd, O_NONBLOCK)) {
+		close(fd);
+		return;
+	}
+
+	struct swa_data_transfer_wl* transfer = calloc(1, sizeof(*transfer));
+	transfer->source = source;
+	transfer->fd = fd;
+	transfer->src_fd = -1;
+
+	const struct swa_data_source_interface* impl = source->source->impl;
+	if(impl->data_fd) {
+		transfer->src_fd = impl->data_fd(source->source, mime_type);
+	}
+	if(transfer->src_fd < 0) {
+		transfer->data = impl->data(source->source, mime_type);
+	}
+
+	transfer->next = source->transfers;
+	if(source->transfers) source->transfers->prev = transfer;
+	source->transfers = transfer;
+
+	transfer->io = pml_io_new(source->dpy->pml, fd, POLLOUT, data_transfer_cb);
+	pml_io_set_data(transfer->io, transfer);
+}
+
+// Called when the source isn't needed anymore, i.e. another
+// selection was set or the dnd session ended.
+static void data_source_finished(struct swa_data_source_wl* source) {
+	wl_data_source_destroy(source->wl_source);
+	source->wl_source = NULL;
+	if(!source->transfers) {
+		data_source_destroy(source);
+	}
+}
+
+static void data_source_cancelled(void* data, struct wl_data_source* wl_source) {
+	struct swa_data_source_wl* source = data;
+	dlg_assert(source->wl_source == wl_source);
+	data_source_finished(source);
+}
+
+static void data_source_dnd_drop_performed(void* data,
+		struct wl_data_source* wl_source) {
+	// nothing to do, we will get dnd_finished or cancelled
+}
+
+static void data_source_dnd_finished(void* data,
+		struct wl_data_source* wl_source) {
+	struct swa_data_source_wl* source = data;
+	dlg_assert(source->wl_source == wl_source);
+	data_source_finished(source);
+}
+
+static void data_source_action(void* data, struct wl_data_source* wl_source,
+		uint32_t dnd_action) {
+	struct swa_data_source_wl* source = data;
+	dlg_assert(source->wl_source == wl_source);
+
+	const struct swa_data_source_interface* impl = source->source->impl;
+	if(!impl->selected_action) {
+		return;
+	}
+
+	enum swa_data_action action = swa_data_action_none;
+	if(dnd_action == WL_DATA_DEVICE_MANAGER_DND_ACTION_COPY) {
+		action = swa_data_action_copy;
+	} else if(dnd_action == WL_DATA_DEVICE_MANAGER_DND_ACTION_MOVE) {
+		action = swa_data_action_move;
+	}
+
+	impl->selected_action(source->source, action);
+}
+
+static const struct wl_data_source_listener data_source_listener = {
+	.target = data_source_target,
+	.send = data_source_send,
+	.cancelled = data_source_cancelled,
+	.dnd_drop_performed = data_source_dnd_drop_performed,
+	.dnd_finished = data_source_dnd_finished,
+	.action = data_source_action,
+};
+
+static struct swa_data_source_wl* data_source_create(
+		struct swa_display_wl* dpy, struct swa_data_source* source) {
+	init_data_dev(dpy);
+	if(!dpy->data_dev) {
+		dlg_warn("compositor has no data device manager");
+		source->impl->destroy(source);
+		return NULL;
+	}
+
+	struct swa_data_source_wl* wrapper = calloc(1, sizeof(*wrapper));
+	wrapper->dpy = dpy;
+	wrapper->source = source;
+	wrapper->wl_source = wl_data_device_manager_create_data_source(
+		dpy->data_dev_manager);
+	wl_data_source_add_listener(wrapper->wl_source,
+		&data_source_listener, wrapper);
+
+	unsigned n_formats = 0u;
+	const char** formats = source->impl->formats(source, &n_formats);
+	for(unsigned i = 0u; i < n_formats; ++i) {
+		wl_data_source_offer(wrapper->wl_source, formats[i]);
+	}
+
+	wrapper->next = dpy->data_source_list;
+	if(dpy->data_source_list) dpy->data_source_list->prev = wrapper;
+	dpy->data_source_list = wrapper;
+	return wrapper;
+}
+
 static void display_destroy(struct swa_display* base) {
 	struct swa_display_wl* dpy = get_display_wl(base);
 	dlg_assert(!dpy->focus);
@@ -1366,6 +2022,17 @@ static void display_destroy(struct swa_display* base) {
 		data_offer_destroy(&d->base);
 		d = next;
 	}
+	while(dpy->data_source_list) {
+		struct swa_data_source_wl* source = dpy->data_source_list;
+		while(source->transfers) {
+			// will destroy the source with its last transfer if it
+			// was already cancelled
+			data_transfer_destroy(source->transfers);
+		}
+		if(dpy->data_source_list == source) {
+			data_source_destroy(source);
+		}
+	}
 
 #ifdef SWA_WITH_GL
 	if(dpy->egl) swa_egl_display_destroy(dpy->egl);
@@ -1377,8 +2044,12 @@ static void display_destroy(struct swa_display* base) {
 	if(dpy->touch_points) free(dpy->touch_points);
 	if(dpy->key_repeat.timer) pml_timer_destroy(dpy->key_repeat.timer);
 	if(dpy->cursor.timer) pml_timer_destroy(dpy->cursor.timer);
+	if(dpy->dispatch_timer) pml_timer_destroy(dpy->dispatch_timer);
+	if(dpy->timers_source) pml_timer_destroy(dpy->timers_source);
+	swa_timer_queue_finish(&dpy->timers);
 	if(dpy->cursor.frame_callback) wl_callback_destroy(dpy->cursor.frame_callback);
 	if(dpy->cursor.theme) wl_cursor_theme_destroy(dpy->cursor.theme);
+	swa_cursor_cache_finish(&dpy->cursor.cache);
 	if(dpy->cursor.surface) wl_surface_destroy(dpy->cursor.surface);
 	if(dpy->data_dev) wl_data_device_destroy(dpy->data_dev);
 	if(dpy->shm) wl_shm_destroy(dpy->shm);
@@ -1396,6 +2067,7 @@ static void display_destroy(struct swa_display* base) {
 	if(dpy->xdg_exporter) zxdg_exporter_v2_destroy(dpy->xdg_exporter);
 	if(dpy->pointer_constraints) zwp_pointer_constraints_v1_destroy(dpy->pointer_constraints);
 	if(dpy->relative_pointer_manager) zwp_relative_pointer_manager_v1_destroy(dpy->relative_pointer_manager);
+	if(dpy->presentation) wp_presentation_destroy(dpy->presentation);
 	if(dpy->registry) wl_registry_destroy(dpy->registry);
 	if(dpy->wl_queue) wl_event_queue_destroy(dpy->wl_queue);
 	if(dpy->display) wl_display_disconnect(dpy->display);
@@ -1416,7 +2088,13 @@ static bool print_error(struct swa_display_wl* dpy, const char* fn) {
 	return true;
 }
 
-static bool display_dispatch(struct swa_display* base, bool block) {
+static void dispatch_timeout_cb(struct pml_timer* timer) {
+	// no-op, only used to wake up pml_iterate in display_dispatch_timeout
+	(void) timer;
+}
+
+static bool display_dispatch_timeout(struct swa_display* base,
+		int64_t timeout_ns) {
 	struct swa_display_wl* dpy = get_display_wl(base);
 
 	// dispatch all buffered events. Those won't be detected by POLL
@@ -1428,14 +2106,51 @@ static bool display_dispatch(struct swa_display* base, bool block) {
 		return print_error(dpy, "wl_display_dispatch_pending");
 	}
 
-	if(wl_display_flush(dpy->display) == -1) {
+	// with the explicit flush policy we only flush when we
+	// might have to wait for events below
+	if(dpy->base.flush_policy != swa_flush_policy_explicit || timeout_ns != 0) {
+		if(wl_display_flush(dpy->display) == -1) {
+			return print_error(dpy, "wl_display_flush");
+		}
+	}
+
+	if(timeout_ns > 0) {
+		if(!dpy->dispatch_timer) {
+			dpy->dispatch_timer = pml_timer_new(dpy->pml, NULL,
+				dispatch_timeout_cb);
+			pml_timer_set_clock(dpy->dispatch_timer, CLOCK_MONOTONIC);
+		}
+
+		int64_t deadline = swa_monotonic_ns() + timeout_ns;
+		pml_timer_set_time(dpy->dispatch_timer,
+			swa_timespec_from_ns(deadline));
+		pml_iterate(dpy->pml, true);
+		pml_timer_disable(dpy->dispatch_timer);
+	} else {
+		pml_iterate(dpy->pml, timeout_ns < 0);
+	}
+
+	// send requests issued by the event handlers (e.g. frame commits)
+	// right away instead of only at the beginning of the next dispatch
+	if(dpy->base.flush_policy != swa_flush_policy_explicit &&
+			wl_display_flush(dpy->display) == -1) {
 		return print_error(dpy, "wl_display_flush");
 	}
 
-	pml_iterate(dpy->pml, block);
 	return !dpy->error;
 }
 
+static void display_flush(struct swa_display* base) {
+	struct swa_display_wl* dpy = get_display_wl(base);
+	if(wl_display_flush(dpy->display) == -1) {
+		print_error(dpy, "wl_display_flush");
+	}
+}
+
+static bool display_dispatch(struct swa_display* base, bool block) {
+	return display_dispatch_timeout(base, block ? -1 : 0);
+}
+
 static void display_wakeup(struct swa_display* base) {
 	struct swa_display_wl* dpy = get_display_wl(base);
 	int err = write(dpy->wakeup_pipe_w, " ", 1);
@@ -1456,13 +2171,17 @@ static enum swa_display_cap display_capabilities(struct swa_display* base) {
 #ifdef SWA_WITH_VK
 		swa_display_cap_vk |
 #endif
-		swa_display_cap_client_decoration;
+		swa_display_cap_client_decoration |
+		swa_display_cap_timers;
 	if(dpy->shm) caps |= swa_display_cap_buffer_surface;
 	if(dpy->keyboard) caps |= swa_display_cap_keyboard;
 	if(dpy->pointer) caps |= swa_display_cap_mouse;
-	if(dpy->touch) caps |= swa_display_cap_touch;
+	if(dpy->seat_caps & WL_SEAT_CAPABILITY_TOUCH) caps |= swa_display_cap_touch;
 	// TODO: implement dnd
-	if(dpy->data_dev) caps |= /*swa_display_cap_dnd |*/ swa_display_cap_clipboard;
+	// the data device itself is created lazily, see init_data_dev
+	if(dpy->data_dev_manager && dpy->seat) {
+		caps |= /*swa_display_cap_dnd |*/ swa_display_cap_clipboard;
+	}
 	// NOTE: we don't know this for sure. But it's at least worth
 	// a shot in this case. And the final result should always be determined
 	// using win_is_client_decorated anyways
@@ -1578,16 +2297,55 @@ static struct swa_data_offer* display_get_clipboard(struct swa_display* base) {
 	return &dpy->selection->base;
 }
 
-// TODO
 static bool display_set_clipboard(struct swa_display* base,
 		struct swa_data_source* source) {
-	// struct swa_display_wl* dpy = get_display_wl(base);
-	return false;
+	struct swa_display_wl* dpy = get_display_wl(base);
+	struct swa_data_source_wl* wrapper = data_source_create(dpy, source);
+	if(!wrapper) {
+		return false;
+	}
+
+	// the previous selection source will receive the cancelled event
+	wl_data_device_set_selection(dpy->data_dev, wrapper->wl_source,
+		dpy->last_serial);
+	return true;
 }
+
 static bool display_start_dnd(struct swa_display* base,
 		struct swa_data_source* source) {
-	// struct swa_display_wl* dpy = get_display_wl(base);
-	return false;
+	struct swa_display_wl* dpy = get_display_wl(base);
+	if(!dpy->mouse_over) {
+		dlg_warn("can't start dnd without a window under the pointer");
+		source->impl->destroy(source);
+		return false;
+	}
+
+	struct swa_data_source_wl* wrapper = data_source_create(dpy, source);
+	if(!wrapper) {
+		return false;
+	}
+
+	if(wl_data_source_get_version(wrapper->wl_source) >=
+			WL_DATA_SOURCE_SET_ACTIONS_SINCE_VERSION) {
+		enum swa_data_action actions = swa_data_action_copy;
+		if(source->impl->supported_actions) {
+			actions = source->impl->supported_actions(source);
+		}
+
+		uint32_t wl_actions = WL_DATA_DEVICE_MANAGER_DND_ACTION_NONE;
+		if(actions & swa_data_action_copy) {
+			wl_actions |= WL_DATA_DEVICE_MANAGER_DND_ACTION_COPY;
+		}
+		if(actions & swa_data_action_move) {
+			wl_actions |= WL_DATA_DEVICE_MANAGER_DND_ACTION_MOVE;
+		}
+		wl_data_source_set_actions(wrapper->wl_source, wl_actions);
+	}
+
+	// TODO: use source->impl->image as drag icon
+	wl_data_device_start_drag(dpy->data_dev, wrapper->wl_source,
+		dpy->mouse_over->wl_surface, NULL, dpy->last_serial);
+	return true;
 }
 
 static swa_proc display_get_gl_proc_addr(struct swa_display* base,
@@ -1600,6 +2358,38 @@ static swa_proc display_get_gl_proc_addr(struct swa_display* base,
 #endif
 }
 
+static void timers_cb(struct pml_timer* timer) {
+	struct swa_display_wl* dpy = pml_timer_get_data(timer);
+	swa_timer_queue_dispatch(&dpy->timers, swa_monotonic_ns());
+}
+
+// Called by the timer queue whenever the next timer deadline might
+// have changed. We only use one pml timer for all swa timers.
+static void timers_update(struct swa_timer_queue* queue) {
+	struct swa_display_wl* dpy = queue->data;
+	int64_t next = swa_timer_queue_next(queue);
+	if(next < 0) {
+		if(dpy->timers_source) {
+			pml_timer_disable(dpy->timers_source);
+		}
+		return;
+	}
+
+	if(!dpy->timers_source) {
+		dpy->timers_source = pml_timer_new(dpy->pml, NULL, timers_cb);
+		pml_timer_set_data(dpy->timers_source, dpy);
+		pml_timer_set_clock(dpy->timers_source, CLOCK_MONOTONIC);
+	}
+
+	pml_timer_set_time(dpy->timers_source, swa_timespec_from_ns(next));
+}
+
+static struct swa_timer* display_add_timer(struct swa_display* base,
+		int64_t deadline, swa_timer_handler handler, void* userdata) {
+	struct swa_display_wl* dpy = get_display_wl(base);
+	return swa_timer_create(&dpy->timers, deadline, handler, userdata);
+}
+
 static void win_handle_deferred(struct pml_defer* defer) {
 	struct swa_window_wl* win = pml_defer_get_data(defer);
 	pml_defer_destroy(defer);
@@ -1614,21 +2404,21 @@ static void win_handle_deferred(struct pml_defer* defer) {
 
 	if(win->defer_events & swa_wl_defer_draw) {
 		win->defer_events &= ~swa_wl_defer_draw;
-		if(win->base.listener->draw && win->show) {
-			win->base.listener->draw(&win->base);
-		}
+		emit_draw(win);
 	}
 }
 
 static struct swa_window* display_create_window(struct swa_display* base,
 		const struct swa_window_settings* settings) {
 	struct swa_display_wl* dpy = get_display_wl(base);
+	init_data_dev(dpy);
 	struct swa_window_wl* win = calloc(1, sizeof(*win));
 	win->base.impl = &window_impl;
 	win->base.listener = settings->listener;
 	win->dpy = dpy;
 	win->width = settings->width;
 	win->height = settings->height;
+	win_update_touch(win);
 
 	win->wl_surface = wl_compositor_create_surface(dpy->compositor);
 	wl_surface_set_user_data(win->wl_surface, win);
@@ -1741,6 +2531,7 @@ static struct swa_window* display_create_window(struct swa_display* base,
 	}
 
 	win->show = !settings->hide;
+	win->visible = true;
 
 	// note how we always set the cursor, even if this is cursor_default
 	// this is needed since when the pointer enters this surface we
@@ -1900,6 +2691,7 @@ err:
 static const struct swa_display_interface display_impl = {
 	.destroy = display_destroy,
 	.dispatch = display_dispatch,
+	.dispatch_timeout = display_dispatch_timeout,
 	.wakeup = display_wakeup,
 	.capabilities = display_capabilities,
 	.vk_extensions = display_vk_extensions,
@@ -1914,7 +2706,9 @@ static const struct swa_display_interface display_impl = {
 	.set_clipboard = display_set_clipboard,
 	.start_dnd = display_start_dnd,
 	.get_gl_proc_addr = display_get_gl_proc_addr,
+	.add_timer = display_add_timer,
 	.create_window = display_create_window,
+	.flush = display_flush,
 };
 
 static void decoration_configure(void *data,
@@ -1985,21 +2779,26 @@ static void toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
 	// we consider the window is fullscreen state.
 	uint32_t* wl_states = (uint32_t*)(states->data);
 	enum swa_window_state state = swa_window_state_normal;
+	bool fullscreen = false;
+	bool suspended = false;
 	for(unsigned i = 0u; i < states->size / sizeof(uint32_t); ++i) {
-		bool finished = false;
 		switch(wl_states[i]) {
 			case XDG_TOPLEVEL_STATE_FULLSCREEN:
-				state = swa_window_state_fullscreen;
-				finished = true;
+				fullscreen = true;
 				break;
 			case XDG_TOPLEVEL_STATE_MAXIMIZED:
 				state = swa_window_state_maximized;
 				break;
+#ifdef XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+			case XDG_TOPLEVEL_STATE_SUSPENDED:
+				suspended = true;
+				break;
+#endif
 		}
+	}
 
-		if(finished) {
-			break;
-		}
+	if(fullscreen) {
+		state = swa_window_state_fullscreen;
 	}
 
 	if(state != win->state) {
@@ -2008,8 +2807,23 @@ static void toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
 			win->base.listener->state(&win->base, state);
 		}
 	}
+
+	win->suspended = suspended;
+	update_visibility(win);
 }
 
+#ifdef XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+static void toplevel_configure_bounds(void* data,
+		struct xdg_toplevel* xdg_toplevel, int32_t width, int32_t height) {
+	// no-op
+}
+
+static void toplevel_wm_capabilities(void* data,
+		struct xdg_toplevel* xdg_toplevel, struct wl_array* caps) {
+	// no-op
+}
+#endif // XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+
 static void toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
 	struct swa_window_wl* win = data;
 	if(win->base.listener->close) {
@@ -2020,6 +2834,10 @@ static void toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
 static const struct xdg_toplevel_listener toplevel_listener = {
 	.configure = toplevel_configure,
 	.close = toplevel_close,
+#ifdef XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+	.configure_bounds = toplevel_configure_bounds,
+	.wm_capabilities = toplevel_wm_capabilities,
+#endif
 };
 
 static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
@@ -2142,6 +2960,7 @@ static void touch_down(void* data, struct wl_touch* wl_touch, uint32_t serial,
 			.id = id,
 			.x = dpy->touch_points[i].x,
 			.y = dpy->touch_points[i].y,
+			.time_usec = swa_event_time_usec(time),
 		};
 		listener->touch_begin(&win->base, &ev);
 	}
@@ -2203,6 +3022,7 @@ static void touch_motion(void* data, struct wl_touch* wl_touch, uint32_t time,
 			.id = id,
 			.x = x,
 			.y = y,
+			.time_usec = swa_event_time_usec(time),
 		};
 		listener->touch_update(&dpy->touch_points[i].window->base, &ev);
 	}
@@ -2355,6 +3175,7 @@ static void pointer_motion(void *data, struct wl_pointer *wl_pointer,
 			.y = y,
 			.dx = x - dpy->mouse_x,
 			.dy = y - dpy->mouse_y,
+			.time_usec = swa_event_time_usec(time),
 		};
 		listener->mouse_move(&dpy->mouse_over->base, &ev);
 	}
@@ -2404,6 +3225,7 @@ static void pointer_button(void* data, struct wl_pointer* wl_pointer,
 			.pressed = state,
 			.x = dpy->mouse_x,
 			.y = dpy->mouse_y,
+			.time_usec = swa_event_time_usec(time),
 		};
 		listener->mouse_button(&dpy->mouse_over->base, &ev);
 	}
@@ -2577,10 +3399,11 @@ static void keyboard_key(void* data, struct wl_keyboard* wl_keyboard,
 		dpy->key_states[idx] &= ~(((uint64_t) 1) << bit);
 	}
 
-	char* utf8 = NULL;
+	char buf[SWA_XKB_TEXT_SIZE];
+	const char* utf8 = NULL;
 	if(pressed) {
 		bool canceled;
-		swa_xkb_key(&dpy->xkb, key + 8, &utf8, &canceled);
+		utf8 = swa_xkb_key(&dpy->xkb, key + 8, buf, &canceled);
 		// TODO: ring the bell when canceled?
 	}
 
@@ -2592,12 +3415,11 @@ static void keyboard_key(void* data, struct wl_keyboard* wl_keyboard,
 			.utf8 = utf8,
 			.repeated = false,
 			.modifiers = swa_xkb_modifiers(&dpy->xkb),
+			.time_usec = swa_event_time_usec(time),
 		};
 		dpy->focus->base.listener->key(&dpy->focus->base, &ev);
 	}
 
-	free(utf8);
-
 	bool repeats = xkb_keymap_key_repeats(dpy->xkb.keymap, key + 8);
 	if(pressed && dpy->key_repeat.timer && repeats) {
 		dpy->key_repeat.key = key;
@@ -2628,12 +3450,13 @@ static void key_repeat_cb(struct pml_timer* timer) {
 	dlg_assert(dpy->keyboard);
 	dlg_assert(dpy->focus);
 
-	char* utf8;
+	char buf[SWA_XKB_TEXT_SIZE];
 	bool canceled;
 
 	// set the serial of the original key press here again
 	dpy->last_serial = dpy->key_repeat.serial;
-	swa_xkb_key(&dpy->xkb, dpy->key_repeat.key + 8, &utf8, &canceled);
+	const char* utf8 = swa_xkb_key(&dpy->xkb, dpy->key_repeat.key + 8,
+		buf, &canceled);
 	if(dpy->focus->base.listener->key) {
 		struct swa_key_event ev = {
 			.keycode = dpy->key_repeat.key,
@@ -2641,9 +3464,10 @@ static void key_repeat_cb(struct pml_timer* timer) {
 			.utf8 = utf8,
 			.repeated = true,
 			.modifiers = swa_xkb_modifiers(&dpy->xkb),
+			// synthesized, there is no better timestamp
+			.time_usec = swa_monotonic_ns() / 1000,
 		};
 		dpy->focus->base.listener->key(&dpy->focus->base, &ev);
-		free(utf8);
 	}
 
 	struct timespec next;
@@ -2683,7 +3507,7 @@ static void seat_caps(void* data, struct wl_seat* seat, uint32_t caps) {
 	if((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !dpy->keyboard) {
 		// We couple xkb initialization to keyboard support so we can
 		// rely on xkb being initialized in all keyboard callbacks
-		if(!swa_xkb_init_default(&dpy->xkb) || !swa_xkb_init_compose(&dpy->xkb)) {
+		if(!swa_xkb_init_default(&dpy->xkb)) {
 			dlg_warn("Failed to initialize xkb. No keyboard support");
 			return;
 		}
@@ -2708,23 +3532,6 @@ static void seat_caps(void* data, struct wl_seat* seat, uint32_t caps) {
 			if(!dpy->cursor.surface) {
 				dpy->cursor.surface = wl_compositor_create_surface(dpy->compositor);
 			}
-			if(!dpy->cursor.theme) {
-				const char* theme = getenv("XCURSOR_THEME");
-				const char* size_str = getenv("XCURSOR_SIZE");
-				unsigned size = 32u;
-				if(size_str) {
-					long s = strtol(size_str, NULL, 10);
-					if(s <= 0) {
-						dlg_warn("Invalid XCURSOR_SIZE: %s", size_str);
-					} else {
-						size = s;
-					}
-				}
-
-				// if XCURSOR_THEME is not set, we pass in null, which will result
-				// in the default cursor theme being used.
-				dpy->cursor.theme = wl_cursor_theme_load(theme, size, dpy->shm);
-			}
 			if(!dpy->cursor.timer) {
 				dpy->cursor.timer = pml_timer_new(dpy->pml, NULL, cursor_time_cb);
 				pml_timer_set_data(dpy->cursor.timer, dpy);
@@ -2737,14 +3544,12 @@ static void seat_caps(void* data, struct wl_seat* seat, uint32_t caps) {
 		dpy->pointer = NULL;
 	}
 
-	if((caps & WL_SEAT_CAPABILITY_TOUCH) && !dpy->touch) {
-		dpy->touch = wl_seat_get_touch(seat);
-		wl_touch_add_listener(dpy->touch, &touch_listener, dpy);
-	} else if(!(caps & WL_SEAT_CAPABILITY_TOUCH) && dpy->touch) {
+	if(!(caps & WL_SEAT_CAPABILITY_TOUCH) && dpy->touch) {
 		dlg_info("lost wl_touch");
-		wl_touch_destroy(dpy->touch);
-		dpy->touch = NULL;
 	}
+
+	dpy->seat_caps = caps;
+	update_touch(dpy);
 }
 
 static void seat_name(void* data, struct wl_seat* seat, const char* name) {
@@ -2760,6 +3565,16 @@ static unsigned min(unsigned a, unsigned b) {
 	return a < b ? a : b;
 }
 
+static void presentation_clock_id(void* data,
+		struct wp_presentation* presentation, uint32_t clk_id) {
+	struct swa_display_wl* dpy = data;
+	dpy->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	.clock_id = presentation_clock_id,
+};
+
 static void handle_global(void *data, struct wl_registry *registry,
 		uint32_t name, const char *interface, uint32_t version) {
 	(void) version;
@@ -2770,7 +3585,11 @@ static void handle_global(void *data, struct wl_registry *registry,
 	static const unsigned v_subcompositor = 1u;
 	static const unsigned v_dd_manager = 3u;
 	static const unsigned v_seat = 6u;
+#ifdef XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+	static const unsigned v_xdg_wm_base = 6u; // suspended state
+#else
 	static const unsigned v_xdg_wm_base = 2u;
+#endif
 
 	if(!dpy->compositor &&
 			strcmp(interface, wl_compositor_interface.name) == 0) {
@@ -2823,6 +3642,12 @@ static void handle_global(void *data, struct wl_registry *registry,
 			strcmp(interface, zwp_relative_pointer_manager_v1_interface.name) == 0) {
 		dpy->relative_pointer_manager = wl_registry_bind(registry, name,
 			&zwp_relative_pointer_manager_v1_interface, 1);
+	} else if(!dpy->presentation &&
+			strcmp(interface, wp_presentation_interface.name) == 0) {
+		dpy->presentation = wl_registry_bind(registry, name,
+			&wp_presentation_interface, 1);
+		wp_presentation_add_listener(dpy->presentation,
+			&presentation_listener, dpy);
 	}
 }
 
@@ -2893,6 +3718,9 @@ static void pointer_relative_motion(void *data,
 
 	int ddx = wl_fixed_to_int(dx);
 	int ddy = wl_fixed_to_int(dy);
+	// already a full 64-bit microsecond timestamp on the same clock
+	// as the other input events, no need to expand it
+	uint64_t utime = ((uint64_t) utime_hi << 32) | utime_lo;
 	const struct swa_window_listener* listener = dpy->mouse_over->base.listener;
 	if(listener && listener->mouse_move) {
 		struct swa_mouse_move_event ev = {
@@ -2900,6 +3728,7 @@ static void pointer_relative_motion(void *data,
 			.y = dpy->mouse_y,
 			.dx = ddx,
 			.dy = ddy,
+			.time_usec = utime,
 		};
 		listener->mouse_move(&dpy->mouse_over->base, &ev);
 	}
@@ -2925,6 +3754,8 @@ struct wl_seat* swa_display_wl_get_seat(struct swa_display* base) {
 }
 
 struct swa_display* swa_display_wl_create(const char* appname) {
+	int64_t start = swa_monotonic_ns();
+	int64_t timing = start;
 	errno = 0;
 	struct wl_display* wld = wl_display_connect(NULL);
 	if(!wld) {
@@ -2933,11 +3764,17 @@ struct swa_display* swa_display_wl_create(const char* appname) {
 	}
 
 	wl_log_set_handler_client(log_handler);
+	swa_log_elapsed(&timing, "wayland startup: connection");
 
 	struct swa_display_wl* dpy = calloc(1, sizeof(*dpy));
 	dpy->base.impl = &display_impl;
 	dpy->display = wld;
+	dpy->cursor.cache.destroy = destroy_cursor;
+	dpy->cursor.cache.data = dpy;
 	dpy->pml = pml_new();
+	dpy->timers.update = timers_update;
+	dpy->timers.data = dpy;
+	dpy->presentation_clock = CLOCK_MONOTONIC;
 	dpy->appname = strdup(appname ? appname : "swa");
 	dpy->io_source = pml_io_new(dpy->pml, wl_display_get_fd(wld),
 		POLLIN, dispatch_display);
@@ -2945,7 +3782,7 @@ struct swa_display* swa_display_wl_create(const char* appname) {
 
 	// create wakeup pipes
 	int fds[2];
-	if(!swa_pipe(fds)) {
+	if(!swa_pipe(fds, true)) {
 		goto error;
 	}
 
@@ -2967,9 +3804,11 @@ struct swa_display* swa_display_wl_create(const char* appname) {
 	// call any application callbacks yet.
 	// 1: all globals are advertised to us and we added listeners
 	wl_display_roundtrip(dpy->display);
+	swa_log_elapsed(&timing, "wayland startup: globals");
 	// 2: all global capabilities were advertised to us and we
 	//    created keyboard/pointer/touch
 	wl_display_roundtrip(dpy->display);
+	swa_log_elapsed(&timing, "wayland startup: seat");
 	// 3: those secondary resources received their initial listener
 	//    information (such as keyboard keymap) as well.
 	//    There is currently no instance where this information is
@@ -2994,12 +3833,9 @@ struct swa_display* swa_display_wl_create(const char* appname) {
 		goto error;
 	}
 
-	if(dpy->data_dev_manager && dpy->seat) {
-		dpy->data_dev = wl_data_device_manager_get_data_device(
-			dpy->data_dev_manager, dpy->seat);
-		wl_data_device_add_listener(dpy->data_dev, &data_dev_listener, dpy);
-	}
-
+	// cursor theme, compose table, data device and egl are all
+	// initialized lazily when they are needed first
+	swa_log_elapsed(&start, "wayland startup: total");
 	return &dpy->base;
 
 error:
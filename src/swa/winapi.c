@@ -1,4 +1,5 @@
 #include <swa/private/winapi.h>
+#include <swa/private/clock.h>
 #include <swa/winapi.h>
 #include <dlg/dlg.h>
 
@@ -791,14 +792,25 @@ static bool dispatch_one(void) {
 	return true;
 }
 
-static bool display_dispatch(struct swa_display* base, bool block) {
+static bool display_dispatch_timeout(struct swa_display* base,
+		int64_t timeout_ns) {
 	struct swa_display_win* dpy = get_display_win(base);
 	if(dpy->error) {
 		return false;
 	}
 
 	// wait for first message if we are allowed to block
-	if(block) {
+	if(timeout_ns > 0) {
+		// never INFINITE, the helper clamps to INT_MAX
+		DWORD wait = (DWORD) swa_timeout_ns_to_ms(timeout_ns);
+		if(!dispatch_one()) {
+			DWORD res = MsgWaitForMultipleObjects(0, NULL, FALSE, wait,
+				QS_ALLINPUT);
+			if(res == WAIT_FAILED) {
+				print_winapi_error("MsgWaitForMultipleObjects");
+			}
+		}
+	} else if(timeout_ns < 0) {
 		MSG msg;
 		int ret = GetMessage(&msg, NULL, 0, 0);
 		if(ret == -1) {
@@ -819,6 +831,10 @@ static bool display_dispatch(struct swa_display* base, bool block) {
 	return true;
 }
 
+static bool display_dispatch(struct swa_display* base, bool block) {
+	return display_dispatch_timeout(base, block ? -1 : 0);
+}
+
 static void display_wakeup(struct swa_display* base) {
 	struct swa_display_win* dpy = get_display_win(base);
 	PostThreadMessage(dpy->main_thread_id, WM_USER, 0, 0);
@@ -946,6 +962,15 @@ static swa_proc display_get_gl_proc_addr(struct swa_display* base, const char* n
 #endif
 }
 
+// Returns the time of the message currently being processed in
+// microseconds. GetMessageTime returns a wrapping 32-bit millisecond
+// value of the GetTickCount clock, we expand it using GetTickCount64.
+static uint64_t message_time_usec(void) {
+	ULONGLONG now = GetTickCount64();
+	DWORD age = (DWORD) now - (DWORD) GetMessageTime();
+	return (uint64_t)(now - age) * 1000;
+}
+
 static void handle_mouse_button(struct swa_window_win* win, bool pressed,
 		enum swa_mouse_button btn, LPARAM lparam) {
 	if(win->base.listener->mouse_button) {
@@ -954,6 +979,7 @@ static void handle_mouse_button(struct swa_window_win* win, bool pressed,
 		ev.button = btn;
 		ev.x = GET_X_LPARAM(lparam);
 		ev.y = GET_Y_LPARAM(lparam);
+		ev.time_usec = message_time_usec();
 		win->base.listener->mouse_button(&win->base, &ev);
 	}
 
@@ -987,6 +1013,7 @@ static void handle_key(struct swa_window_win* win, bool pressed,
 		ev.keycode = swa_winapi_to_key((unsigned)(wparam));
 		ev.repeated = pressed && (lparam & 0x40000000);
 		ev.utf8 = utf8;
+		ev.time_usec = message_time_usec();
 
 		win->base.listener->key(&win->base, &ev);
 	}
@@ -1137,6 +1164,7 @@ static LRESULT CALLBACK win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lpar
 			ev.y = GET_Y_LPARAM(lparam);
 			ev.dx = ev.x - win->dpy->mx;
 			ev.dy = ev.y - win->dpy->my;
+			ev.time_usec = message_time_usec();
 
 			// check for implicit mouse over change
 			// windows does not send any mouse enter events, we have to detect them this way
@@ -1187,6 +1215,7 @@ static LRESULT CALLBACK win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lpar
 			struct swa_mouse_move_event ev = {0};
 			ev.dx = raw->data.mouse.lLastX;
 			ev.dy = raw->data.mouse.lLastY;
+			ev.time_usec = message_time_usec();
 
 			if(win->base.listener->mouse_move) {
 				win->base.listener->mouse_move(&win->base, &ev);
@@ -1400,6 +1429,7 @@ error:
 static const struct swa_display_interface display_impl = {
 	.destroy = display_destroy,
 	.dispatch = display_dispatch,
+	.dispatch_timeout = display_dispatch_timeout,
 	.wakeup = display_wakeup,
 	.capabilities = display_capabilities,
 	.vk_extensions = display_vk_extensions,
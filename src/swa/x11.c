@@ -1,16 +1,24 @@
 #include <swa/private/x11.h>
+#include <swa/private/clock.h>
 #include <swa/x11.h>
 #include <dlg/dlg.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
 #include <X11/Xlib.h>
-#include <X11/Xutil.h>
 #include <X11/Xlib-xcb.h>
-#include <X11/Xcursor/Xcursor.h>
-#include <X11/cursorfont.h>
+
+#ifdef SWA_WITH_XCB_CURSOR
+  #include <xcb/render.h>
+  #include <xcb/xcb_renderutil.h>
+  #include <xcb/xcb_cursor.h>
+#else
+  #include <X11/Xcursor/Xcursor.h>
+#endif
 
 #include <xcb/xcb.h>
 #include <xcb/xcb_icccm.h>
@@ -18,6 +26,7 @@
 #include <xcb/xinput.h>
 #include <xcb/shm.h>
 #include <xcb/xkb.h>
+#include <xcb/xfixes.h>
 
 #include <xkbcommon/xkbcommon-x11.h>
 
@@ -33,6 +42,11 @@
 #ifdef SWA_WITH_GL
   #include <swa/private/egl.h>
   #include <EGL/egl.h>
+
+  // EGL_EXT_platform_xcb, missing in older eglext.h headers
+  #ifndef EGL_PLATFORM_XCB_EXT
+	#define EGL_PLATFORM_XCB_EXT 0x31DC
+  #endif
 #endif
 
 static const struct swa_display_interface display_impl;
@@ -53,14 +67,362 @@ static struct swa_window_x11* get_window_x11(struct swa_window* base) {
 	return (struct swa_window_x11*) base;
 }
 
+// Returns the name of a core protocol error. We don't use XGetErrorText
+// since that requires an xlib display.
+static const char* error_name(uint8_t code) {
+	static const char* const names[] = {
+		[XCB_REQUEST] = "BadRequest",
+		[XCB_VALUE] = "BadValue",
+		[XCB_WINDOW] = "BadWindow",
+		[XCB_PIXMAP] = "BadPixmap",
+		[XCB_ATOM] = "BadAtom",
+		[XCB_CURSOR] = "BadCursor",
+		[XCB_FONT] = "BadFont",
+		[XCB_MATCH] = "BadMatch",
+		[XCB_DRAWABLE] = "BadDrawable",
+		[XCB_ACCESS] = "BadAccess",
+		[XCB_ALLOC] = "BadAlloc",
+		[XCB_COLORMAP] = "BadColor",
+		[XCB_G_CONTEXT] = "BadGC",
+		[XCB_ID_CHOICE] = "BadIDChoice",
+		[XCB_NAME] = "BadName",
+		[XCB_LENGTH] = "BadLength",
+		[XCB_IMPLEMENTATION] = "BadImplementation",
+	};
+
+	if(code < sizeof(names) / sizeof(names[0]) && names[code]) {
+		return names[code];
+	}
+
+	return "extension error";
+}
+
 #define handle_error(dpy, err, txt) do {\
 	dlg_assert(err); \
-	char buf[256]; \
-	XGetErrorText(dpy->display, err->error_code, buf, sizeof(buf)); \
-	dlg_error(txt ": %s (%d)", buf, err->error_code); \
+	dlg_error(txt ": %s (%d)", error_name(err->error_code), err->error_code); \
 	free(err); \
 } while(0)
 
+// Issues the void request 'req' with the given arguments. The request is
+// unchecked, errors are reported asynchronously from dispatch. In sync
+// mode, the checked variant is used and the error is checked immediately.
+// Evaluates to false if the request is known to have failed, i.e. never
+// outside of sync mode.
+#define x11_request(dpy, name, req, ...) ((dpy)->sync_requests ? \
+	check_request((dpy), req##_checked((dpy)->conn, __VA_ARGS__), (name)) : \
+	track_request((dpy), req((dpy)->conn, __VA_ARGS__), (name)))
+
+static bool track_request(struct swa_display_x11* dpy,
+		xcb_void_cookie_t cookie, const char* name) {
+	struct swa_x11_request* r = &dpy->requests[dpy->request_head];
+	r->sequence = cookie.sequence;
+	r->name = name;
+	dpy->request_head = (dpy->request_head + 1) % SWA_X11_TRACKED_REQUESTS;
+	return true;
+}
+
+static bool check_request(struct swa_display_x11* dpy,
+		xcb_void_cookie_t cookie, const char* name) {
+	xcb_generic_error_t* err = xcb_request_check(dpy->conn, cookie);
+	if(err) {
+		dlg_error("%s: %s (%d)", name, error_name(err->error_code),
+			err->error_code);
+		free(err);
+		return false;
+	}
+
+	return true;
+}
+
+// Returns an xlib display for the apis that require one (egl without
+// EGL_EXT_platform_xcb, xlib vulkan surfaces). Unless swa was built
+// without xcb-cursor, we don't use xlib ourselves and open a separate
+// connection on first use. That works since windows are server-side
+// resources. Returns NULL on failure.
+static Display* xlib_display(struct swa_display_x11* dpy) {
+	if(!dpy->display) {
+		XInitThreads();
+		dpy->display = XOpenDisplay(NULL);
+		if(!dpy->display) {
+			dlg_error("XOpenDisplay failed");
+		}
+	}
+
+	return dpy->display;
+}
+
+// Reports an error received as event, i.e. for an unchecked request.
+static void handle_async_error(struct swa_display_x11* dpy,
+		const xcb_generic_error_t* err) {
+	const char* name = NULL;
+	for(unsigned i = 0u; i < SWA_X11_TRACKED_REQUESTS; ++i) {
+		const struct swa_x11_request* r = &dpy->requests[i];
+		if(r->name && r->sequence == err->full_sequence) {
+			name = r->name;
+			break;
+		}
+	}
+
+	const char* ename = error_name(err->error_code);
+	if(name) {
+		dlg_error("%s: %s (%d)", name, ename, err->error_code);
+	} else {
+		dlg_error("request %d.%d (sequence %u): %s (%d)",
+			err->major_code, err->minor_code, err->full_sequence,
+			ename, err->error_code);
+	}
+}
+
+
+// Returns the core event mask for a window with the given listener.
+// We only select the input events the listener is interested in so
+// that e.g. passive windows don't wake us up on every mouse movement.
+// Crossing and focus events are rare and always needed for the
+// internal state (mouse over and keyboard focus). The same goes for
+// visibility and property (for _NET_WM_STATE) changes.
+static uint32_t listener_event_mask(const struct swa_window_listener* l) {
+	uint32_t mask =
+		XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY |
+		XCB_EVENT_MASK_ENTER_WINDOW | XCB_EVENT_MASK_LEAVE_WINDOW |
+		XCB_EVENT_MASK_FOCUS_CHANGE | XCB_EVENT_MASK_VISIBILITY_CHANGE |
+		XCB_EVENT_MASK_PROPERTY_CHANGE;
+	if(l->key) {
+		mask |= XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE;
+	}
+	if(l->mouse_button || l->mouse_wheel) {
+		mask |= XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE;
+	}
+	if(l->mouse_move) {
+		mask |= XCB_EVENT_MASK_POINTER_MOTION;
+	}
+	return mask;
+}
+
+// Selects the xinput events the window listener is interested in.
+// When force is false, will not make a request when no events
+// are needed.
+static void select_xi_events(struct swa_window_x11* win, bool force) {
+	struct {
+		xcb_input_event_mask_t info;
+		xcb_input_xi_event_mask_t events;
+	} mask;
+
+	// NOTE: not sure how to test this but we might want to listen
+	// for TOUCH_OWNERSHIP events. See
+	// https://lwn.net/Articles/475886/
+	// https://lwn.net/Articles/485484/
+	const struct swa_window_listener* l = win->base.listener;
+	mask.info.deviceid = XCB_INPUT_DEVICE_ALL_MASTER; // or ALL?
+	mask.info.mask_len = sizeof(mask.events) / sizeof(uint32_t);
+	mask.events =
+		(l->touch_begin ? XCB_INPUT_XI_EVENT_MASK_TOUCH_BEGIN : 0) |
+		(l->touch_end ? XCB_INPUT_XI_EVENT_MASK_TOUCH_END : 0) |
+		(l->touch_update ? XCB_INPUT_XI_EVENT_MASK_TOUCH_UPDATE : 0);
+	if(mask.events || force) {
+		xcb_input_xi_select_events(win->dpy->conn, win->window, 1, &mask.info);
+	}
+}
+
+// window map
+static unsigned window_hash(xcb_window_t window) {
+	// xcb ids are usually allocated sequentially, mix the bits anyways
+	uint32_t h = window;
+	h = (h ^ (h >> 16)) * 0x45d9f3bu;
+	return h ^ (h >> 16);
+}
+
+// Puts the given window into the first free slot of its probe sequence.
+static void window_map_place(struct swa_window_x11** slots, unsigned mask,
+		struct swa_window_x11* win) {
+	unsigned i = window_hash(win->window) & mask;
+	while(slots[i]) {
+		dlg_assert(slots[i]->window != win->window);
+		i = (i + 1) & mask;
+	}
+
+	slots[i] = win;
+}
+
+static void window_map_insert(struct swa_x11_window_map* map,
+		struct swa_window_x11* win) {
+	// keep the load factor below 1/2
+	if(2 * (map->count + 1) > map->capacity) {
+		unsigned capacity = map->capacity ? 2 * map->capacity : 16u;
+		struct swa_window_x11** slots = calloc(capacity, sizeof(*slots));
+		for(unsigned i = 0u; i < map->capacity; ++i) {
+			if(map->slots[i]) {
+				window_map_place(slots, capacity - 1, map->slots[i]);
+			}
+		}
+
+		free(map->slots);
+		map->slots = slots;
+		map->capacity = capacity;
+	}
+
+	window_map_place(map->slots, map->capacity - 1, win);
+	++map->count;
+}
+
+static struct swa_window_x11* window_map_find(
+		const struct swa_x11_window_map* map, xcb_window_t window) {
+	if(!map->capacity) {
+		return NULL;
+	}
+
+	unsigned mask = map->capacity - 1;
+	unsigned i = window_hash(window) & mask;
+	while(map->slots[i]) {
+		if(map->slots[i]->window == window) {
+			return map->slots[i];
+		}
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static void window_map_remove(struct swa_x11_window_map* map,
+		struct swa_window_x11* win) {
+	if(!map->capacity) {
+		return;
+	}
+
+	unsigned mask = map->capacity - 1;
+	unsigned i = window_hash(win->window) & mask;
+	while(map->slots[i] != win) {
+		if(!map->slots[i]) {
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	// backward shift deletion: move following entries of the probe
+	// sequence into the hole so lookups don't need tombstones
+	map->slots[i] = NULL;
+	--map->count;
+	for(unsigned j = (i + 1) & mask; map->slots[j]; j = (j + 1) & mask) {
+		unsigned k = window_hash(map->slots[j]->window) & mask;
+		// whether k lies cyclically in (i, j]: then the entry can stay
+		bool stay = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+		if(!stay) {
+			map->slots[i] = map->slots[j];
+			map->slots[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+// Returns a colormap for the given visual, shared between all
+// windows using it. Must be released using release_colormap.
+static xcb_colormap_t acquire_colormap(struct swa_display_x11* dpy,
+		xcb_visualid_t visual) {
+	// the root visual already has a colormap
+	if(visual == dpy->screen->root_visual) {
+		return dpy->screen->default_colormap;
+	}
+
+	for(unsigned i = 0u; i < dpy->visuals.n_colormaps; ++i) {
+		struct swa_x11_colormap* cmap = &dpy->visuals.colormaps[i];
+		if(cmap->visual == visual) {
+			++cmap->refs;
+			return cmap->colormap;
+		}
+	}
+
+	unsigned count = dpy->visuals.n_colormaps + 1;
+	struct swa_x11_colormap* cmaps = realloc(dpy->visuals.colormaps,
+		count * sizeof(*cmaps));
+	if(!cmaps) {
+		dlg_error("failed to allocate colormap entry");
+		return XCB_NONE;
+	}
+
+	struct swa_x11_colormap* cmap = &cmaps[count - 1];
+	cmap->visual = visual;
+	cmap->refs = 1u;
+	cmap->colormap = xcb_generate_id(dpy->conn);
+	xcb_create_colormap(dpy->conn, XCB_COLORMAP_ALLOC_NONE, cmap->colormap,
+		dpy->screen->root, visual);
+
+	dpy->visuals.colormaps = cmaps;
+	dpy->visuals.n_colormaps = count;
+	return cmap->colormap;
+}
+
+static void release_colormap(struct swa_display_x11* dpy,
+		xcb_colormap_t colormap) {
+	if(colormap == dpy->screen->default_colormap) {
+		return;
+	}
+
+	for(unsigned i = 0u; i < dpy->visuals.n_colormaps; ++i) {
+		struct swa_x11_colormap* cmap = &dpy->visuals.colormaps[i];
+		if(cmap->colormap != colormap) {
+			continue;
+		}
+
+		if(--cmap->refs == 0u) {
+			xcb_free_colormap(dpy->conn, colormap);
+			*cmap = dpy->visuals.colormaps[--dpy->visuals.n_colormaps];
+		}
+		return;
+	}
+
+	dlg_error("Unknown colormap %u", colormap);
+}
+
+static void defer_draw(struct swa_window_x11* win) {
+	struct swa_display_x11* dpy = win->dpy;
+	if(win->draw_deferred) {
+		return;
+	}
+
+	win->draw_deferred = true;
+	win->next_deferred = NULL;
+	if(dpy->deferred_draws.last) {
+		dpy->deferred_draws.last->next_deferred = win;
+	} else {
+		dpy->deferred_draws.first = win;
+	}
+	dpy->deferred_draws.last = win;
+}
+
+static void undefer_draw(struct swa_window_x11* win) {
+	struct swa_display_x11* dpy = win->dpy;
+	if(!win->draw_deferred) {
+		return;
+	}
+
+	struct swa_window_x11* prev = NULL;
+	struct swa_window_x11* it = dpy->deferred_draws.first;
+	while(it != win) {
+		dlg_assert(it);
+		prev = it;
+		it = it->next_deferred;
+	}
+
+	if(prev) {
+		prev->next_deferred = win->next_deferred;
+	} else {
+		dpy->deferred_draws.first = win->next_deferred;
+	}
+
+	if(dpy->deferred_draws.last == win) {
+		dpy->deferred_draws.last = prev;
+	}
+
+	win->draw_deferred = false;
+	win->next_deferred = NULL;
+}
+
+// Flushes the connection after requests were issued if the flush
+// policy requires it.
+static void request_flush(struct swa_display_x11* dpy) {
+	if(dpy->base.flush_policy == swa_flush_policy_immediate) {
+		xcb_flush(dpy->conn);
+	}
+}
 
 // window api
 static void win_destroy(struct swa_window* base) {
@@ -98,18 +460,21 @@ static void win_destroy(struct swa_window* base) {
 	}
 
 	struct swa_display_x11* dpy = win->dpy;
+	swa_draw_sched_finish(&win->sched);
 	if(win->next) win->next->prev = win->prev;
 	if(win->prev) win->prev->next = win->next;
 	if(win->dpy->window_list == win) {
-		win->dpy->window_list = NULL;
+		win->dpy->window_list = win->next;
 	}
+	window_map_remove(&win->dpy->window_map, win);
+	undefer_draw(win);
 
 	if(win->dpy->keyboard.focus == win) win->dpy->keyboard.focus = NULL;
 	if(win->dpy->mouse.over == win) win->dpy->mouse.over = NULL;
 
 	if(win->window) xcb_destroy_window(dpy->conn, win->window);
-	if(win->cursor) xcb_free_cursor(dpy->conn, win->cursor);
-	if(win->colormap) xcb_free_colormap(dpy->conn, win->colormap);
+	swa_cursor_cache_set(&dpy->cursors, &win->cursor, NULL);
+	if(win->colormap) release_colormap(dpy, win->colormap);
 
 	// Application might not call dispatch after this.
 	// We manually flush the display to make sure the display sees
@@ -139,7 +504,7 @@ static void win_set_min_size(struct swa_window* base, unsigned w, unsigned h) {
 	hints.min_height = h;
 	hints.flags = XCB_ICCCM_SIZE_HINT_P_MIN_SIZE;
 	xcb_icccm_set_wm_normal_hints(win->dpy->conn, win->window, &hints);
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static void win_set_max_size(struct swa_window* base, unsigned w, unsigned h) {
@@ -150,7 +515,7 @@ static void win_set_max_size(struct swa_window* base, unsigned w, unsigned h) {
 	hints.max_height = h;
 	hints.flags = XCB_ICCCM_SIZE_HINT_P_MAX_SIZE;
 	xcb_icccm_set_wm_normal_hints(win->dpy->conn, win->window, &hints);
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static void win_show(struct swa_window* base, bool show) {
@@ -161,7 +526,7 @@ static void win_show(struct swa_window* base, bool show) {
 		xcb_unmap_window(win->dpy->conn, win->window);
 	}
 
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static void win_set_size(struct swa_window* base, unsigned w, unsigned h) {
@@ -169,22 +534,125 @@ static void win_set_size(struct swa_window* base, unsigned w, unsigned h) {
 	uint32_t data[] = {w, h};
 	xcb_configure_window(win->dpy->conn, win->window,
 		XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, data);
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
-struct swa_x11_cursor {
-	enum swa_cursor_type type;
-	xcb_cursor_t cursor;
-};
+static void destroy_cursor(struct swa_cursor_cache* cache,
+		struct swa_cursor_cache_entry* entry) {
+	struct swa_display_x11* dpy = cache->data;
+	xcb_free_cursor(dpy->conn, entry->id);
+}
 
-static xcb_cursor_t get_cursor(struct swa_display_x11* dpy,
-		enum swa_cursor_type type) {
-	for(unsigned i = 0u; i < dpy->n_cursors; ++i) {
-		if(dpy->cursors[i].type == type) {
-			return dpy->cursors[i].cursor;
-		}
+#ifdef SWA_WITH_XCB_CURSOR
+
+static xcb_cursor_t create_image_cursor(struct swa_display_x11* dpy,
+		const struct swa_cursor* cursor) {
+	const struct swa_image* img = &cursor->image;
+	const xcb_render_query_pict_formats_reply_t* formats =
+		xcb_render_util_query_formats(dpy->conn);
+	const xcb_render_pictforminfo_t* argb = formats ?
+		xcb_render_util_find_standard_format(formats, XCB_PICT_STANDARD_ARGB_32) :
+		NULL;
+	if(!argb) {
+		dlg_warn("No render argb32 format, can't create image cursor");
+		return XCB_NONE;
+	}
+
+	// same layout xcursor images use: 32-bit argb words.
+	// We assume that the server uses our byte order
+	unsigned size = 4 * img->width * img->height;
+	uint8_t* data = malloc(size);
+	if(!data) {
+		dlg_error("failed to allocate cursor image");
+		return XCB_NONE;
+	}
+
+	struct swa_image dst = {
+		.width = img->width,
+		.height = img->height,
+		.stride = 4 * img->width,
+		.data = data,
+		.format = swa_image_format_toggle_byte_word(swa_image_format_argb32),
+	};
+	swa_convert_image(img, &dst);
+
+	xcb_pixmap_t pixmap = xcb_generate_id(dpy->conn);
+	xcb_create_pixmap(dpy->conn, 32, pixmap, dpy->screen->root,
+		img->width, img->height);
+
+	xcb_gcontext_t gc = xcb_generate_id(dpy->conn);
+	xcb_create_gc(dpy->conn, gc, pixmap, 0, NULL);
+	xcb_put_image(dpy->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, pixmap, gc,
+		img->width, img->height, 0, 0, 0, 32, size, data);
+	xcb_free_gc(dpy->conn, gc);
+	free(data);
+
+	xcb_render_picture_t picture = xcb_generate_id(dpy->conn);
+	xcb_render_create_picture(dpy->conn, picture, pixmap, argb->id, 0, NULL);
+
+	xcb_cursor_t xcursor = xcb_generate_id(dpy->conn);
+	if(!x11_request(dpy, "xcb_render_create_cursor", xcb_render_create_cursor,
+			xcursor, picture, cursor->hx, cursor->hy)) {
+		xcursor = XCB_NONE;
 	}
 
+	xcb_render_free_picture(dpy->conn, picture);
+	xcb_free_pixmap(dpy->conn, pixmap);
+	return xcursor;
+}
+
+static xcb_cursor_t load_theme_cursor(struct swa_display_x11* dpy,
+		const char* name) {
+	// created on first use since it queries resources and the
+	// render extension, i.e. needs a few roundtrips
+	if(!dpy->cursor_context &&
+			xcb_cursor_context_new(dpy->conn, dpy->screen,
+				&dpy->cursor_context) < 0) {
+		dlg_warn("xcb_cursor_context_new failed");
+		dpy->cursor_context = NULL;
+		return XCB_NONE;
+	}
+
+	return xcb_cursor_load_cursor(dpy->cursor_context, name);
+}
+
+#else // SWA_WITH_XCB_CURSOR
+
+// Fallback when built without xcb-cursor, requires an xlib display.
+static xcb_cursor_t create_image_cursor(struct swa_display_x11* dpy,
+		const struct swa_cursor* cursor) {
+	const struct swa_image* img = &cursor->image;
+	XcursorImage* xcimage = XcursorImageCreate(img->width, img->height);
+	xcimage->xhot = cursor->hx;
+	xcimage->yhot = cursor->hy;
+
+	struct swa_image dst = {
+		.width = img->width,
+		.height = img->height,
+		.stride = 4 * img->width,
+		.data = (uint8_t*) xcimage->pixels,
+		.format = swa_image_format_toggle_byte_word(swa_image_format_argb32),
+	};
+
+	swa_convert_image(img, &dst);
+	xcb_cursor_t xcursor = XcursorImageLoadCursor(dpy->display, xcimage);
+	if(!xcursor) {
+		dlg_warn("XcursorImageLoadCursor failed");
+	}
+
+	XcursorImageDestroy(xcimage);
+	return xcursor;
+}
+
+static xcb_cursor_t load_theme_cursor(struct swa_display_x11* dpy,
+		const char* name) {
+	return XcursorLibraryLoadCursor(dpy->display, name);
+}
+
+#endif // SWA_WITH_XCB_CURSOR
+
+static xcb_cursor_t create_named_cursor(struct swa_display_x11* dpy,
+		enum swa_cursor_type type) {
 	xcb_cursor_t cursor = 0;
 	if(type == swa_cursor_none) {
 		xcb_pixmap_t pixmap = xcb_generate_id(dpy->conn);
@@ -194,11 +662,6 @@ static xcb_cursor_t get_cursor(struct swa_display_x11* dpy,
 			0, 0, 0, 0, 0, 0, 0, 0);
 		xcb_free_pixmap(dpy->conn, pixmap);
 	} else {
-		// NOTE: the reason we use xcursor here (Xlib api) is because
-		// xcb would require us to use xcb_cursor and xcb_render (for custom
-		// image cursors). Both are probably not as widely
-		// available/installed as libxcursor.
-		// We should probably switch at some point though.
 		const char* const* names = swa_get_xcursor_names(type);
 		if(!names) {
 			dlg_warn("failed to convert cursor type %d to xcursor", type);
@@ -206,7 +669,7 @@ static xcb_cursor_t get_cursor(struct swa_display_x11* dpy,
 		}
 
 		for(; *names; ++names) {
-			cursor = XcursorLibraryLoadCursor(dpy->display, *names);
+			cursor = load_theme_cursor(dpy, *names);
 			if(cursor) {
 				break;
 			} else {
@@ -217,58 +680,63 @@ static xcb_cursor_t get_cursor(struct swa_display_x11* dpy,
 
 	if(!cursor) {
 		dlg_warn("Failed to create cursor for cursor type %d", type);
-		return cursor;
 	}
 
-	++dpy->n_cursors;
-	dpy->cursors = realloc(dpy->cursors, dpy->n_cursors * sizeof(*dpy->cursors));
-
-	dpy->cursors[dpy->n_cursors - 1].cursor = cursor;
-	dpy->cursors[dpy->n_cursors - 1].type = type;
 	return cursor;
 }
 
+static struct swa_cursor_cache_entry* get_cursor(struct swa_display_x11* dpy,
+		const struct swa_cursor* cursor) {
+	struct swa_cursor_key key;
+	swa_cursor_key_init(&key, cursor);
+	struct swa_cursor_cache_entry* entry =
+		swa_cursor_cache_find(&dpy->cursors, &key);
+	if(entry) {
+		return entry;
+	}
+
+	xcb_cursor_t xcursor;
+	size_t size = 0u;
+	if(cursor->type == swa_cursor_image) {
+		xcursor = create_image_cursor(dpy, cursor);
+		size = 4u * cursor->image.width * cursor->image.height;
+	} else {
+		// we don't know the size of theme cursors. There are only
+		// a few of them though, they are limited by the entry count.
+		xcursor = create_named_cursor(dpy, cursor->type);
+	}
+
+	if(!xcursor) {
+		return NULL;
+	}
+
+	entry = swa_cursor_cache_insert(&dpy->cursors, &key, size);
+	entry->id = xcursor;
+	return entry;
+}
+
 static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 	struct swa_window_x11* win = get_window_x11(base);
 
 	// for swa_cursor_default we simply unset the cursor (set it to XCB_NONE)
 	// so that the parent cursor will be used
-	xcb_cursor_t xcursor = XCB_NONE;
-	bool owned = false;
-	if(cursor.type == swa_cursor_image) {
-		struct swa_image* img = &cursor.image;
-		XcursorImage* xcimage = XcursorImageCreate(img->width, img->height);
-		xcimage->xhot = cursor.hx;
-		xcimage->yhot = cursor.hy;
-
-		struct swa_image dst = {
-			.width = img->width,
-			.height = img->height,
-			.stride = 4 * img->width,
-			.data = (uint8_t*) xcimage->pixels,
-			.format = swa_image_format_toggle_byte_word(swa_image_format_argb32),
-		};
-
-		swa_convert_image(img, &dst);
-		xcursor = XcursorImageLoadCursor(win->dpy->display, xcimage);
-		if(!xcursor) {
-			dlg_warn("XcursorImageLoadCursor failed");
-		}
-
-		XcursorImageDestroy(xcimage);
-		owned = true;
-	} else if(cursor.type != swa_cursor_default) {
-		xcursor = get_cursor(win->dpy, cursor.type);
+	struct swa_cursor_cache_entry* entry = NULL;
+	if(cursor.type != swa_cursor_default) {
+		entry = get_cursor(win->dpy, &cursor);
 	}
 
-	if(win->cursor) {
-		xcb_free_cursor(win->dpy->conn, win->cursor);
+	if(entry == win->cursor) {
+		return;
 	}
 
-	win->cursor = owned ? xcursor : 0;
+	// the server keeps the cursor alive as long as it is used by the
+	// window, we are allowed to evict it from the cache right after
+	// changing the window attribute.
+	xcb_cursor_t xcursor = entry ? entry->id : XCB_NONE;
 	xcb_change_window_attributes(win->dpy->conn, win->window,
 		XCB_CW_CURSOR, &xcursor);
-	xcb_flush(win->dpy->conn);
+	swa_cursor_cache_set(&win->dpy->cursors, &win->cursor, entry);
+	request_flush(win->dpy);
 }
 
 static void win_refresh(struct swa_window* base) {
@@ -279,21 +747,30 @@ static void win_refresh(struct swa_window* base) {
 		return;
 	}
 
+	// will be drawn when it becomes visible, see update_visibility
+	if(!win->visibility.visible) {
+		win->visibility.redraw = true;
+		return;
+	}
+
 	if(win->dpy->ext.xpresent && win->present.pending) {
 		win->present.redraw = true;
 		return;
 	}
 
-	xcb_expose_event_t ev = {0};
-	ev.response_type = XCB_EXPOSE;
-	ev.window = win->window;
-	xcb_send_event(win->dpy->conn, 0, win->window,
-		XCB_EVENT_MASK_EXPOSURE, (const char*)&ev);
-	xcb_flush(win->dpy->conn);
+	// the draw event was already scheduled
+	if(swa_draw_sched_pending(&win->sched)) {
+		return;
+	}
+
+	// No need to involve the server (e.g. via a synthetic expose
+	// event), the draw event is emitted from the dispatch loop.
+	defer_draw(win);
 }
 
 static void win_surface_frame(struct swa_window* base) {
 	struct swa_window_x11* win = get_window_x11(base);
+	swa_draw_sched_end(&win->sched);
 
 	if(win->dpy->ext.xpresent && !win->present.pending) {
 		if(!win->present.context) {
@@ -306,7 +783,7 @@ static void win_surface_frame(struct swa_window* base) {
 		xcb_present_notify_msc(win->dpy->conn, win->window,
 			++win->present.serial,
 			win->present.target_msc, 1, 0);
-		xcb_flush(win->dpy->conn);
+		request_flush(win->dpy);
 		win->present.pending = true;
 	}
 
@@ -352,7 +829,7 @@ static void win_set_state(struct swa_window* base, enum swa_window_state state)
 		xcb_send_event(win->dpy->conn, false, root, mask, (const char*) &event);
 	}
 
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static void win_begin_move(struct swa_window* base) {
@@ -371,7 +848,7 @@ static void win_begin_move(struct swa_window* base) {
 	xcb_ewmh_request_wm_moveresize(&win->dpy->ewmh, 0, win->window,
 		win->dpy->mouse.x, win->dpy->mouse.y, XCB_EWMH_WM_MOVERESIZE_MOVE,
 		index, XCB_EWMH_CLIENT_SOURCE_TYPE_NORMAL);
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static xcb_ewmh_moveresize_direction_t edge_to_x11(enum swa_edge edge) {
@@ -410,13 +887,13 @@ static void win_begin_resize(struct swa_window* base, enum swa_edge edges) {
 	xcb_ewmh_request_wm_moveresize(&win->dpy->ewmh, 0, win->window,
 		win->dpy->mouse.x, win->dpy->mouse.y, action,
 		index, XCB_EWMH_CLIENT_SOURCE_TYPE_NORMAL);
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static void win_set_title(struct swa_window* base, const char* title) {
 	struct swa_window_x11* win = get_window_x11(base);
 	xcb_ewmh_set_wm_name(&win->dpy->ewmh, win->window, strlen(title), title);
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static void win_set_icon(struct swa_window* base, const struct swa_image* img) {
@@ -445,7 +922,7 @@ static void win_set_icon(struct swa_window* base, const struct swa_image* img) {
 			win->window, 2, buffer);
 	}
 
-	xcb_flush(win->dpy->conn);
+	request_flush(win->dpy);
 }
 
 static bool win_is_client_decorated(struct swa_window* base) {
@@ -582,15 +1059,30 @@ static void win_apply_buffer(struct swa_window* base) {
 	win_surface_frame(base);
 
 	buf->active = false;
-	xcb_void_cookie_t cookie = xcb_shm_put_image_checked(win->dpy->conn,
+	x11_request(win->dpy, "xcb_shm_put_image", xcb_shm_put_image,
 		win->window, buf->gc, win->width, win->height, 0, 0,
 		win->width, win->height, 0, 0, win->depth,
 		XCB_IMAGE_FORMAT_Z_PIXMAP, 0, buf->shmseg, 0);
-	xcb_generic_error_t* err = xcb_request_check(win->dpy->conn, cookie);
-	if(err) {
-		handle_error(win->dpy, err, "xcb_shm_put_image");
-		return;
+	request_flush(win->dpy);
+}
+
+static void win_update_listener(struct swa_window* base) {
+	struct swa_window_x11* win = get_window_x11(base);
+	uint32_t eventmask = listener_event_mask(base->listener);
+	xcb_change_window_attributes(win->dpy->conn, win->window,
+		XCB_CW_EVENT_MASK, &eventmask);
+	// xinput is optional, requests would close the connection otherwise
+	if(win->dpy->ext.xinput) {
+		select_xi_events(win, true);
 	}
+	request_flush(win->dpy);
+}
+
+static void win_set_draw_scheduling(struct swa_window* base, bool enable,
+		uint64_t margin) {
+	struct swa_window_x11* win = get_window_x11(base);
+	win->sched.enabled = enable;
+	win->sched.margin = margin;
 }
 
 static void* win_native_handle(struct swa_window* base) {
@@ -620,46 +1112,101 @@ static const struct swa_window_interface window_impl = {
 	.gl_set_swap_interval = win_gl_set_swap_interval,
 	.get_buffer = win_get_buffer,
 	.apply_buffer = win_apply_buffer,
+	.set_draw_scheduling = win_set_draw_scheduling,
+	.update_listener = win_update_listener,
 	.native_handle = win_native_handle,
 };
 
 
 // display api
-static void display_destroy(struct swa_display* base) {
-	struct swa_display_x11* dpy = get_display_x11(base);
-	if(!dpy->display) {
-		free(dpy);
+static struct swa_window_x11* find_window(struct swa_display_x11* dpy,
+		xcb_window_t xcb_win) {
+	return window_map_find(&dpy->window_map, xcb_win);
+}
+
+static void emit_draw(struct swa_window_x11* win) {
+	if(!win->visibility.visible) {
+		win->visibility.redraw = true;
 		return;
 	}
 
-	dlg_assertm(!dpy->window_list, "Still windows left");
-	dlg_assert(dpy->conn || !dpy->n_cursors);
+	if(win->base.listener->draw) {
+		dlg_assert(win->visualtype);
+		swa_draw_sched_begin(&win->sched);
+		win->base.listener->draw(&win->base);
+	}
+}
 
-	for(unsigned i = 0u; i < dpy->n_cursors; ++i) {
-		xcb_free_cursor(dpy->conn, dpy->cursors[i].cursor);
+static void sched_draw_cb(struct swa_timer* timer) {
+	emit_draw(swa_timer_get_userdata(timer));
+}
+
+static void dispatch_deferred_draws(struct swa_display_x11* dpy) {
+	// Windows refreshed again from their draw handler are only drawn in
+	// the next dispatch, otherwise we would never return.
+	unsigned count = 0u;
+	for(struct swa_window_x11* it = dpy->deferred_draws.first; it;
+			it = it->next_deferred) {
+		++count;
+	}
+
+	for(; count > 0 && dpy->deferred_draws.first; --count) {
+		struct swa_window_x11* win = dpy->deferred_draws.first;
+		undefer_draw(win);
+
+		// the window might have called surface_frame after the
+		// refresh, we have to wait for the present then
+		if(dpy->ext.xpresent && win->present.pending) {
+			win->present.redraw = true;
+		} else if(!swa_draw_sched_defer(&win->sched, &dpy->timers,
+				sched_draw_cb, win)) {
+			emit_draw(win);
+		}
 	}
+}
 
-	free(dpy->cursors);
-	swa_xkb_finish(&dpy->keyboard.xkb);
-	if(dpy->next_event) free(dpy->next_event);
-	xcb_ewmh_connection_wipe(&dpy->ewmh);
+// We consider a window visible when it is mapped (minimized windows
+// are usually unmapped), not fully obscured and not hidden as
+// signaled by the window manager (e.g. on another workspace).
+static void update_visibility(struct swa_window_x11* win) {
+	bool visible = win->visibility.mapped && !win->visibility.obscured &&
+		!win->visibility.hidden;
+	if(visible == win->visibility.visible) {
+		return;
+	}
 
-	if(dpy->conn) xcb_flush(dpy->conn); // no destruction needed
-	if(dpy->display) XCloseDisplay(dpy->display);
-	free(dpy);
+	win->visibility.visible = visible;
+	if(visible && win->visibility.redraw) {
+		win->visibility.redraw = false;
+		win_refresh(&win->base);
+	}
+
+	if(win->base.listener->visibility) {
+		win->base.listener->visibility(&win->base, visible);
+	}
 }
 
-static struct swa_window_x11* find_window(struct swa_display_x11* dpy,
-		xcb_window_t xcb_win) {
-	struct swa_window_x11* win = dpy->window_list;
-	while(win) {
-		if(win->window == xcb_win) {
-			return win;
+static void handle_wm_state(struct swa_window_x11* win, bool deleted) {
+	struct swa_display_x11* dpy = win->dpy;
+	bool hidden = false;
+	if(!deleted) {
+		xcb_ewmh_get_atoms_reply_t states;
+		xcb_get_property_cookie_t cookie =
+			xcb_ewmh_get_wm_state(&dpy->ewmh, win->window);
+		if(xcb_ewmh_get_wm_state_reply(&dpy->ewmh, cookie, &states, NULL)) {
+			for(unsigned i = 0u; i < states.atoms_len; ++i) {
+				if(states.atoms[i] == dpy->ewmh._NET_WM_STATE_HIDDEN) {
+					hidden = true;
+					break;
+				}
+			}
+
+			xcb_ewmh_get_atoms_reply_wipe(&states);
 		}
-		win = win->next;
 	}
 
-	return NULL;
+	win->visibility.hidden = hidden;
+	update_visibility(win);
 }
 
 static void handle_present_event(struct swa_display_x11* dpy,
@@ -687,11 +1234,36 @@ static void handle_present_event(struct swa_display_x11* dpy,
 
 			win->present.target_msc = complete->msc + 1; // for next frame
 			win->present.pending = false;
+
+			// We only get notified about the msc after the frame was
+			// submitted, not about the actual presentation of a pixmap
+			// (we don't present via xcb_present_pixmap). With vsync this
+			// is the vblank the frame was presented at.
+			uint64_t refresh = 0;
+			uint64_t dmsc = complete->msc - win->present.last_msc;
+			if(win->present.last_ust && complete->ust &&
+					complete->msc > win->present.last_msc) {
+				refresh = 1000 * (complete->ust - win->present.last_ust) / dmsc;
+			}
+
+			win->present.last_ust = complete->ust;
+			win->present.last_msc = complete->msc;
+
+			struct swa_present_event pev = {
+				.time_ns = 1000 * complete->ust,
+				.refresh_ns = refresh,
+				.seq = complete->msc,
+			};
+			swa_draw_sched_presented(&win->sched, &pev);
+			if(win->base.listener->presented) {
+				win->base.listener->presented(&win->base, &pev);
+			}
+
 			if(win->present.redraw) {
 				win->present.redraw = false;
-				if(win->base.listener->draw) {
-					dlg_assert(win->visualtype);
-					win->base.listener->draw(&win->base);
+				if(!swa_draw_sched_defer(&win->sched, &dpy->timers,
+						sched_draw_cb, win)) {
+					emit_draw(win);
 				}
 			}
 		}
@@ -711,6 +1283,7 @@ static void handle_xinput_event(struct swa_display_x11* dpy,
 		float x = tev->event_x / fp16;
 		float y = tev->event_y / fp16;
 		unsigned id = tev->detail;
+		uint64_t time = swa_event_time_usec(tev->time);
 		switch(gev->event_type) {
 		case XCB_INPUT_TOUCH_BEGIN:
 			if(win->base.listener->touch_begin) {
@@ -718,6 +1291,7 @@ static void handle_xinput_event(struct swa_display_x11* dpy,
 					.id = id,
 					.x = x,
 					.y = y,
+					.time_usec = time,
 				};
 				win->base.listener->touch_begin(&win->base, &ev);
 			} return;
@@ -727,6 +1301,7 @@ static void handle_xinput_event(struct swa_display_x11* dpy,
 					.id = id,
 					.x = x,
 					.y = y,
+					.time_usec = time,
 				};
 				win->base.listener->touch_update(&win->base, &ev);
 			}
@@ -739,46 +1314,759 @@ static void handle_xinput_event(struct swa_display_x11* dpy,
 	}
 }
 
-static enum swa_mouse_button x11_to_button_and_wheel(unsigned detail,
-		float* wheel_x, float* wheel_y) {
-	switch(detail) {
-		case 1: return swa_mouse_button_left;
-		case 2: return swa_mouse_button_middle;
-		case 3: return swa_mouse_button_right;
-		case 4: *wheel_y = 1.f; return swa_mouse_button_none;
-		case 5: *wheel_y = -1.f; return swa_mouse_button_none;
-		case 6: *wheel_x = 1.f; return swa_mouse_button_none;
-		case 7: *wheel_x = -1.f; return swa_mouse_button_none;
-		case 8: return swa_mouse_button_custom1;
-		case 9: return swa_mouse_button_custom2;
-		default: return swa_mouse_button_none;
+static enum swa_mouse_button x11_to_button_and_wheel(unsigned detail,
+		float* wheel_x, float* wheel_y) {
+	switch(detail) {
+		case 1: return swa_mouse_button_left;
+		case 2: return swa_mouse_button_middle;
+		case 3: return swa_mouse_button_right;
+		case 4: *wheel_y = 1.f; return swa_mouse_button_none;
+		case 5: *wheel_y = -1.f; return swa_mouse_button_none;
+		case 6: *wheel_x = 1.f; return swa_mouse_button_none;
+		case 7: *wheel_x = -1.f; return swa_mouse_button_none;
+		case 8: return swa_mouse_button_custom1;
+		case 9: return swa_mouse_button_custom2;
+		default: return swa_mouse_button_none;
+	}
+}
+
+static bool init_keymap(struct swa_display_x11* dpy) {
+	int flags = XKB_KEYMAP_COMPILE_NO_FLAGS;
+	int32_t dev = dpy->keyboard.device_id;
+
+	struct xkb_keymap* keymap = xkb_x11_keymap_new_from_device(
+		dpy->keyboard.xkb.context, dpy->conn, dev, flags);
+	if(!keymap) {
+		dlg_error("xkb_x11_keymap_new_from_device failed");
+		return false;
+	}
+
+	struct xkb_state* state = xkb_x11_state_new_from_device(keymap,
+		dpy->conn, dev);
+	if(!state) {
+		dlg_error("xkb_x11_state_new_from_device failed");
+		return false;
+	}
+
+	struct swa_xkb_context* xkb = &dpy->keyboard.xkb;
+	if(xkb->keymap) xkb_keymap_unref(xkb->keymap);
+	if(xkb->state) xkb_state_unref(xkb->state);
+	xkb->keymap = keymap;
+	xkb->state = state;
+	return true;
+}
+
+// selections
+static const struct swa_data_offer_interface data_offer_impl;
+static const char* const mime_utf8 = "text/plain;charset=utf-8";
+
+static struct swa_data_offer_x11* get_data_offer_x11(
+		struct swa_data_offer* base) {
+	dlg_assert(base->impl == &data_offer_impl);
+	return (struct swa_data_offer_x11*) base;
+}
+
+static char* copy_string(const char* str, size_t len) {
+	char* ret = malloc(len + 1);
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	return ret;
+}
+
+// Interns all given atoms with a single round trip.
+// Atoms that could not be interned are set to XCB_ATOM_NONE.
+static void intern_atoms(struct swa_display_x11* dpy, unsigned count,
+		const char** names, xcb_atom_t* atoms) {
+	xcb_intern_atom_cookie_t* cookies = calloc(count, sizeof(*cookies));
+	for(unsigned i = 0u; i < count; ++i) {
+		cookies[i] = xcb_intern_atom(dpy->conn, 0, strlen(names[i]), names[i]);
+	}
+
+	for(unsigned i = 0u; i < count; ++i) {
+		xcb_generic_error_t* err = NULL;
+		xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(dpy->conn,
+			cookies[i], &err);
+		atoms[i] = XCB_ATOM_NONE;
+		if(reply) {
+			atoms[i] = reply->atom;
+			free(reply);
+		} else {
+			handle_error(dpy, err, "xcb_intern_atom");
+		}
+	}
+
+	free(cookies);
+}
+
+// X11 clients traditionally use their own target names for text
+// instead of mime types. Returns NULL for targets that aren't
+// data formats (e.g. TARGETS or TIMESTAMP).
+static const char* target_to_format(struct swa_display_x11* dpy,
+		xcb_atom_t atom, const char* name) {
+	if(atom == dpy->atoms.utf8_string) {
+		return mime_utf8;
+	} else if(atom == XCB_ATOM_STRING) {
+		return "text/plain";
+	}
+
+	return strchr(name, '/') ? name : NULL;
+}
+
+static void data_offer_reset_data(struct swa_data_offer_x11* offer) {
+	free(offer->data.bytes);
+	free((void*) offer->data.format);
+	memset(&offer->data, 0, sizeof(offer->data));
+}
+
+// Ends the current data request and notifies the application.
+// The handler is allowed to destroy the offer, so all request state
+// is reset before calling it. On success, ownership of the
+// accumulated data is transferred to the application.
+static void data_offer_finish_data(struct swa_data_offer_x11* offer,
+		bool success) {
+	swa_data_handler handler = offer->data.handler;
+	swa_data_stream_handler stream = offer->data.stream;
+	const char* format = offer->data.format;
+	struct swa_exchange_data data = {0};
+	if(success && handler) {
+		data.data = offer->data.bytes;
+		data.size = offer->data.n_bytes;
+		offer->data.bytes = NULL;
+	}
+
+	offer->data.format = NULL;
+	data_offer_reset_data(offer);
+
+	if(stream) {
+		enum swa_data_stream_status status = success ?
+			swa_data_stream_done : swa_data_stream_error;
+		stream(&offer->base, format, data, status);
+	} else {
+		handler(&offer->base, format, data);
+	}
+
+	free((void*) format);
+}
+
+// Hands received data to the application or appends it to the
+// data accumulated so far, depending on the kind of request.
+static bool data_offer_add_data(struct swa_data_offer_x11* offer,
+		const char* data, uint64_t size) {
+	if(offer->data.stream) {
+		struct swa_exchange_data chunk = {
+			.data = data,
+			.size = size,
+		};
+		offer->data.stream(&offer->base, offer->data.format, chunk,
+			swa_data_stream_chunk);
+		return true;
+	}
+
+	uint64_t needed = offer->data.n_bytes + size;
+	if(needed > offer->data.cap) {
+		uint64_t cap = offer->data.cap * 2;
+		cap = cap > needed ? cap : needed;
+		char* bytes = realloc(offer->data.bytes, cap);
+		if(!bytes) {
+			dlg_error("failed to allocate data offer buffer");
+			return false;
+		}
+
+		offer->data.bytes = bytes;
+		offer->data.cap = cap;
+	}
+
+	memcpy(offer->data.bytes + offer->data.n_bytes, data, size);
+	offer->data.n_bytes += size;
+	return true;
+}
+
+static void data_offer_destroy(struct swa_data_offer* base) {
+	struct swa_data_offer_x11* offer = get_data_offer_x11(base);
+	if(offer->dpy->selection.offer == offer) {
+		offer->dpy->selection.offer = NULL;
+	}
+
+	if(offer->formats_handler) {
+		offer->formats_handler(&offer->base, NULL, 0);
+	}
+	if(offer->data.handler || offer->data.stream) {
+		data_offer_finish_data(offer, false);
+	}
+
+	swa_offer_cache_finish(&offer->base.cache);
+	for(unsigned i = 0u; i < offer->n_formats; ++i) {
+		free((void*) offer->formats[i]);
+	}
+	free(offer->formats);
+	free(offer->format_atoms);
+	free(offer);
+}
+
+static bool data_offer_formats(struct swa_data_offer* base,
+		swa_formats_handler cb) {
+	struct swa_data_offer_x11* offer = get_data_offer_x11(base);
+	struct swa_display_x11* dpy = offer->dpy;
+	if(offer->formats_known) {
+		cb(base, offer->formats, offer->n_formats);
+		return true;
+	}
+
+	dlg_assert(!offer->formats_handler);
+	if(!x11_request(dpy, "xcb_convert_selection (TARGETS)",
+			xcb_convert_selection, dpy->dummy_window, offer->selection,
+			dpy->atoms.targets, dpy->atoms.swa_targets, XCB_CURRENT_TIME)) {
+		return false;
+	}
+
+	offer->formats_handler = cb;
+	request_flush(dpy);
+	return true;
+}
+
+static bool data_offer_request(struct swa_data_offer_x11* offer,
+		const char* format) {
+	struct swa_display_x11* dpy = offer->dpy;
+	dlg_assert(!offer->data.handler && !offer->data.stream);
+
+	xcb_atom_t target = XCB_ATOM_NONE;
+	for(unsigned i = 0u; i < offer->n_formats; ++i) {
+		if(strcmp(offer->formats[i], format) == 0) {
+			target = offer->format_atoms[i];
+			break;
+		}
+	}
+
+	// formats not queried (or not offered), just try it
+	if(target == XCB_ATOM_NONE) {
+		intern_atoms(dpy, 1, &format, &target);
+		if(target == XCB_ATOM_NONE) {
+			return false;
+		}
+	}
+
+	if(!x11_request(dpy, "xcb_convert_selection", xcb_convert_selection,
+			dpy->dummy_window, offer->selection, target,
+			dpy->atoms.swa_selection, XCB_CURRENT_TIME)) {
+		return false;
+	}
+
+	offer->data.format = copy_string(format, strlen(format));
+	request_flush(dpy);
+	return true;
+}
+
+static bool data_offer_data(struct swa_data_offer* base, const char* format,
+		swa_data_handler cb) {
+	struct swa_data_offer_x11* offer = get_data_offer_x11(base);
+	if(!data_offer_request(offer, format)) {
+		return false;
+	}
+
+	offer->data.handler = cb;
+	return true;
+}
+
+static bool data_offer_data_stream(struct swa_data_offer* base,
+		const char* format, swa_data_stream_handler cb) {
+	struct swa_data_offer_x11* offer = get_data_offer_x11(base);
+	if(!data_offer_request(offer, format)) {
+		return false;
+	}
+
+	offer->data.stream = cb;
+	return true;
+}
+
+static void data_offer_set_preferred(struct swa_data_offer* base,
+		const char* format, enum swa_data_action action) {
+	// only relevant for dnd
+}
+
+static enum swa_data_action data_offer_action(struct swa_data_offer* base) {
+	return swa_data_action_copy;
+}
+
+static enum swa_data_action data_offer_supported_actions(
+		struct swa_data_offer* base) {
+	return swa_data_action_copy;
+}
+
+static const struct swa_data_offer_interface data_offer_impl = {
+	.destroy = data_offer_destroy,
+	.formats = data_offer_formats,
+	.data = data_offer_data,
+	.data_stream = data_offer_data_stream,
+	.set_preferred = data_offer_set_preferred,
+	.action = data_offer_action,
+	.supported_actions = data_offer_supported_actions,
+};
+
+static void handle_targets_notify(struct swa_data_offer_x11* offer,
+		const xcb_selection_notify_event_t* ev) {
+	struct swa_display_x11* dpy = offer->dpy;
+	swa_formats_handler cb = offer->formats_handler;
+	offer->formats_handler = NULL;
+	if(ev->property == XCB_ATOM_NONE) {
+		// owner refused the conversion
+		cb(&offer->base, NULL, 0);
+		return;
+	}
+
+	xcb_generic_error_t* err = NULL;
+	xcb_get_property_cookie_t cookie = xcb_get_property(dpy->conn, true,
+		dpy->dummy_window, dpy->atoms.swa_targets, XCB_ATOM_ATOM,
+		0, max_prop_length);
+	xcb_get_property_reply_t* reply = xcb_get_property_reply(dpy->conn,
+		cookie, &err);
+	if(!reply) {
+		handle_error(dpy, err, "xcb_get_property (TARGETS)");
+		cb(&offer->base, NULL, 0);
+		return;
+	}
+
+	const xcb_atom_t* targets = xcb_get_property_value(reply);
+	unsigned count = xcb_get_property_value_length(reply) / 4;
+	xcb_get_atom_name_cookie_t* cookies = calloc(count, sizeof(*cookies));
+	for(unsigned i = 0u; i < count; ++i) {
+		cookies[i] = xcb_get_atom_name(dpy->conn, targets[i]);
+	}
+
+	offer->formats = calloc(count, sizeof(*offer->formats));
+	offer->format_atoms = calloc(count, sizeof(*offer->format_atoms));
+	for(unsigned i = 0u; i < count; ++i) {
+		xcb_get_atom_name_reply_t* name_reply = xcb_get_atom_name_reply(
+			dpy->conn, cookies[i], &err);
+		if(!name_reply) {
+			handle_error(dpy, err, "xcb_get_atom_name");
+			continue;
+		}
+
+		char* name = copy_string(xcb_get_atom_name_name(name_reply),
+			xcb_get_atom_name_name_length(name_reply));
+		free(name_reply);
+
+		const char* format = target_to_format(dpy, targets[i], name);
+		bool duplicate = false;
+		for(unsigned j = 0u; format && j < offer->n_formats; ++j) {
+			duplicate |= (strcmp(offer->formats[j], format) == 0);
+		}
+
+		if(format && !duplicate) {
+			unsigned idx = offer->n_formats++;
+			offer->formats[idx] = copy_string(format, strlen(format));
+			offer->format_atoms[idx] = targets[i];
+		}
+
+		free(name);
+	}
+
+	free(cookies);
+	free(reply);
+	offer->formats_known = true;
+	cb(&offer->base, offer->formats, offer->n_formats);
+}
+
+// Reads (and deletes) the selection data property on our dummy window.
+// Deleting it signals the owner to send the next chunk when using INCR.
+static xcb_get_property_reply_t* read_selection_property(
+		struct swa_display_x11* dpy) {
+	xcb_generic_error_t* err = NULL;
+	xcb_get_property_cookie_t cookie = xcb_get_property(dpy->conn, true,
+		dpy->dummy_window, dpy->atoms.swa_selection, XCB_ATOM_ANY,
+		0, max_prop_length);
+	xcb_get_property_reply_t* reply = xcb_get_property_reply(dpy->conn,
+		cookie, &err);
+	if(!reply) {
+		handle_error(dpy, err, "xcb_get_property (selection)");
+	}
+
+	return reply;
+}
+
+static void handle_data_notify(struct swa_data_offer_x11* offer,
+		const xcb_selection_notify_event_t* ev) {
+	struct swa_display_x11* dpy = offer->dpy;
+	if(ev->property == XCB_ATOM_NONE) {
+		// owner refused the conversion
+		data_offer_finish_data(offer, false);
+		return;
+	}
+
+	xcb_get_property_reply_t* reply = read_selection_property(dpy);
+	if(!reply) {
+		data_offer_finish_data(offer, false);
+		return;
+	}
+
+	if(reply->type == dpy->atoms.incr) {
+		// The value is a lower bound for the size, the data follows in
+		// chunks. We already deleted the property which tells the
+		// owner to start sending. See handle_property_notify.
+		if(!offer->data.stream && xcb_get_property_value_length(reply) >= 4) {
+			uint32_t size = *(const uint32_t*) xcb_get_property_value(reply);
+			offer->data.bytes = malloc(size);
+			offer->data.cap = offer->data.bytes ? size : 0u;
+		}
+
+		offer->data.incr = true;
+		free(reply);
+		request_flush(dpy);
+		return;
+	}
+
+	bool success = data_offer_add_data(offer, xcb_get_property_value(reply),
+		xcb_get_property_value_length(reply));
+	free(reply);
+	data_offer_finish_data(offer, success);
+}
+
+static void handle_incr_chunk(struct swa_data_offer_x11* offer) {
+	struct swa_display_x11* dpy = offer->dpy;
+	xcb_get_property_reply_t* reply = read_selection_property(dpy);
+	if(!reply) {
+		data_offer_finish_data(offer, false);
+		return;
+	}
+
+	// a zero-length chunk marks the end of the transfer
+	unsigned length = xcb_get_property_value_length(reply);
+	if(length == 0u) {
+		free(reply);
+		data_offer_finish_data(offer, true);
+		return;
+	}
+
+	bool success = data_offer_add_data(offer, xcb_get_property_value(reply),
+		length);
+	free(reply);
+	if(!success) {
+		data_offer_finish_data(offer, false);
+		return;
+	}
+
+	request_flush(dpy);
+}
+
+static void data_source_destroy(struct swa_data_source_x11* source) {
+	dlg_assert(!source->transfers);
+	struct swa_display_x11* dpy = source->dpy;
+	if(source->next) source->next->prev = source->prev;
+	if(source->prev) source->prev->next = source->next;
+	if(dpy->selection.sources == source) {
+		dpy->selection.sources = source->next;
+	}
+	if(dpy->selection.source == source) {
+		dpy->selection.source = NULL;
+	}
+
+	source->source->impl->destroy(source->source);
+	free(source->targets);
+	free(source->target_formats);
+	free(source);
+}
+
+// Destroys the source if it is not needed anymore, i.e. when
+// we lost ownership and all pending transfers finished.
+static void data_source_check_finished(struct swa_data_source_x11* source) {
+	if(source->selection == XCB_ATOM_NONE && !source->transfers) {
+		data_source_destroy(source);
+	}
+}
+
+// Whether any pending transfer (of any source) targets the requestor.
+static bool has_selection_transfers(struct swa_display_x11* dpy,
+		xcb_window_t requestor) {
+	for(struct swa_data_source_x11* s = dpy->selection.sources; s; s = s->next) {
+		for(struct swa_x11_selection_transfer* t = s->transfers; t; t = t->next) {
+			if(t->requestor == requestor) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static void selection_transfer_destroy(struct swa_data_source_x11* source,
+		struct swa_x11_selection_transfer* transfer, bool unselect) {
+	struct swa_display_x11* dpy = source->dpy;
+	struct swa_x11_selection_transfer** it = &source->transfers;
+	while(*it != transfer) {
+		it = &(*it)->next;
+	}
+	*it = transfer->next;
+
+	// we selected property events on the requestor for the transfer.
+	// Our own windows need their event mask though, and other
+	// transfers to the same requestor still need the events.
+	if(unselect && transfer->requestor != dpy->dummy_window &&
+			!find_window(dpy, transfer->requestor) &&
+			!has_selection_transfers(dpy, transfer->requestor)) {
+		uint32_t mask = XCB_EVENT_MASK_NO_EVENT;
+		xcb_change_window_attributes(dpy->conn, transfer->requestor,
+			XCB_CW_EVENT_MASK, &mask);
+	}
+
+	free(transfer);
+}
+
+// Called when we lost ownership of the source's selection.
+static void data_source_lost(struct swa_data_source_x11* source) {
+	source->selection = XCB_ATOM_NONE;
+	if(source->dpy->selection.source == source) {
+		source->dpy->selection.source = NULL;
+	}
+
+	data_source_check_finished(source);
+}
+
+static struct swa_data_source_x11* data_source_create(
+		struct swa_display_x11* dpy, struct swa_data_source* source,
+		xcb_atom_t selection) {
+	unsigned n_formats = 0u;
+	const char** formats = source->impl->formats(source, &n_formats);
+
+	// additionally offer utf-8 text as UTF8_STRING, that is what
+	// most x11 clients will ask for
+	struct swa_data_source_x11* wrapper = calloc(1, sizeof(*wrapper));
+	wrapper->targets = calloc(n_formats + 1, sizeof(*wrapper->targets));
+	wrapper->target_formats = calloc(n_formats + 1,
+		sizeof(*wrapper->target_formats));
+	intern_atoms(dpy, n_formats, formats, wrapper->targets);
+	for(unsigned i = 0u; i < n_formats; ++i) {
+		wrapper->target_formats[i] = formats[i];
+		if(strcmp(formats[i], mime_utf8) == 0) {
+			wrapper->targets[n_formats] = dpy->atoms.utf8_string;
+			wrapper->target_formats[n_formats] = formats[i];
+		}
+	}
+
+	wrapper->n_targets = n_formats;
+	if(wrapper->target_formats[n_formats]) {
+		++wrapper->n_targets;
+	}
+
+	wrapper->dpy = dpy;
+	wrapper->source = source;
+	wrapper->selection = selection;
+	wrapper->next = dpy->selection.sources;
+	if(dpy->selection.sources) dpy->selection.sources->prev = wrapper;
+	dpy->selection.sources = wrapper;
+	return wrapper;
+}
+
+// Writes the next chunk of an INCR transfer after the requestor
+// deleted the previous one. Returns false when the transfer is done.
+static bool write_incr_chunk(struct swa_display_x11* dpy,
+		struct swa_x11_selection_transfer* transfer) {
+	uint64_t left = transfer->data.size - transfer->offset;
+	uint32_t size = left < dpy->selection.chunk_size ?
+		left : dpy->selection.chunk_size;
+
+	// the zero-length chunk after all data signals the end
+	xcb_change_property(dpy->conn, XCB_PROP_MODE_REPLACE,
+		transfer->requestor, transfer->property, transfer->target,
+		8, size, transfer->data.data + transfer->offset);
+	transfer->offset += size;
+	return size != 0u;
+}
+
+// Converts the selection into the requested target, returns the
+// property the data was stored in or XCB_ATOM_NONE on failure.
+static xcb_atom_t convert_selection(struct swa_data_source_x11* source,
+		const xcb_selection_request_event_t* ev, xcb_atom_t property) {
+	struct swa_display_x11* dpy = source->dpy;
+	if(ev->target == dpy->atoms.targets) {
+		xcb_atom_t* atoms = calloc(source->n_targets + 1, sizeof(*atoms));
+		atoms[0] = dpy->atoms.targets;
+		memcpy(atoms + 1, source->targets,
+			source->n_targets * sizeof(*atoms));
+		xcb_change_property(dpy->conn, XCB_PROP_MODE_REPLACE, ev->requestor,
+			property, XCB_ATOM_ATOM, 32, source->n_targets + 1, atoms);
+		free(atoms);
+		return property;
+	}
+
+	const char* format = NULL;
+	for(unsigned i = 0u; i < source->n_targets; ++i) {
+		if(source->targets[i] == ev->target) {
+			format = source->target_formats[i];
+			break;
+		}
+	}
+
+	if(!format) {
+		return XCB_ATOM_NONE;
+	}
+
+	struct swa_exchange_data data = source->source->impl->data(
+		source->source, format);
+	if(data.size <= dpy->selection.chunk_size) {
+		xcb_change_property(dpy->conn, XCB_PROP_MODE_REPLACE, ev->requestor,
+			property, ev->target, 8, data.size, data.data);
+		return property;
+	}
+
+	// Too large for a single request, use the INCR protocol.
+	// We have to see when the requestor deleted the property. Select
+	// the events before setting the property so we can't miss it.
+	if(ev->requestor != dpy->dummy_window) {
+		uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE |
+			XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+		xcb_change_window_attributes(dpy->conn, ev->requestor,
+			XCB_CW_EVENT_MASK, &mask);
+	}
+
+	uint32_t size = data.size > UINT32_MAX ? UINT32_MAX : data.size;
+	xcb_change_property(dpy->conn, XCB_PROP_MODE_REPLACE, ev->requestor,
+		property, dpy->atoms.incr, 32, 1, &size);
+
+	struct swa_x11_selection_transfer* transfer = calloc(1, sizeof(*transfer));
+	transfer->requestor = ev->requestor;
+	transfer->property = property;
+	transfer->target = ev->target;
+	transfer->data = data;
+	transfer->next = source->transfers;
+	source->transfers = transfer;
+	return property;
+}
+
+static void handle_selection_request(struct swa_display_x11* dpy,
+		const xcb_selection_request_event_t* ev) {
+	// obsolete clients don't specify a property
+	xcb_atom_t property = ev->property == XCB_ATOM_NONE ?
+		ev->target : ev->property;
+
+	xcb_selection_notify_event_t notify = {0};
+	notify.response_type = XCB_SELECTION_NOTIFY;
+	notify.time = ev->time;
+	notify.requestor = ev->requestor;
+	notify.selection = ev->selection;
+	notify.target = ev->target;
+	notify.property = XCB_ATOM_NONE;
+
+	struct swa_data_source_x11* source = dpy->selection.source;
+	if(source && source->selection == ev->selection &&
+			ev->owner == dpy->dummy_window) {
+		notify.property = convert_selection(source, ev, property);
+	}
+
+	xcb_send_event(dpy->conn, false, ev->requestor, XCB_EVENT_MASK_NO_EVENT,
+		(const char*) &notify);
+	request_flush(dpy);
+}
+
+static void handle_property_notify(struct swa_display_x11* dpy,
+		const xcb_property_notify_event_t* ev) {
+	struct swa_window_x11* win;
+	if(ev->atom == dpy->ewmh._NET_WM_STATE &&
+			(win = find_window(dpy, ev->window))) {
+		handle_wm_state(win, ev->state == XCB_PROPERTY_DELETE);
+		return;
+	}
+
+	// incoming INCR chunk
+	struct swa_data_offer_x11* offer = dpy->selection.offer;
+	if(ev->window == dpy->dummy_window &&
+			ev->atom == dpy->atoms.swa_selection &&
+			ev->state == XCB_PROPERTY_NEW_VALUE &&
+			offer && offer->data.incr) {
+		handle_incr_chunk(offer);
+		return;
+	}
+
+	// requestor deleted the last chunk of an outgoing INCR transfer
+	if(ev->state != XCB_PROPERTY_DELETE) {
+		return;
+	}
+
+	for(struct swa_data_source_x11* s = dpy->selection.sources; s; s = s->next) {
+		for(struct swa_x11_selection_transfer* t = s->transfers; t; t = t->next) {
+			if(t->requestor == ev->window && t->property == ev->atom) {
+				if(!write_incr_chunk(dpy, t)) {
+					selection_transfer_destroy(s, t, true);
+					data_source_check_finished(s);
+				}
+
+				request_flush(dpy);
+				return;
+			}
+		}
 	}
 }
 
-static bool init_keymap(struct swa_display_x11* dpy) {
-	int flags = XKB_KEYMAP_COMPILE_NO_FLAGS;
-	int32_t dev = dpy->keyboard.device_id;
+// Drops all outgoing transfers to the given (destroyed) window.
+static void drop_selection_transfers(struct swa_display_x11* dpy,
+		xcb_window_t window) {
+	struct swa_data_source_x11* s = dpy->selection.sources;
+	while(s) {
+		struct swa_data_source_x11* next = s->next;
+		struct swa_x11_selection_transfer* t = s->transfers;
+		while(t) {
+			struct swa_x11_selection_transfer* next_t = t->next;
+			if(t->requestor == window) {
+				selection_transfer_destroy(s, t, false);
+			}
+			t = next_t;
+		}
 
-	struct xkb_keymap* keymap = xkb_x11_keymap_new_from_device(
-		dpy->keyboard.xkb.context, dpy->conn, dev, flags);
-	if(!keymap) {
-		dlg_error("xkb_x11_keymap_new_from_device failed");
-		return false;
+		data_source_check_finished(s);
+		s = next;
 	}
+}
 
-	struct xkb_state* state = xkb_x11_state_new_from_device(keymap,
-		dpy->conn, dev);
-	if(!state) {
-		dlg_error("xkb_x11_state_new_from_device failed");
-		return false;
+static void display_destroy(struct swa_display* base) {
+	struct swa_display_x11* dpy = get_display_x11(base);
+	if(!dpy->conn) {
+		free(dpy);
+		return;
 	}
 
-	struct swa_xkb_context* xkb = &dpy->keyboard.xkb;
-	if(xkb->keymap) xkb_keymap_unref(xkb->keymap);
-	if(xkb->state) xkb_state_unref(xkb->state);
-	xkb->keymap = keymap;
-	xkb->state = state;
-	return true;
+	dlg_assertm(!dpy->window_list, "Still windows left");
+	if(dpy->selection.offer) {
+		data_offer_destroy(&dpy->selection.offer->base);
+	}
+	while(dpy->selection.sources) {
+		struct swa_data_source_x11* source = dpy->selection.sources;
+		while(source->transfers) {
+			selection_transfer_destroy(source, source->transfers, false);
+		}
+		data_source_destroy(source);
+	}
+
+	dlg_assert(dpy->conn || !dpy->cursors.count);
+	for(unsigned i = 0u; i < dpy->visuals.n_colormaps; ++i) {
+		xcb_free_colormap(dpy->conn, dpy->visuals.colormaps[i].colormap);
+	}
+	free(dpy->visuals.colormaps);
+	free(dpy->visuals.choices);
+	free(dpy->window_map.slots);
+	swa_cursor_cache_finish(&dpy->cursors);
+#ifdef SWA_WITH_XCB_CURSOR
+	if(dpy->cursor_context) xcb_cursor_context_free(dpy->cursor_context);
+#endif
+	swa_timer_queue_finish(&dpy->timers);
+	swa_xkb_finish(&dpy->keyboard.xkb);
+	if(dpy->next_event) free(dpy->next_event);
+	xcb_ewmh_connection_wipe(&dpy->ewmh);
+
+#ifdef SWA_WITH_GL
+	// might reference the xlib display
+	if(dpy->egl) swa_egl_display_destroy(dpy->egl);
+#endif
+
+#ifdef SWA_WITH_XCB_CURSOR
+	// frees the render format cache kept for the connection
+	xcb_render_util_disconnect(dpy->conn);
+#endif
+
+	// when the connection was retrieved from the xlib display,
+	// it is destroyed with it
+	xcb_flush(dpy->conn);
+	if(!dpy->xlib_conn) xcb_disconnect(dpy->conn);
+	if(dpy->display) XCloseDisplay(dpy->display);
+	free(dpy);
 }
 
 static void handle_event(struct swa_display_x11* dpy,
@@ -808,8 +2096,8 @@ static void handle_event(struct swa_display_x11* dpy,
 					win->present.redraw = true;
 				} else {
 					win->present.redraw = false;
-					dlg_assert(win->visualtype);
-					win->base.listener->draw(&win->base);
+					undefer_draw(win); // drawing now anyways
+					emit_draw(win);
 				}
 			}
 		}
@@ -846,6 +2134,63 @@ static void handle_event(struct swa_display_x11* dpy,
 			}
 		}
 		break;
+	} case XCB_SELECTION_NOTIFY: {
+		xcb_selection_notify_event_t* notify =
+			(xcb_selection_notify_event_t*) ev;
+		struct swa_data_offer_x11* offer = dpy->selection.offer;
+		if(!offer || notify->requestor != dpy->dummy_window ||
+				notify->selection != offer->selection) {
+			break;
+		}
+
+		if(notify->target == dpy->atoms.targets) {
+			if(offer->formats_handler) {
+				handle_targets_notify(offer, notify);
+			}
+		} else if(offer->data.handler || offer->data.stream) {
+			handle_data_notify(offer, notify);
+		}
+		break;
+	} case XCB_SELECTION_REQUEST: {
+		handle_selection_request(dpy, (xcb_selection_request_event_t*) ev);
+		break;
+	} case XCB_SELECTION_CLEAR: {
+		xcb_selection_clear_event_t* clear = (xcb_selection_clear_event_t*) ev;
+		struct swa_data_source_x11* source = dpy->selection.source;
+		if(source && clear->owner == dpy->dummy_window &&
+				clear->selection == source->selection) {
+			data_source_lost(source);
+		}
+		break;
+	} case XCB_PROPERTY_NOTIFY: {
+		handle_property_notify(dpy, (xcb_property_notify_event_t*) ev);
+		break;
+	} case XCB_MAP_NOTIFY: {
+		xcb_map_notify_event_t* map = (xcb_map_notify_event_t*) ev;
+		if((win = find_window(dpy, map->window))) {
+			win->visibility.mapped = true;
+			update_visibility(win);
+		}
+		break;
+	} case XCB_UNMAP_NOTIFY: {
+		xcb_unmap_notify_event_t* unmap = (xcb_unmap_notify_event_t*) ev;
+		if((win = find_window(dpy, unmap->window))) {
+			win->visibility.mapped = false;
+			update_visibility(win);
+		}
+		break;
+	} case XCB_VISIBILITY_NOTIFY: {
+		xcb_visibility_notify_event_t* vis = (xcb_visibility_notify_event_t*) ev;
+		if((win = find_window(dpy, vis->window))) {
+			win->visibility.obscured =
+				vis->state == XCB_VISIBILITY_FULLY_OBSCURED;
+			update_visibility(win);
+		}
+		break;
+	} case XCB_DESTROY_NOTIFY: {
+		xcb_destroy_notify_event_t* destroy = (xcb_destroy_notify_event_t*) ev;
+		drop_selection_transfers(dpy, destroy->window);
+		break;
 	} case XCB_MOTION_NOTIFY: {
 		xcb_motion_notify_event_t* motion = (xcb_motion_notify_event_t*) ev;
 		if((win = find_window(dpy, motion->event))) {
@@ -859,6 +2204,7 @@ static void handle_event(struct swa_display_x11* dpy,
 				lev.y = motion->event_y;
 				lev.dx = lev.x - dpy->mouse.x;
 				lev.dy = lev.y - dpy->mouse.y;
+				lev.time_usec = swa_event_time_usec(motion->time);
 				win->base.listener->mouse_move(&win->base, &lev);
 			}
 			dpy->mouse.x = motion->event_x;
@@ -878,6 +2224,10 @@ static void handle_event(struct swa_display_x11* dpy,
 				&sx, &sy);
 			dpy->mouse.button_states |= (1ul << (unsigned) button);
 
+			// we might not receive motion events for this window
+			dpy->mouse.x = bev->event_x;
+			dpy->mouse.y = bev->event_y;
+
 			if((sx != 0.f || sy != 0.f) && win->base.listener->mouse_wheel) {
 				win->base.listener->mouse_wheel(&win->base, sx, sy);
 			} else if(button != swa_mouse_button_none &&
@@ -889,6 +2239,7 @@ static void handle_event(struct swa_display_x11* dpy,
 				lev.pressed = true;
 				lev.x = bev->event_x;
 				lev.y = bev->event_y;
+				lev.time_usec = swa_event_time_usec(bev->time);
 				win->base.listener->mouse_button(&win->base, &lev);
 				dpy->mouse.button = 0;
 			}
@@ -916,6 +2267,7 @@ static void handle_event(struct swa_display_x11* dpy,
 				lev.pressed = false;
 				lev.x = bev->event_x;
 				lev.y = bev->event_y;
+				lev.time_usec = swa_event_time_usec(bev->time);
 				win->base.listener->mouse_button(&win->base, &lev);
 				dpy->mouse.button = 0;
 			}
@@ -932,6 +2284,8 @@ static void handle_event(struct swa_display_x11* dpy,
 		// dlg_assert(!dpy->mouse.over);
 		if((win = find_window(dpy, eev->event))) {
 			dpy->mouse.over = win;
+			dpy->mouse.x = eev->event_x;
+			dpy->mouse.y = eev->event_y;
 			if(win->base.listener->mouse_cross) {
 				struct swa_mouse_cross_event lev;
 				lev.entered = true;
@@ -1005,9 +2359,10 @@ static void handle_event(struct swa_display_x11* dpy,
 		unsigned bit = key % 64;
 		dpy->keyboard.key_states[idx] |= ((uint64_t) 1) << bit;
 
-		char* utf8 = NULL;
+		char buf[SWA_XKB_TEXT_SIZE];
 		bool canceled;
-		swa_xkb_key(&dpy->keyboard.xkb, kev->detail, &utf8, &canceled);
+		const char* utf8 = swa_xkb_key(&dpy->keyboard.xkb, kev->detail,
+			buf, &canceled);
 
 		// dlg_assert(win == dpy->keyboard.focus);
 		if(win->base.listener->key) {
@@ -1017,11 +2372,11 @@ static void handle_event(struct swa_display_x11* dpy,
 				.utf8 = utf8,
 				.repeated = dpy->keyboard.repeated,
 				.modifiers = swa_xkb_modifiers(&dpy->keyboard.xkb),
+				.time_usec = swa_event_time_usec(kev->time),
 			};
 			win->base.listener->key(&win->base, &lev);
 		}
 
-		free(utf8);
 		dpy->keyboard.repeated = false;
 		break;
 	}
@@ -1031,7 +2386,12 @@ static void handle_event(struct swa_display_x11* dpy,
 			break;
 		}
 
-		// check for repeat
+		// check for repeat. The lookahead only contains already
+		// read events, the paired press might still be in the socket
+		if(!dpy->next_event) {
+			dpy->next_event = xcb_poll_for_event(dpy->conn);
+		}
+
 		struct xcb_key_press_event_t* kp =
 			(struct xcb_key_press_event_t*) dpy->next_event;
 		if(kp && (kp->response_type & ~0x80) == XCB_KEY_PRESS) {
@@ -1056,6 +2416,7 @@ static void handle_event(struct swa_display_x11* dpy,
 				.utf8 = NULL,
 				.repeated = false,
 				.modifiers = swa_xkb_modifiers(&dpy->keyboard.xkb),
+				.time_usec = swa_event_time_usec(kev->time),
 			};
 			win->base.listener->key(&win->base, &lev);
 		}
@@ -1070,16 +2431,22 @@ static void handle_event(struct swa_display_x11* dpy,
 
 		break;
 	} case 0u: {
-		xcb_generic_error_t* eev = (xcb_generic_error_t*) ev;
-		int code = eev->error_code;
-		char buf[256];
-		XGetErrorText(dpy->display, code, buf, sizeof(buf));
-		dlg_error("retrieved x11 error code: %s (%d)", buf, code);
+		handle_async_error(dpy, (const xcb_generic_error_t*) ev);
 		break;
 	} default:
 		break;
 	}
 
+	if(dpy->ext.xfixes && type == dpy->ext.xfixes + XCB_XFIXES_SELECTION_NOTIFY) {
+		// the selection changed, the current offer is outdated
+		xcb_xfixes_selection_notify_event_t* notify =
+			(xcb_xfixes_selection_notify_event_t*) ev;
+		struct swa_data_offer_x11* offer = dpy->selection.offer;
+		if(offer && notify->selection == offer->selection) {
+			data_offer_destroy(&offer->base);
+		}
+	}
+
 	if(dpy->ext.xkb && ev->response_type == dpy->ext.xkb) {
 		union xkb_event {
 			struct {
@@ -1142,7 +2509,39 @@ static bool check_error(struct swa_display_x11* dpy) {
 	return dpy->error = true;
 }
 
-static bool display_dispatch(struct swa_display* base, bool block) {
+// Waits for the next event until the given CLOCK_MONOTONIC timepoint
+// (in nanoseconds). Returns NULL if there was none until then or
+// if there was a connection error.
+static xcb_generic_event_t* wait_for_event_until(struct swa_display_x11* dpy,
+		int64_t deadline) {
+	struct pollfd pfd = {
+		.fd = xcb_get_file_descriptor(dpy->conn),
+		.events = POLLIN,
+	};
+
+	while(true) {
+		// xcb might have already read events from the connection,
+		// e.g. while waiting for a reply, so always check first
+		xcb_generic_event_t* event = xcb_poll_for_event(dpy->conn);
+		if(event || xcb_connection_has_error(dpy->conn)) {
+			return event;
+		}
+
+		int64_t now = swa_monotonic_ns();
+		if(now >= deadline) {
+			return NULL;
+		}
+
+		int timeout = swa_timeout_ns_to_ms(deadline - now);
+		if(poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+			dlg_error("poll: %s (%d)", strerror(errno), errno);
+			return NULL;
+		}
+	}
+}
+
+static bool display_dispatch_timeout(struct swa_display* base,
+		int64_t timeout_ns) {
 	struct swa_display_x11* dpy = get_display_x11(base);
 	if(check_error(dpy)) {
 		return false;
@@ -1153,33 +2552,70 @@ static bool display_dispatch(struct swa_display* base, bool block) {
 	// in some cases, e.g. the only way to determine whether
 	// a key press is a repeat
 
-	xcb_flush(dpy->conn);
-	if(block && !dpy->next_event) {
+	// never block when there are draw events to emit
+	if(dpy->deferred_draws.first) {
+		timeout_ns = 0;
+	}
+
+	// with the explicit flush policy we only flush when we
+	// have to wait for events below
+	int64_t timers = swa_timer_queue_next(&dpy->timers);
+	bool wait = !dpy->next_event && timeout_ns != 0;
+	if(dpy->base.flush_policy != swa_flush_policy_explicit || wait) {
+		xcb_flush(dpy->conn);
+	}
+
+	if(timeout_ns < 0 && timers < 0 && !dpy->next_event) {
 		dpy->next_event = xcb_wait_for_event(dpy->conn);
 		if(!dpy->next_event) {
 			dlg_warn("xcb_wait_for_event failed");
 			return !check_error(dpy);
 		}
+	} else if((timeout_ns != 0 || timers >= 0) && !dpy->next_event) {
+		// wait until the given timeout elapsed or the next timer
+		// has to be dispatched, whatever comes first
+		int64_t now = swa_monotonic_ns();
+		int64_t deadline = timeout_ns < 0 ? INT64_MAX : now + timeout_ns;
+		if(timers >= 0 && timers < deadline) {
+			deadline = timers;
+		}
+
+		dpy->next_event = wait_for_event_until(dpy, deadline);
 	}
 
 	while(true) {
-		xcb_generic_event_t* event;
-		if(dpy->next_event) {
-			event = dpy->next_event;
-			dpy->next_event = NULL;
-		} else if(!(event = xcb_poll_for_event(dpy->conn))) {
+		xcb_generic_event_t* event = dpy->next_event;
+		dpy->next_event = NULL;
+
+		// Only go back to the socket once all events that xcb already
+		// read were handled. A single read usually gets many events.
+		if(!event && !(event = xcb_poll_for_event(dpy->conn))) {
 			break;
 		}
 
-		dpy->next_event = xcb_poll_for_event(dpy->conn);
+		dpy->next_event = xcb_poll_for_queued_event(dpy->conn);
 		handle_event(dpy, event);
-		xcb_flush(dpy->conn);
 		free(event);
 	}
 
+	swa_timer_queue_dispatch(&dpy->timers, swa_monotonic_ns());
+	dispatch_deferred_draws(dpy);
+	if(dpy->base.flush_policy != swa_flush_policy_explicit) {
+		xcb_flush(dpy->conn);
+	}
+
 	return !check_error(dpy);
 }
 
+static bool display_dispatch(struct swa_display* base, bool block) {
+	return display_dispatch_timeout(base, block ? -1 : 0);
+}
+
+static void display_flush(struct swa_display* base) {
+	struct swa_display_x11* dpy = get_display_x11(base);
+	xcb_flush(dpy->conn);
+}
+
 // We can implement this function simply using an xserver roundtrip
 // and xcb since the library is threadsafe by design.
 // Would be slightly more efficient using an eventfd and a custom
@@ -1212,11 +2648,12 @@ static enum swa_display_cap display_capabilities(struct swa_display* base) {
 		swa_display_cap_server_decoration |
 		swa_display_cap_keyboard |
 		swa_display_cap_mouse |
-		// TODO: implement data exchange
+		// TODO: implement dnd
 		// swa_display_cap_dnd |
-		// swa_display_cap_clipboard |
+		swa_display_cap_clipboard |
 		swa_display_cap_buffer_surface |
-		swa_display_cap_child_windows;
+		swa_display_cap_child_windows |
+		swa_display_cap_timers;
 	if(dpy->ext.xinput) caps |= swa_display_cap_touch;
 	return caps;
 }
@@ -1278,14 +2715,72 @@ static struct swa_window* display_get_mouse_over(struct swa_display* base) {
 	struct swa_display_x11* dpy = get_display_x11(base);
 	return dpy->mouse.over ? &dpy->mouse.over->base : NULL;
 }
+static xcb_window_t get_selection_owner(struct swa_display_x11* dpy,
+		xcb_atom_t selection) {
+	xcb_generic_error_t* err = NULL;
+	xcb_get_selection_owner_cookie_t cookie =
+		xcb_get_selection_owner(dpy->conn, selection);
+	xcb_get_selection_owner_reply_t* reply =
+		xcb_get_selection_owner_reply(dpy->conn, cookie, &err);
+	if(!reply) {
+		handle_error(dpy, err, "xcb_get_selection_owner");
+		return XCB_NONE;
+	}
+
+	xcb_window_t owner = reply->owner;
+	free(reply);
+	return owner;
+}
+
+// With xfixes, the offer is destroyed when the clipboard changes and
+// can otherwise be reused (keeping its cache). Without it, there is no
+// notification so every call creates a new offer. The previous one is
+// destroyed then, cancelling pending requests on it.
 static struct swa_data_offer* display_get_clipboard(struct swa_display* base) {
-	// struct swa_display_x11* dpy = get_display_x11(base);
-	return NULL;
+	struct swa_display_x11* dpy = get_display_x11(base);
+	if(dpy->selection.offer && dpy->ext.xfixes) {
+		return &dpy->selection.offer->base;
+	} else if(dpy->selection.offer) {
+		data_offer_destroy(&dpy->selection.offer->base);
+	}
+
+	xcb_window_t owner = get_selection_owner(dpy, dpy->atoms.clipboard);
+	if(owner == XCB_NONE) {
+		return NULL;
+	}
+
+	struct swa_data_offer_x11* offer = calloc(1, sizeof(*offer));
+	offer->base.impl = &data_offer_impl;
+	offer->dpy = dpy;
+	offer->selection = dpy->atoms.clipboard;
+	offer->owner = owner;
+	dpy->selection.offer = offer;
+	return &offer->base;
 }
+
 static bool display_set_clipboard(struct swa_display* base,
 		struct swa_data_source* source) {
-	// struct swa_display_x11* dpy = get_display_x11(base);
-	return false;
+	struct swa_display_x11* dpy = get_display_x11(base);
+	xcb_atom_t selection = dpy->atoms.clipboard;
+	struct swa_data_source_x11* wrapper =
+		data_source_create(dpy, source, selection);
+
+	// The server doesn't send a selection clear event if the
+	// owner window stays the same.
+	if(dpy->selection.source) {
+		data_source_lost(dpy->selection.source);
+	}
+
+	xcb_set_selection_owner(dpy->conn, dpy->dummy_window, selection,
+		XCB_CURRENT_TIME);
+	if(get_selection_owner(dpy, selection) != dpy->dummy_window) {
+		dlg_warn("Failed to acquire clipboard ownership");
+		data_source_lost(wrapper);
+		return false;
+	}
+
+	dpy->selection.source = wrapper;
+	return true;
 }
 static bool display_start_dnd(struct swa_display* base,
 		struct swa_data_source* source) {
@@ -1355,11 +2850,10 @@ static enum swa_image_format visual_to_format(const xcb_visualtype_t* v,
 	return swa_image_format_none;
 }
 
-// Returns the score of the visual.
+// Returns the score of the visual for the given visual choice key.
 // If the score is negative, the visual is already perfect.
-static int rate_visual(struct swa_display_x11* dpy,
-		const struct swa_window_settings* settings, xcb_visualtype_t* visual,
-		enum swa_image_format format, unsigned depth) {
+static int rate_visual(const struct swa_x11_visual_choice* key,
+		xcb_visualtype_t* visual, enum swa_image_format format, unsigned depth) {
 	int s = 1; // baseline
 	bool perfect = true;
 	if(visual->_class == XCB_VISUAL_CLASS_DIRECT_COLOR ||
@@ -1371,14 +2865,13 @@ static int rate_visual(struct swa_display_x11* dpy,
 
 	bool known_format = format != swa_image_format_none;
 	if(known_format) {
-		if(settings->surface == swa_surface_buffer) {
+		if(key->buffer) {
 			s += (1 << 3);
-			enum swa_image_format pref =
-				settings->surface_settings.buffer.preferred_format;
+			enum swa_image_format pref = key->preferred_format;
 			if(format == pref) {
 				s += (1 << 5);
 				dlg_assertlm(dlg_level_warn,
-					settings->transparent == (depth == 32),
+					key->transparent == (depth == 32),
 					"Preferred buffer format and 'transparent' don't match");
 			} else if(pref != swa_image_format_none) {
 				perfect = false;
@@ -1390,7 +2883,7 @@ static int rate_visual(struct swa_display_x11* dpy,
 		perfect = false;
 	}
 
-	if(settings->transparent == (depth == 32)) {
+	if(key->transparent == (depth == 32)) {
 		s += (1 << 2);
 	} else {
 		perfect = false;
@@ -1399,10 +2892,9 @@ static int rate_visual(struct swa_display_x11* dpy,
 	return perfect ? -s : s;
 }
 
-static void find_visual(struct swa_window_x11* win,
-		const struct swa_window_settings* settings,
-		unsigned* scanline_pad, enum swa_image_format* format) {
-	struct swa_display_x11* dpy = win->dpy;
+// Fills the visual related fields of the given choice, based on its key.
+static void find_visual(struct swa_display_x11* dpy,
+		struct swa_x11_visual_choice* choice) {
 	xcb_depth_iterator_t di = xcb_screen_allowed_depths_iterator(dpy->screen);
 
 	const xcb_setup_t* setup = xcb_get_setup(dpy->conn);
@@ -1433,23 +2925,18 @@ static void find_visual(struct swa_window_x11* win,
 		unsigned bpp = formats[fmt].bits_per_pixel;
 		for(; vi.rem; xcb_visualtype_next(&vi)) {
 			enum swa_image_format fmti = visual_to_format(vi.data, depth, bpp);
-			int score = rate_visual(dpy, settings, vi.data, fmti, depth);
-			if(score < 0) { // perfect visual
-				*scanline_pad = formats[fmt].scanline_pad;
-				*format = fmti;
-				win->visualtype = vi.data;
-				win->depth = depth;
+			int score = rate_visual(choice, vi.data, fmti, depth);
+			if(score < 0 || score > best) {
+				choice->scanline_pad = formats[fmt].scanline_pad;
+				choice->format = fmti;
+				choice->visualtype = vi.data;
+				choice->depth = depth;
 				best = score;
-				done = true;
-				break;
 			}
 
-			if(score > best) {
-				*scanline_pad = formats[fmt].scanline_pad;
-				*format = fmti;
-				win->visualtype = vi.data;
-				win->depth = depth;
-				best = score;
+			if(score < 0) { // perfect visual
+				done = true;
+				break;
 			}
 		}
 
@@ -1459,6 +2946,45 @@ static void find_visual(struct swa_window_x11* win,
 	}
 }
 
+// Returns the visual to use for a window with the given settings.
+// The result of find_visual is cached per display since iterating all
+// visuals (and rating them) is wasted work for every window after the first.
+// The returned pointer is only valid until the next call.
+static const struct swa_x11_visual_choice* get_visual(
+		struct swa_display_x11* dpy, const struct swa_window_settings* settings) {
+	struct swa_x11_visual_choice key = {0};
+	key.buffer = settings->surface == swa_surface_buffer;
+	key.transparent = settings->transparent;
+	if(key.buffer) {
+		key.preferred_format = settings->surface_settings.buffer.preferred_format;
+	}
+
+	for(unsigned i = 0u; i < dpy->visuals.n_choices; ++i) {
+		struct swa_x11_visual_choice* choice = &dpy->visuals.choices[i];
+		if(choice->buffer == key.buffer &&
+				choice->transparent == key.transparent &&
+				choice->preferred_format == key.preferred_format) {
+			return choice;
+		}
+	}
+
+	unsigned count = dpy->visuals.n_choices + 1;
+	struct swa_x11_visual_choice* choices = realloc(dpy->visuals.choices,
+		count * sizeof(*choices));
+	if(!choices) {
+		dlg_error("failed to allocate visual cache entry");
+		return NULL;
+	}
+
+	struct swa_x11_visual_choice* choice = &choices[count - 1];
+	*choice = key;
+	find_visual(dpy, choice);
+
+	dpy->visuals.choices = choices;
+	dpy->visuals.n_choices = count;
+	return choice;
+}
+
 static swa_proc display_get_gl_proc_addr(struct swa_display* base,
 		const char* name) {
 #ifdef SWA_WITH_GL
@@ -1469,6 +2995,45 @@ static swa_proc display_get_gl_proc_addr(struct swa_display* base,
 #endif
 }
 
+static struct swa_timer* display_add_timer(struct swa_display* base,
+		int64_t deadline, swa_timer_handler handler, void* userdata) {
+	struct swa_display_x11* dpy = get_display_x11(base);
+	// no update callback needed, display_dispatch_timeout queries
+	// the next timer before it waits
+	return swa_timer_create(&dpy->timers, deadline, handler, userdata);
+}
+
+#ifdef SWA_WITH_GL
+// Prefers egl's xcb platform, so that we don't need xlib.
+// Otherwise falls back to the xlib platform.
+static struct swa_egl_display* create_egl_display(struct swa_display_x11* dpy) {
+	// when we already have the xlib display our connection is from,
+	// there is no reason to prefer xcb
+	const char* exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if(!dpy->xlib_conn && exts &&
+			swa_egl_find_ext(exts, "EGL_EXT_platform_xcb")) {
+		// NOTE: without EGL_PLATFORM_XCB_SCREEN_EXT, the default screen
+		// is used, we do the same
+		struct swa_egl_display* egl =
+			swa_egl_display_create(EGL_PLATFORM_XCB_EXT, dpy->conn);
+		if(egl) {
+			dpy->egl_xcb = true;
+			return egl;
+		}
+
+		dlg_warn("Creating xcb egl display failed, trying xlib");
+	}
+
+	Display* display = xlib_display(dpy);
+	if(!display) {
+		return NULL;
+	}
+
+	dpy->egl_xcb = false;
+	return swa_egl_display_create(EGL_PLATFORM_X11_EXT, display);
+}
+#endif // SWA_WITH_GL
+
 static struct swa_window* display_create_window(struct swa_display* base,
 		const struct swa_window_settings* settings) {
 	struct swa_display_x11* dpy = get_display_x11(base);
@@ -1514,8 +3079,7 @@ static struct swa_window* display_create_window(struct swa_display* base,
 	if(settings->surface == swa_surface_gl) {
 #ifdef SWA_WITH_GL
 		if(!dpy->egl) {
-			dpy->egl = swa_egl_display_create(EGL_PLATFORM_X11_EXT,
-				dpy->display);
+			dpy->egl = create_egl_display(dpy);
 			if(!dpy->egl) {
 				goto error;
 			}
@@ -1553,13 +3117,19 @@ static struct swa_window* display_create_window(struct swa_display* base,
 		goto error;
 #endif
 	} else if(!input_only) {
-		find_visual(win, settings, &visual_scanline_pad, &visual_format);
+		const struct swa_x11_visual_choice* choice = get_visual(dpy, settings);
+		if(choice) {
+			visual_scanline_pad = choice->scanline_pad;
+			visual_format = choice->format;
+			win->visualtype = choice->visualtype;
+			win->depth = choice->depth;
+		}
 	}
 
 	if(!input_only) {
 		if(!win->visualtype) {
 			dlg_error("Could not find valid visual");
-			return false;
+			goto error;
 		}
 
 		dlg_debug("visualid: %d, depth: %d", win->visualtype->visual_id,
@@ -1585,17 +3155,13 @@ static struct swa_window* display_create_window(struct swa_display* base,
 	uint32_t vid = 0;
 	if(!input_only) {
 		vid = win->visualtype->visual_id;
-		win->colormap = xcb_generate_id(dpy->conn);
-		xcb_create_colormap(dpy->conn, XCB_COLORMAP_ALLOC_NONE, win->colormap,
-			dpy->screen->root, win->visualtype->visual_id);
+		win->colormap = acquire_colormap(dpy, vid);
+		if(!win->colormap) {
+			goto error;
+		}
 	}
 
-	uint32_t eventmask =
-		XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY |
-		XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE |
-		XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE |
-		XCB_EVENT_MASK_ENTER_WINDOW | XCB_EVENT_MASK_LEAVE_WINDOW |
-		XCB_EVENT_MASK_POINTER_MOTION | XCB_EVENT_MASK_FOCUS_CHANGE;
+	uint32_t eventmask = listener_event_mask(settings->listener);
 
 	// Setting the background pixel here may introduce flicker but may fix issues
 	// with creating opengl windows. To get the default (parent) cursor
@@ -1617,13 +3183,10 @@ static struct swa_window* display_create_window(struct swa_display* base,
 	}
 
 	win->window = xcb_generate_id(dpy->conn);
-	xcb_void_cookie_t cookie = xcb_create_window_checked(dpy->conn, win->depth,
-		win->window, xparent, x, y, win->width, win->height, 0,
-		window_class, vid,
-		valuemask, valuelist);
-	xcb_generic_error_t* err = xcb_request_check(dpy->conn, cookie);
-	if(err) {
-		handle_error(dpy, err, "xcb_create_window");
+	window_map_insert(&dpy->window_map, win);
+	if(!x11_request(dpy, "xcb_create_window", xcb_create_window,
+			win->depth, win->window, xparent, x, y, win->width, win->height,
+			0, window_class, vid, valuemask, valuelist)) {
 		goto error;
 	}
 
@@ -1655,24 +3218,8 @@ static struct swa_window* display_create_window(struct swa_display* base,
 
 	// register for touch xinput events
 	// we only need touch events if the window listener implements it
-	struct {
-		xcb_input_event_mask_t info;
-		xcb_input_xi_event_mask_t events;
-	} mask;
-
-	// NOTE: not sure how to test this but we might want to listen
-	// for TOUCH_OWNERSHIP events. See
-	// https://lwn.net/Articles/475886/
-	// https://lwn.net/Articles/485484/
-	const struct swa_window_listener* l = win->base.listener;
-	mask.info.deviceid = XCB_INPUT_DEVICE_ALL_MASTER; // or ALL?
-	mask.info.mask_len = sizeof(mask.events) / sizeof(uint32_t);
-	mask.events =
-		(l->touch_begin ? XCB_INPUT_XI_EVENT_MASK_TOUCH_BEGIN : 0) |
-		(l->touch_end ? XCB_INPUT_XI_EVENT_MASK_TOUCH_END : 0) |
-		(l->touch_update ? XCB_INPUT_XI_EVENT_MASK_TOUCH_UPDATE : 0);
-	if(mask.events) {
-		xcb_input_xi_select_events(win->dpy->conn, win->window, 1, &mask.info);
+	if(dpy->ext.xinput) {
+		select_xi_events(win, false);
 	}
 
 	if(settings->client_decorate == swa_preference_yes) {
@@ -1703,6 +3250,11 @@ static struct swa_window* display_create_window(struct swa_display* base,
 		xcb_map_window(dpy->conn, win->window);
 	}
 
+	// We assume the window to be visible as soon as it is mapped,
+	// even before we get the MapNotify event.
+	win->visibility.mapped = !settings->hide;
+	win->visibility.visible = win->visibility.mapped;
+
 	// create surface
 	win->surface_type = settings->surface;
 	if(win->surface_type == swa_surface_buffer) {
@@ -1713,11 +3265,8 @@ static struct swa_window* display_create_window(struct swa_display* base,
 
 		win->buffer.gc = xcb_generate_id(dpy->conn);
 		uint32_t value[] = {0, 0};
-		xcb_void_cookie_t c = xcb_create_gc_checked(dpy->conn, win->buffer.gc,
-			win->window, XCB_GC_FOREGROUND, value);
-		xcb_generic_error_t* e = xcb_request_check(dpy->conn, c);
-		if(e) {
-			handle_error(dpy, e, "xcb_create_gc");
+		if(!x11_request(dpy, "xcb_create_gc", xcb_create_gc,
+				win->buffer.gc, win->window, XCB_GC_FOREGROUND, value)) {
 			goto error;
 		}
 
@@ -1726,7 +3275,10 @@ static struct swa_window* display_create_window(struct swa_display* base,
 		win->buffer.scanline_align = visual_scanline_pad / 8;
 	} else if(win->surface_type == swa_surface_gl) {
 #ifdef SWA_WITH_GL
-		if(!(win->gl.surface = swa_egl_create_surface(dpy->egl, &win->window,
+		// the native window type differs: xcb_window_t vs xlib's Window
+		Window xwin = win->window;
+		void* handle = dpy->egl_xcb ? (void*) &win->window : (void*) &xwin;
+		if(!(win->gl.surface = swa_egl_create_surface(dpy->egl, handle,
 				egl_config, settings->surface_settings.gl.srgb))) {
 			goto error;
 		}
@@ -1761,8 +3313,11 @@ static struct swa_window* display_create_window(struct swa_display* base,
 		if(x11_settings && x11_settings->vk_use_xlib) {
 			VkXlibSurfaceCreateInfoKHR info = {0};
 			info.sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR;
-			info.dpy = win->dpy->display;
+			info.dpy = xlib_display(win->dpy);
 			info.window = win->window;
+			if(!info.dpy) {
+				goto error;
+			}
 
 			PFN_vkCreateXlibSurfaceKHR fn = (PFN_vkCreateXlibSurfaceKHR)
 				fpGetProcAddr(instance, "vkCreateXlibSurfaceKHR");
@@ -1815,6 +3370,7 @@ error:
 static const struct swa_display_interface display_impl = {
 	.destroy = display_destroy,
 	.dispatch = display_dispatch,
+	.dispatch_timeout = display_dispatch_timeout,
 	.wakeup = display_wakeup,
 	.capabilities = display_capabilities,
 	.vk_extensions = display_vk_extensions,
@@ -1830,6 +3386,8 @@ static const struct swa_display_interface display_impl = {
 	.start_dnd = display_start_dnd,
 	.get_gl_proc_addr = display_get_gl_proc_addr,
 	.create_window = display_create_window,
+	.add_timer = display_add_timer,
+	.flush = display_flush,
 };
 
 bool swa_display_is_x11(struct swa_display* dpy) {
@@ -1843,7 +3401,7 @@ xcb_connection_t* swa_display_x11_connection(struct swa_display* base) {
 
 SWA_API uint32_t swa_window_x11_cursor(struct swa_window* base) {
 	struct swa_window_x11* win = get_window_x11(base);
-	return win->cursor;
+	return win->cursor ? win->cursor->id : 0u;
 }
 
 SWA_API const void* swa_display_x11_current_event(struct swa_display* base) {
@@ -1853,56 +3411,85 @@ SWA_API const void* swa_display_x11_current_event(struct swa_display* base) {
 
 struct swa_display* swa_display_x11_create(const char* appname) {
 	(void) appname;
+	int64_t start = swa_monotonic_ns();
+	int64_t timing = start;
 
-// #ifdef SWA_WITH_GL
-#if 1
-	// We start by opening a display since we need that for gl
-	// Neither egl nor glx support xcb. And since xlib is implemented
+#ifdef SWA_WITH_XCB_CURSOR
+	// We don't need xlib. It's only opened when needed, see xlib_display.
+	// This saves the startup time and memory of an xlib display.
+	xcb_connection_t* conn = xcb_connect(NULL, NULL);
+	if(xcb_connection_has_error(conn)) {
+		dlg_error("xcb_connect failed");
+		xcb_disconnect(conn);
+		return NULL;
+	}
+#else // SWA_WITH_XCB_CURSOR
+	// Fallback: xcursor needs an xlib display. Since xlib is implemented
 	// using xcb these days, we can get the xcb connection from the
 	// xlib display but not the other way around.
-	// We need multi threading since we implement display wakeup
-	// using an event sent from another thread.
 	XInitThreads();
 	Display* display = XOpenDisplay(NULL);
 	if(!display) {
 		return NULL;
 	}
-#else
-	xcb_connection_t* conn = xcb_connect(NULL, NULL);
-	if(!conn) {
-		return NULL;
-	}
-#endif // SWA_WITH_GL
+#endif // SWA_WITH_XCB_CURSOR
 
 	struct swa_display_x11* dpy = calloc(1, sizeof(*dpy));
 	dpy->base.impl = &display_impl;
+	dpy->cursors.destroy = destroy_cursor;
+	dpy->cursors.data = dpy;
 
-	// TODO: need XGetErrorText replacment without xlib...
-// #ifdef SWA_WITH_GL
-#if 1
+#ifdef SWA_WITH_XCB_CURSOR
+	dpy->conn = conn;
+#else // SWA_WITH_XCB_CURSOR
 	dpy->display = display;
 	dpy->conn = XGetXCBConnection(display);
+	dpy->xlib_conn = true;
 
 	// make sure we can retrieve events using xcb
 	XSetEventQueueOwner(dpy->display, XCBOwnsEventQueue);
-#else  // SWA_WITH_GL
-	dpy->conn = conn;
-#endif // SWA_WITH_GL
+#endif // SWA_WITH_XCB_CURSOR
 
 	dpy->screen = xcb_setup_roots_iterator(xcb_get_setup(dpy->conn)).data;
+	swa_log_elapsed(&timing, "x11 startup: connection");
 
-	// create dummy window used for selections and wakeup
+	// We need this information below. Prefetching it means that the
+	// server handles the extension queries together with the atom
+	// requests instead of a separate round trip for each extension.
+	xcb_prefetch_extension_data(dpy->conn, &xcb_input_id);
+	xcb_prefetch_extension_data(dpy->conn, &xcb_present_id);
+	xcb_prefetch_extension_data(dpy->conn, &xcb_shm_id);
+	xcb_prefetch_extension_data(dpy->conn, &xcb_xfixes_id);
+
+	const char* sync = getenv("SWA_X11_SYNC");
+	dpy->sync_requests = sync && *sync && strcmp(sync, "0") != 0;
+	if(dpy->sync_requests) {
+		dlg_info("SWA_X11_SYNC set: checking requests synchronously");
+	}
+
+	// create dummy window used for selections and wakeup.
+	// Selection data is received in properties on it.
+	uint32_t dummy_mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
 	dpy->dummy_window = xcb_generate_id(dpy->conn);
-	xcb_void_cookie_t cookie = xcb_create_window_checked(dpy->conn,
-		XCB_COPY_FROM_PARENT, dpy->dummy_window,
-		dpy->screen->root, 0, 0, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_ONLY,
-		XCB_COPY_FROM_PARENT, 0, NULL);
-	xcb_generic_error_t* err = xcb_request_check(dpy->conn, cookie);
-	if(err) {
-		handle_error(dpy, err, "xcb_create_window (dummy)");
+	if(!x11_request(dpy, "xcb_create_window (dummy)", xcb_create_window,
+			XCB_COPY_FROM_PARENT, dpy->dummy_window,
+			dpy->screen->root, 0, 0, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_ONLY,
+			XCB_COPY_FROM_PARENT, XCB_CW_EVENT_MASK, &dummy_mask)) {
 		goto err;
 	}
 
+	// Property changes larger than the maximum request size fail, we
+	// send anything larger incrementally. The length is given in
+	// 4-byte units and includes the 24 byte change_property header.
+	// Capped so that huge selections don't sit in the server at once.
+	uint32_t max_request = xcb_get_maximum_request_length(dpy->conn) * 4;
+	dpy->selection.chunk_size = max_request - 24;
+	if(dpy->selection.chunk_size > 1024 * 1024) {
+		dpy->selection.chunk_size = 1024 * 1024;
+	}
+
+	xcb_generic_error_t* err = NULL;
+
 	// load atoms
 	xcb_intern_atom_cookie_t* ewmh_cookie =
 		xcb_ewmh_init_atoms(dpy->conn, &dpy->ewmh);
@@ -1929,6 +3516,9 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 
 		{&dpy->atoms.clipboard, "CLIPBOARD", {0}},
 		{&dpy->atoms.targets, "TARGETS", {0}},
+		{&dpy->atoms.incr, "INCR", {0}},
+		{&dpy->atoms.swa_selection, "SWA_SELECTION", {0}},
+		{&dpy->atoms.swa_targets, "SWA_TARGETS", {0}},
 		{&dpy->atoms.text, "TEXT", {0}},
 		{&dpy->atoms.utf8_string, "UTF8_STRING", {0}},
 		{&dpy->atoms.file_name, "FILE_NAME", {0}},
@@ -1956,9 +3546,8 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 			*atoms[i].atom = reply->atom;
 			free(reply);
 		} else {
-			char buf[256];
-			XGetErrorText(dpy->display, err->error_code, buf, sizeof(buf));
-			dlg_warn("Failed to load atom %s: %s", atoms[i].name, buf);
+			dlg_warn("Failed to load atom %s: %s", atoms[i].name,
+				error_name(err->error_code));
 			free(err);
 		}
 	}
@@ -1968,6 +3557,8 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 		handle_error(dpy, err, "xcb_ewmh_init_atoms");
 	}
 
+	swa_log_elapsed(&timing, "x11 startup: atoms");
+
 	// read out supported ewmh stuff
 	xcb_get_property_cookie_t c = xcb_get_property(dpy->conn, false,
 		dpy->screen->root, dpy->ewmh._NET_SUPPORTED,
@@ -2012,21 +3603,44 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 	// since that's what other libraries seem to do. We might be fine
 	// with lower versions of the extensions
 
-	// check for xpresent extension support
-	const xcb_query_extension_reply_t* ext;
-	ext = xcb_get_extension_data(dpy->conn, &xcb_input_id);
-	if(ext && ext->present) {
-		xcb_input_xi_query_version_cookie_t c =
-			xcb_input_xi_query_version(dpy->conn, 2, 0);
+	// Again, we first send all version queries and only then wait
+	// for their replies.
+	const xcb_query_extension_reply_t* xinput_ext =
+		xcb_get_extension_data(dpy->conn, &xcb_input_id);
+	const xcb_query_extension_reply_t* present_ext =
+		xcb_get_extension_data(dpy->conn, &xcb_present_id);
+	const xcb_query_extension_reply_t* xfixes_ext =
+		xcb_get_extension_data(dpy->conn, &xcb_xfixes_id);
+	bool has_xinput = xinput_ext && xinput_ext->present;
+	bool has_present = present_ext && present_ext->present;
+	bool has_xfixes = xfixes_ext && xfixes_ext->present;
+
+	xcb_input_xi_query_version_cookie_t xinput_cookie = {0};
+	xcb_present_query_version_cookie_t present_cookie = {0};
+	if(has_xinput) {
+		xinput_cookie = xcb_input_xi_query_version(dpy->conn, 2, 0);
+	}
+	if(has_present) {
+		present_cookie = xcb_present_query_version(dpy->conn, 1, 2);
+	}
+	xcb_shm_query_version_cookie_t sc = xcb_shm_query_version(dpy->conn);
+	xcb_xfixes_query_version_cookie_t xfixes_cookie = {0};
+	if(has_xfixes) {
+		// required before using the extension
+		xfixes_cookie = xcb_xfixes_query_version(dpy->conn, 1, 0);
+	}
+
+	// check for xinput extension support
+	if(has_xinput) {
 		xcb_input_xi_query_version_reply_t* reply =
-			xcb_input_xi_query_version_reply(dpy->conn, c, &err);
+			xcb_input_xi_query_version_reply(dpy->conn, xinput_cookie, &err);
 		if(!reply) {
 			handle_error(dpy, err, "xcb_input_xi_query_version");
 		} else if(reply->major_version < 2) {
 			dlg_info("xinput version too low: %d.%d",
 				reply->major_version, reply->minor_version);
 		} else {
-			dpy->ext.xinput = ext->major_opcode;
+			dpy->ext.xinput = xinput_ext->major_opcode;
 		}
 		free(reply);
 	} else {
@@ -2034,19 +3648,16 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 	}
 
 	// check for present extension support
-	ext = xcb_get_extension_data(dpy->conn, &xcb_present_id);
-	if(ext && ext->present) {
-		xcb_present_query_version_cookie_t c =
-			xcb_present_query_version(dpy->conn, 1, 2);
+	if(has_present) {
 		xcb_present_query_version_reply_t* reply =
-			xcb_present_query_version_reply(dpy->conn, c, &err);
+			xcb_present_query_version_reply(dpy->conn, present_cookie, &err);
 		if(!reply) {
 			handle_error(dpy, err, "xcb_present_query_version");
 		} else if(reply->major_version < 1 || reply->minor_version < 2) {
 			dlg_info("xpresent version too low: %d.%d",
 				reply->major_version, reply->minor_version);
 		} else {
-			dpy->ext.xpresent = ext->major_opcode;
+			dpy->ext.xpresent = present_ext->major_opcode;
 		}
 		free(reply);
 	} else {
@@ -2054,7 +3665,6 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 	}
 
 	// check for shm extension support
-	xcb_shm_query_version_cookie_t sc = xcb_shm_query_version(dpy->conn);
 	xcb_shm_query_version_reply_t* sreply =
 		xcb_shm_query_version_reply(dpy->conn, sc, &err);
 	if(!sreply) {
@@ -2070,6 +3680,29 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 	}
 	free(sreply);
 
+	// check for xfixes extension support, used to get notified
+	// when the clipboard changes
+	if(has_xfixes) {
+		xcb_xfixes_query_version_reply_t* reply =
+			xcb_xfixes_query_version_reply(dpy->conn, xfixes_cookie, &err);
+		if(!reply) {
+			handle_error(dpy, err, "xcb_xfixes_query_version");
+		} else {
+			dpy->ext.xfixes = xfixes_ext->first_event;
+			uint32_t mask =
+				XCB_XFIXES_SELECTION_EVENT_MASK_SET_SELECTION_OWNER |
+				XCB_XFIXES_SELECTION_EVENT_MASK_SELECTION_WINDOW_DESTROY |
+				XCB_XFIXES_SELECTION_EVENT_MASK_SELECTION_CLIENT_CLOSE;
+			x11_request(dpy, "xcb_xfixes_select_selection_input",
+				xcb_xfixes_select_selection_input, dpy->dummy_window,
+				dpy->atoms.clipboard, mask);
+		}
+		free(reply);
+	} else {
+		dlg_info("xfixes not available, clipboard offers can't be reused");
+	}
+	swa_log_elapsed(&timing, "x11 startup: extensions");
+
 	// xkb: we require this extension for keyboard support
 	// NOTE: instead of erroring out, we could simply not report
 	// the keyboard capability
@@ -2128,18 +3761,15 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 	details.affectState = req_state_details;
 	details.stateDetails = req_state_details;
 
-	xcb_void_cookie_t xkbc = xcb_xkb_select_events_aux_checked(dpy->conn,
-		dpy->keyboard.device_id, req_events, 0, 0,
-		req_map_parts, req_map_parts, &details);
-	err = xcb_request_check(dpy->conn, xkbc);
-	if(err) {
-		handle_error(dpy, err, "xcb_xkb_select_events_aux_checked");
+	if(!x11_request(dpy, "xcb_xkb_select_events", xcb_xkb_select_events_aux,
+			dpy->keyboard.device_id, req_events, 0, 0,
+			req_map_parts, req_map_parts, &details)) {
 		goto err;
 	}
 
-	if(!swa_xkb_init_compose(xkb)) {
-		goto err;
-	}
+	// the compose table is loaded lazily on the first key press
+	swa_log_elapsed(&timing, "x11 startup: xkb");
+	swa_log_elapsed(&start, "x11 startup: total");
 
 	return &dpy->base;
 
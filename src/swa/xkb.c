@@ -1,8 +1,248 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <swa/private/xkb.h>
 #include <dlg/dlg.h>
 #include <xkbcommon/xkbcommon-compose.h>
 #include <locale.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+// Compiling a keymap from RMLVO names resolves the rules and reads
+// dozens of files from xkeyboard-config, which takes tens of ms on
+// slow devices. Compiled keymaps are therefore cached on disk in their
+// serialized form, which is much cheaper to parse.
+// Each cache file starts with a header containing the full cache key,
+// followed by the keymap string.
+#define CACHE_MAGIC "swa-xkb-cache 1\n"
+
+static uint64_t fnv1a(const char* str) {
+	uint64_t hash = 14695981039346656037ull;
+	for(; *str; ++str) {
+		hash ^= (unsigned char) *str;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Hashes path, modification time and size of all files in the given
+// directory and (up to `depth` levels of) its subdirectories.
+// Independent of the order in which readdir returns the entries.
+static uint64_t hash_dir(const char* path, unsigned depth) {
+	DIR* dir = opendir(path);
+	if(!dir) {
+		return 0u;
+	}
+
+	uint64_t hash = 0u;
+	struct dirent* ent;
+	while((ent = readdir(dir))) {
+		if(ent->d_name[0] == '.') {
+			continue;
+		}
+
+		char sub[512];
+		snprintf(sub, sizeof(sub), "%s/%s", path, ent->d_name);
+
+		struct stat st;
+		if(stat(sub, &st) != 0) {
+			continue;
+		}
+
+		char entry[600];
+		snprintf(entry, sizeof(entry), "%s %lld.%09ld %lld", sub,
+			(long long) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec,
+			(long long) st.st_size);
+		hash += fnv1a(entry);
+
+		if(S_ISDIR(st.st_mode) && depth > 0) {
+			hash += hash_dir(sub, depth - 1);
+		}
+	}
+
+	closedir(dir);
+	return hash;
+}
+
+// xkbcommon doesn't expose the xkeyboard-config version. We use the
+// path, modification time and size of the rules file instead, they
+// change whenever xkeyboard-config is updated.
+// The keymap also depends on the symbols, keycodes, types and compat
+// files which might come from any include path, e.g. user overrides in
+// $XDG_CONFIG_HOME/xkb that don't have a rules directory. Files might
+// also be edited in place, so we add a hash over modification times
+// and sizes of all component files to the key as well.
+static bool rules_version(struct xkb_context* ctx, const char* rules,
+		char* buf, size_t size) {
+	static const char* const dirs[] = {
+		"rules", "symbols", "keycodes", "types", "compat"
+	};
+
+	char rules_stat[560] = {0};
+	uint64_t files = 0u;
+	for(unsigned i = 0u; i < xkb_context_num_include_paths(ctx); ++i) {
+		const char* include = xkb_context_include_path_get(ctx, i);
+		char path[512];
+		for(unsigned d = 0u; d < sizeof(dirs) / sizeof(dirs[0]); ++d) {
+			snprintf(path, sizeof(path), "%s/%s", include, dirs[d]);
+			files += hash_dir(path, 2u);
+		}
+
+		struct stat st;
+		snprintf(path, sizeof(path), "%s/rules/%s", include, rules);
+		if(!*rules_stat && stat(path, &st) == 0) {
+			snprintf(rules_stat, sizeof(rules_stat), "%s %lld %lld", path,
+				(long long) st.st_mtime, (long long) st.st_size);
+		}
+	}
+
+	if(!*rules_stat) {
+		return false;
+	}
+
+	snprintf(buf, size, "%s %016llx", rules_stat, (unsigned long long) files);
+	return true;
+}
+
+// Writes the path of the cache file for the given key hash into buf,
+// creating the cache directory if needed.
+static bool cache_path(uint64_t hash, char* buf, size_t size) {
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	if(xdg && *xdg) {
+		snprintf(buf, size, "%s/swa", xdg);
+	} else if(home && *home) {
+		snprintf(buf, size, "%s/.cache", home);
+		mkdir(buf, 0755);
+		snprintf(buf, size, "%s/.cache/swa", home);
+	} else {
+		return false;
+	}
+
+	if(mkdir(buf, 0755) != 0 && errno != EEXIST) {
+		dlg_debug("mkdir(%s): %s", buf, strerror(errno));
+		return false;
+	}
+
+	size_t len = strlen(buf);
+	snprintf(buf + len, size - len, "/xkb-%016llx", (unsigned long long) hash);
+	return true;
+}
+
+static struct xkb_keymap* load_cached_keymap(struct xkb_context* ctx,
+		const char* path, const char* header) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	size_t header_len = strlen(header);
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size <= header_len) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t size = st.st_size;
+	char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		return NULL;
+	}
+
+	// the header guards against hash collisions and stale files
+	struct xkb_keymap* keymap = NULL;
+	if(memcmp(data, header, header_len) == 0) {
+		keymap = xkb_keymap_new_from_buffer(ctx, data + header_len,
+			size - header_len, XKB_KEYMAP_FORMAT_TEXT_V1,
+			XKB_KEYMAP_COMPILE_NO_FLAGS);
+	}
+
+	munmap(data, size);
+	return keymap;
+}
+
+static void store_cached_keymap(struct xkb_keymap* keymap,
+		const char* path, const char* header) {
+	char* str = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+	if(!str) {
+		return;
+	}
+
+	// write to a temporary file first so that concurrent readers
+	// never see a partially written file
+	char tmp[600];
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+	FILE* file = fopen(tmp, "w");
+	if(!file) {
+		dlg_debug("fopen(%s): %s", tmp, strerror(errno));
+		free(str);
+		return;
+	}
+
+	bool ok = fputs(header, file) >= 0 && fputs(str, file) >= 0;
+	ok = (fclose(file) == 0) && ok;
+	if(!ok || rename(tmp, path) != 0) {
+		dlg_debug("failed to write xkb keymap cache %s", path);
+		remove(tmp);
+	}
+
+	free(str);
+}
+
+struct xkb_keymap* swa_xkb_keymap_new_from_names(struct xkb_context* ctx,
+		const struct xkb_rule_names* names) {
+	// resolve the names like xkbcommon does so they can be used as key
+	struct xkb_rule_names rules = *names;
+	if(!rules.rules || !*rules.rules) rules.rules = getenv("XKB_DEFAULT_RULES");
+	if(!rules.model || !*rules.model) rules.model = getenv("XKB_DEFAULT_MODEL");
+	if(!rules.layout || !*rules.layout) rules.layout = getenv("XKB_DEFAULT_LAYOUT");
+	if(!rules.variant || !*rules.variant) rules.variant = getenv("XKB_DEFAULT_VARIANT");
+	if(!rules.options || !*rules.options) rules.options = getenv("XKB_DEFAULT_OPTIONS");
+
+	// SWA_XKB_NO_CACHE disables the cache, e.g. for debugging keymaps
+	const char* no_cache = getenv("SWA_XKB_NO_CACHE");
+	bool cacheable = !(no_cache && *no_cache && strcmp(no_cache, "0") != 0);
+
+	char version[600];
+	const char* rules_name = (rules.rules && *rules.rules) ? rules.rules : "evdev";
+	cacheable = cacheable &&
+		rules_version(ctx, rules_name, version, sizeof(version));
+
+	char header[1024];
+	char path[512];
+	if(cacheable) {
+		snprintf(header, sizeof(header), CACHE_MAGIC "%s\n%s\n%s\n%s\n%s\n%s\n",
+			version,
+			rules.rules ? rules.rules : "",
+			rules.model ? rules.model : "",
+			rules.layout ? rules.layout : "",
+			rules.variant ? rules.variant : "",
+			rules.options ? rules.options : "");
+		cacheable = cache_path(fnv1a(header), path, sizeof(path));
+	}
+
+	if(cacheable) {
+		struct xkb_keymap* keymap = load_cached_keymap(ctx, path, header);
+		if(keymap) {
+			return keymap;
+		}
+	}
+
+	struct xkb_keymap* keymap = xkb_keymap_new_from_names(ctx, &rules,
+		XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if(keymap && cacheable) {
+		store_cached_keymap(keymap, path, header);
+	}
+
+	return keymap;
+}
 
 bool swa_xkb_init_default(struct swa_xkb_context* xkb) {
 	xkb->context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
@@ -12,16 +252,9 @@ bool swa_xkb_init_default(struct swa_xkb_context* xkb) {
 	}
 
 	struct xkb_rule_names rules = {0};
-	rules.rules = getenv("XKB_DEFAULT_RULES");
-	rules.model = getenv("XKB_DEFAULT_MODEL");
-	rules.layout = getenv("XKB_DEFAULT_LAYOUT");
-	rules.variant = getenv("XKB_DEFAULT_VARIANT");
-	rules.options = getenv("XKB_DEFAULT_OPTIONS");
-
-	xkb->keymap = xkb_map_new_from_names(xkb->context, &rules,
-		XKB_KEYMAP_COMPILE_NO_FLAGS);
+	xkb->keymap = swa_xkb_keymap_new_from_names(xkb->context, &rules);
 	if(!xkb->keymap) {
-		dlg_error("xkb_map_new_from_names failed");
+		dlg_error("swa_xkb_keymap_new_from_names failed");
 		return false;
 	}
 
@@ -65,6 +298,7 @@ void swa_xkb_finish(struct swa_xkb_context* xkb) {
 	if(xkb->compose_table) xkb_compose_table_unref(xkb->compose_table);
 	if(xkb->compose_state) xkb_compose_state_unref(xkb->compose_state);
 
+	swa_xkb_key_names_finish(&xkb->names);
 	if(xkb->state) xkb_state_unref(xkb->state);
 	if(xkb->keymap) xkb_keymap_unref(xkb->keymap);
 	if(xkb->context) xkb_context_unref(xkb->context);
@@ -101,51 +335,81 @@ enum swa_keyboard_mod swa_xkb_modifiers(struct swa_xkb_context* xkb) {
 	return swa_xkb_modifiers_state(xkb->state);
 }
 
-void swa_xkb_key(struct swa_xkb_context* xkb, uint8_t keycode,
-		char** out_utf8, bool* canceled) {
+const char* swa_xkb_key(struct swa_xkb_context* xkb, uint8_t keycode,
+		char buf[static SWA_XKB_TEXT_SIZE], bool* canceled) {
 	xkb_keysym_t keysym = xkb_state_key_get_one_sym(xkb->state, keycode);
 	*canceled = false;
-	*out_utf8 = NULL;
 
-	xkb_compose_state_feed(xkb->compose_state, keysym);
-	enum xkb_compose_status status = xkb_compose_state_get_status(xkb->compose_state);
+	if(!xkb->compose_state && !xkb->compose_failed) {
+		xkb->compose_failed = !swa_xkb_init_compose(xkb);
+	}
+
+	enum xkb_compose_status status = XKB_COMPOSE_NOTHING;
+	if(xkb->compose_state) {
+		xkb_compose_state_feed(xkb->compose_state, keysym);
+		status = xkb_compose_state_get_status(xkb->compose_state);
+	}
+
+	// the returned counts don't include the terminator, buf is
+	// always null-terminated (and truncated if too small)
+	int count = 0;
 	if(status == XKB_COMPOSE_NOTHING) {
-		unsigned count = xkb_state_key_get_utf8(xkb->state, keycode, NULL, 0);
-		if(count > 0) {
-			*out_utf8 = malloc(count + 1);
-			xkb_state_key_get_utf8(xkb->state, keycode, *out_utf8, count + 1);
-		}
+		count = xkb_state_key_get_utf8(xkb->state, keycode,
+			buf, SWA_XKB_TEXT_SIZE);
 	} else if(status == XKB_COMPOSE_COMPOSED) {
-		unsigned count = xkb_compose_state_get_utf8(xkb->compose_state, NULL, 0);
-		if(count > 0) {
-			*out_utf8 = malloc(count + 1);
-			xkb_compose_state_get_utf8(xkb->compose_state, *out_utf8, count + 1);
-			xkb_compose_state_reset(xkb->compose_state);
-		}
+		count = xkb_compose_state_get_utf8(xkb->compose_state,
+			buf, SWA_XKB_TEXT_SIZE);
+		xkb_compose_state_reset(xkb->compose_state);
 	} else if(status == XKB_COMPOSE_CANCELLED) {
 		xkb_compose_state_reset(xkb->compose_state);
 		*canceled = true;
 	}
+
+	if(count >= (int) SWA_XKB_TEXT_SIZE) {
+		dlg_warn("key text truncated (%d bytes)", count);
+	}
+
+	return count > 0 ? buf : NULL;
 }
 
-const char* swa_xkb_key_name_keymap(struct xkb_keymap* keymap, enum swa_key key) {
-	uint8_t code = (uint8_t)key - 8;
-	// temporary dummy state, nothing pressed
-	struct xkb_state* state = xkb_state_new(keymap);
-	if(!state) {
-		dlg_error("xkb_state_new failed");
+void swa_xkb_key_names_finish(struct swa_xkb_key_names* names) {
+	if(names->state) xkb_state_unref(names->state);
+	if(names->keymap) xkb_keymap_unref(names->keymap);
+	memset(names, 0, sizeof(*names));
+}
+
+const char* swa_xkb_key_name_keymap(struct swa_xkb_key_names* names,
+		struct xkb_keymap* keymap, enum swa_key key) {
+	// xkb keycodes are offset by 8 from the evdev keycodes we use
+	unsigned code = (unsigned) key + 8;
+	if(code >= 256u) {
 		return NULL;
 	}
 
-	unsigned count = xkb_state_key_get_utf8(state, code, NULL, 0) + 1;
-	char* name = malloc(count);
-	xkb_state_key_get_utf8(state, code, name, count + 1);
-	xkb_state_unref(state);
-	return name;
+	if(names->keymap != keymap) {
+		swa_xkb_key_names_finish(names);
+		names->keymap = xkb_keymap_ref(keymap);
+	}
+
+	unsigned idx = code / 8;
+	unsigned bit = code % 8;
+	if(!(names->known[idx] & (1u << bit))) {
+		// temporary dummy state, nothing pressed
+		if(!names->state && !(names->state = xkb_state_new(keymap))) {
+			dlg_error("xkb_state_new failed");
+			return NULL;
+		}
+
+		xkb_state_key_get_utf8(names->state, code,
+			names->names[code], sizeof(names->names[code]));
+		names->known[idx] |= (uint8_t) (1u << bit);
+	}
+
+	return names->names[code][0] ? names->names[code] : NULL;
 }
 
 const char* swa_xkb_key_name(struct swa_xkb_context* xkb, enum swa_key key) {
-	return swa_xkb_key_name_keymap(xkb->keymap, key);
+	return swa_xkb_key_name_keymap(&xkb->names, xkb->keymap, key);
 }
 
 void swa_xkb_update_state(struct swa_xkb_context* xkb, int mods[3],